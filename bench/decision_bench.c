@@ -0,0 +1,422 @@
+// drives the decision process offline. fake interfaces stand in for the
+// links and the null io backend swallows every send, so only the protocol
+// code is measured. every workload runs in a process of its own and prints
+// one line of key=value pairs.
+//
+// usage: decision-bench [prefixes]
+
+#include "../logger/logger.h"
+#include "../mem/mem_utils.h"
+#include "../protocol/protocol.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_PREFIXES  10000
+#define BENCH_IFACES    4
+#define BENCH_LONG_PATH 64
+#define BENCH_HOST_ID   1
+#define BENCH_SEED      42
+
+// prefixes are /24s counted up from 11.0.0.0 without wrapping around.
+#define BENCH_PREFIX_BASE  0x0b000000u
+#define BENCH_PREFIXES_MAX ((0xffffffffu - BENCH_PREFIX_BASE) >> 8)
+
+struct bench_result {
+	const char* name;
+	u_int64_t*  latencies;  // ns per update
+	size_t      count;
+	double      seconds;
+};
+
+static struct null_backend_stats*
+sent_stats()
+{
+	return speaker->io_backend->priv;
+}
+
+static u_int64_t
+now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static in_addr_t
+prefix_of(size_t i)
+{
+	return htonl(BENCH_PREFIX_BASE + ((u_int32_t)i << 8));
+}
+
+static struct ifaddrs*
+iface_at(size_t i)
+{
+	struct ifaddrs* current = speaker->filtered_ifap;
+	for (i %= BENCH_IFACES; i; i--) {
+		current = current->ifa_next;
+	}
+	return current;
+}
+
+static void
+setup()
+{
+	protocol_init(0);
+	for (int i = BENCH_IFACES - 1; i >= 0; i--) {
+		in_addr_t     net   = htonl((10u << 24) | ((u_int32_t)i << 8));
+		struct iface* iface = NULL;
+		char          name[IF_NAMESIZE];
+
+		snprintf(name, sizeof(name), "bench%d", i);
+		iface = make_iface(name,
+		                   i + 1,
+		                   IFF_UP | IFF_BROADCAST,
+		                   net | htonl(1),
+		                   htonl(0xffffff00),
+		                   net | htonl(0xff));
+		LIST_INSERT_HEAD(&speaker->ifaces, iface, entries);
+	}
+	speaker->filtered_ifap = link_ifaces(&speaker->ifaces);
+	sent_stats()->messages = 0;
+}
+
+static void
+teardown()
+{
+	protocol_free();
+	free_ifaces(&speaker->ifaces);
+	speaker->filtered_ifap = NULL;
+}
+
+// the path never contains BENCH_HOST_ID, so no update is dropped as a loop.
+static struct update_message*
+make_update(int type, in_addr_t addr, u_int32_t weight, u_int32_t path_len)
+{
+	size_t size = sizeof(struct update_message) + path_len * sizeof(u_int64_t);
+	struct update_message* m_ptr = calloc(1, size);
+	m_ptr->size                  = size;
+	m_ptr->type                  = type;
+	m_ptr->addr                  = addr;
+	m_ptr->weight                = weight;
+	m_ptr->path_len              = path_len;
+	for (u_int32_t i = 0; i < path_len; i++) {
+		m_ptr->ASPATH[i] = BENCH_HOST_ID + 1 + i;
+	}
+	return m_ptr;
+}
+
+// updates come from the neighbor at .2 of the link.
+static in_addr_t
+neighbor_of(struct ifaddrs* recv_if)
+{
+	struct iface* iface = iface_of(recv_if);
+	return (iface->addr.sin_addr.s_addr & iface->netmask.sin_addr.s_addr) |
+	       htonl(2);
+}
+
+static void
+timed_decision(struct bench_result*   result,
+               struct update_message* m_ptr,
+               struct ifaddrs*        recv_if)
+{
+	u_int64_t start = now_ns();
+	decision(speaker->filtered_ifap,
+	         recv_if,
+	         neighbor_of(recv_if),
+	         (char*)m_ptr,
+	         m_ptr->size);
+	result->latencies[result->count++] = now_ns() - start;
+}
+
+static void
+announce_all(struct bench_result* result, size_t prefixes, u_int32_t path_len)
+{
+	for (size_t i = 0; i < prefixes; i++) {
+		CLEANUP_FREE struct update_message* m_ptr =
+		    make_update(MADD, prefix_of(i), 1 + i % 8, path_len);
+		timed_decision(result, m_ptr, iface_at(i));
+	}
+}
+
+// announces the table outside of the measured part.
+static void
+load_table(struct bench_result* result, size_t prefixes)
+{
+	struct bench_result load = *result;
+	announce_all(&load, prefixes, 1);
+	sent_stats()->messages = 0;
+}
+
+static void
+run_full_table(struct bench_result* result, size_t prefixes)
+{
+	announce_all(result, prefixes, 1);
+}
+
+static void
+run_long_aspath(struct bench_result* result, size_t prefixes)
+{
+	announce_all(result, prefixes, BENCH_LONG_PATH);
+}
+
+// random announcements and withdrawals over a loaded table. flapping
+// prefixes run into dampening just as they would in the daemon.
+static void
+run_churn(struct bench_result* result, size_t prefixes)
+{
+	load_table(result, prefixes);
+
+	char* present = malloc(prefixes);
+	memset(present, 1, prefixes);
+	for (size_t i = 0; i < prefixes; i++) {
+		size_t k    = rand() % prefixes;
+		int    type = present[k] ? MWITHDRAW : MADD;
+
+		CLEANUP_FREE struct update_message* m_ptr =
+		    make_update(type, prefix_of(k), 1 + k % 8, 1);
+		timed_decision(result, m_ptr, iface_at(k));
+		present[k] = !present[k];
+	}
+	free(present);
+}
+
+// withdraws the whole table in random order.
+static void
+run_withdraw_storm(struct bench_result* result, size_t prefixes)
+{
+	load_table(result, prefixes);
+
+	size_t* order = malloc(prefixes * sizeof(size_t));
+	for (size_t i = 0; i < prefixes; i++) {
+		order[i] = i;
+	}
+	for (size_t i = prefixes - 1; i > 0; i--) {
+		size_t j = rand() % (i + 1);
+		size_t t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+
+	for (size_t i = 0; i < prefixes; i++) {
+		size_t k = order[i];
+		CLEANUP_FREE struct update_message* m_ptr =
+		    make_update(MWITHDRAW, prefix_of(k), 0, 1);
+		timed_decision(result, m_ptr, iface_at(k));
+	}
+	free(order);
+}
+
+static void
+run_rib_insert(struct bench_result* result, size_t prefixes)
+{
+	for (size_t i = 0; i < prefixes; i++) {
+		struct routing_entry route = {
+		    .weight  = 1,
+		    .base    = prefix_of(i),
+		    .mask    = (in_addr_t)-1,
+		    .if_addr = iface_at(i),
+		};
+		u_int64_t start = now_ns();
+		add_new_route(&route);
+		result->latencies[result->count++] = now_ns() - start;
+	}
+}
+
+static void
+run_rib_withdraw(struct bench_result* result, size_t prefixes)
+{
+	struct bench_result load = *result;
+	run_rib_insert(&load, prefixes);
+
+	for (size_t i = 0; i < prefixes; i++) {
+		struct routing_entry route = {
+		    .base    = prefix_of(i),
+		    .if_addr = iface_at(i),
+		};
+		u_int64_t start = now_ns();
+		withdraw_route(&route);
+		result->latencies[result->count++] = now_ns() - start;
+	}
+}
+
+// every prefix is offered by all interfaces at the same weight, so the whole
+// table shares one next hop group.
+static void
+run_ecmp_insert(struct bench_result* result, size_t paths)
+{
+	for (size_t i = 0; i < paths; i++) {
+		struct routing_entry route = {
+		    .weight  = 1,
+		    .base    = prefix_of(i / BENCH_IFACES),
+		    .mask    = (in_addr_t)-1,
+		    .if_addr = iface_at(i),
+		};
+		u_int64_t start = now_ns();
+		add_new_route(&route);
+		result->latencies[result->count++] = now_ns() - start;
+	}
+}
+
+// one interface goes down under a multipath table. the single sample covers
+// the whole failover.
+static void
+run_ecmp_failover(struct bench_result* result, size_t paths)
+{
+	struct bench_result load = *result;
+	run_ecmp_insert(&load, paths);
+
+	u_int64_t start = now_ns();
+	iface_down(iface_of(iface_at(0)));
+	result->latencies[result->count++] = now_ns() - start;
+}
+
+static void
+run_add_aspath(struct bench_result* result, size_t prefixes)
+{
+	CLEANUP_FREE struct update_message* m_ptr =
+	    make_update(MADD, prefix_of(0), 1, BENCH_LONG_PATH);
+
+	for (size_t i = 0; i < prefixes; i++) {
+		u_int64_t              start = now_ns();
+		struct update_message* new   = add_aspath(m_ptr, BENCH_HOST_ID);
+		result->latencies[result->count++] = now_ns() - start;
+		free(new);
+	}
+}
+
+static int
+cmp_latency(const void* a, const void* b)
+{
+	u_int64_t x = *(const u_int64_t*)a;
+	u_int64_t y = *(const u_int64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static u_int64_t
+percentile(struct bench_result* result, double p)
+{
+	if (!result->count) {
+		return 0;
+	}
+	return result->latencies[(size_t)(p * (result->count - 1))];
+}
+
+static size_t
+count_routes()
+{
+	size_t                routes = 0;
+	struct routing_entry* current;
+	LIST_FOREACH (current, &speaker->routing_table, entries) {
+		++routes;
+	}
+	return routes;
+}
+
+static long
+peak_rss_kb()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+// the workload runs in a child, so its peak rss is its own rather than the
+// one of an earlier workload, and it starts from a fresh heap.
+static void
+run_workload(const char* name,
+             void (*workload)(struct bench_result*, size_t),
+             size_t prefixes)
+{
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		LOG_ERROR("failed to fork for %s. errno: %d", name, errno);
+		return;
+	}
+	if (pid) {
+		int status;
+		if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status)) {
+			LOG_ERROR("workload %s failed.", name);
+		}
+		return;
+	}
+
+	// tables loaded before the measured part record into the same buffer and
+	// are overwritten.
+	CLEANUP_FREE u_int64_t* latencies = calloc(prefixes, sizeof(u_int64_t));
+	struct bench_result     result    = {.name = name, .latencies = latencies};
+
+	setup();
+	u_int64_t start = now_ns();
+	workload(&result, prefixes);
+	u_int64_t elapsed = now_ns() - start;
+
+	u_int64_t total = 0;
+	for (size_t i = 0; i < result.count; i++) {
+		total += result.latencies[i];
+	}
+	result.seconds = total / 1e9;
+	qsort(result.latencies, result.count, sizeof(u_int64_t), cmp_latency);
+
+	printf("workload=%s updates=%zu seconds=%.3f updates_per_sec=%.0f "
+	       "p50_ns=%lu p99_ns=%lu routes=%zu nexthop_groups=%zu "
+	       "messages_sent=%lu wall_seconds=%.3f peak_rss_kb=%ld\n",
+	       result.name,
+	       result.count,
+	       result.seconds,
+	       result.seconds > 0 ? result.count / result.seconds : 0,
+	       percentile(&result, 0.50),
+	       percentile(&result, 0.99),
+	       count_routes(),
+	       speaker->nexthops.count,
+	       sent_stats()->messages,
+	       elapsed / 1e9,
+	       peak_rss_kb());
+	fflush(stdout);
+
+	teardown();
+	exit(0);
+}
+
+int
+main(int argc, char** argv)
+{
+	size_t prefixes = BENCH_PREFIXES;
+	if (argc > 1) {
+		prefixes = strtoul(argv[1], NULL, 10);
+	}
+	if (!prefixes || prefixes > BENCH_PREFIXES_MAX) {
+		printf("usage: %s [prefixes]\n", argv[0]);
+		printf("prefixes: 1 to %u\n", BENCH_PREFIXES_MAX);
+		return 1;
+	}
+
+	set_log_level(LERROR);
+	srand(BENCH_SEED);
+	speaker->host_id    = BENCH_HOST_ID;
+	speaker->io_backend = make_null_backend();
+	if (!speaker->io_backend) {
+		return 1;
+	}
+
+	run_workload("full_table", run_full_table, prefixes);
+	run_workload("churn", run_churn, prefixes);
+	run_workload("withdraw_storm", run_withdraw_storm, prefixes);
+	run_workload("long_aspath", run_long_aspath, prefixes);
+	run_workload("rib_insert", run_rib_insert, prefixes);
+	run_workload("rib_withdraw", run_rib_withdraw, prefixes);
+	run_workload("ecmp_insert", run_ecmp_insert, prefixes);
+	run_workload("ecmp_failover", run_ecmp_failover, prefixes);
+	run_workload("add_aspath", run_add_aspath, prefixes);
+
+	close_io_backend(speaker->io_backend);
+	return 0;
+}
@@ -0,0 +1,123 @@
+// compares the datagram io backends on loopback. every round fans out one
+// batch of update-sized datagrams and waits until the receiver consumed them,
+// which mirrors broadcast_update() followed by decision() on the neighbor.
+
+#include "../io/io_backend.h"
+#include "../logger/logger.h"
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_PORT     5353
+#define BENCH_ROUNDS   20000
+#define BENCH_BATCH    16
+#define BENCH_MSG_SIZE 64
+#define BENCH_WAIT_NS  (100 * 1000 * 1000L)
+
+struct bench_state {
+	struct io_backend* backend;
+	long               received;
+	int                stop;
+};
+
+static double
+now_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void*
+bench_receiver(void* arg)
+{
+	struct bench_state* state = arg;
+	struct io_datagram  dgram;
+
+	while (!__atomic_load_n(&state->stop, __ATOMIC_ACQUIRE)) {
+		if (state->backend->recv(state->backend, &dgram) < 0) {
+			continue;
+		}
+		if (dgram.len == BENCH_MSG_SIZE) {
+			__atomic_add_fetch(&state->received, 1, __ATOMIC_RELEASE);
+		}
+		state->backend->release(state->backend, &dgram);
+	}
+	return NULL;
+}
+
+static int
+run_bench(const char* name)
+{
+	struct bench_state state = {0};
+	state.backend            = open_io_backend(name, BENCH_PORT);
+	if (!state.backend) {
+		return -1;
+	}
+	if (strcmp(state.backend->name, name)) {
+		printf("backend=%s status=unavailable\n", name);
+		close_io_backend(state.backend);
+		return 0;
+	}
+
+	pthread_t tid;
+	pthread_create(&tid, NULL, bench_receiver, &state);
+
+	char               msg[BENCH_MSG_SIZE];
+	struct io_send_req reqs[BENCH_BATCH];
+	memset(msg, 0xab, sizeof(msg));
+
+	long   sent  = 0;
+	long   lost  = 0;
+	double start = now_sec();
+	for (int round = 0; round < BENCH_ROUNDS; round++) {
+		for (int i = 0; i < BENCH_BATCH; i++) {
+			memset(&reqs[i], 0, sizeof(reqs[i]));
+			reqs[i].dest.sin_family      = AF_INET;
+			reqs[i].dest.sin_port        = htons(BENCH_PORT);
+			reqs[i].dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			reqs[i].msg                  = msg;
+			reqs[i].len                  = sizeof(msg);
+		}
+		sent += BENCH_BATCH - state.backend->send_batch(
+		                          state.backend, reqs, BENCH_BATCH);
+
+		double deadline = now_sec() + BENCH_WAIT_NS / 1e9;
+		while (__atomic_load_n(&state.received, __ATOMIC_ACQUIRE) + lost <
+		       sent) {
+			if (now_sec() > deadline) {
+				lost = sent - __atomic_load_n(&state.received, __ATOMIC_ACQUIRE);
+				break;
+			}
+		}
+	}
+	double elapsed = now_sec() - start;
+
+	// wake the receiver with a short datagram so it can observe stop.
+	__atomic_store_n(&state.stop, 1, __ATOMIC_RELEASE);
+	reqs[0].len = 1;
+	state.backend->send_batch(state.backend, reqs, 1);
+	pthread_join(tid, NULL);
+
+	printf("backend=%s messages=%ld lost=%ld seconds=%.3f msgs_per_sec=%.0f\n",
+	       state.backend->name,
+	       sent,
+	       lost,
+	       elapsed,
+	       sent / elapsed);
+
+	close_io_backend(state.backend);
+	return 0;
+}
+
+int
+main(void)
+{
+	set_log_level(LERROR);
+	run_bench("syscall");
+	run_bench("uring");
+	return 0;
+}
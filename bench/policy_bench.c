@@ -0,0 +1,177 @@
+// measures loading and evaluating an import policy built around one large
+// prefix list. the list holds random prefixes between /8 and /24, mostly /24
+// like a full table, and the rules around it exercise every match term.
+// every list size prints one line of key=value pairs.
+//
+// usage: policy-bench [prefixes...]
+
+#include "../logger/logger.h"
+#include "../policy/policy.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define BENCH_EVALS    (1 << 22)
+#define BENCH_ADDRS    (1 << 16)  // distinct lookups, cycled through
+#define BENCH_PATH_LEN 8
+#define BENCH_SEED     42
+
+static u_int64_t
+now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static u_int32_t
+random_u32()
+{
+	return ((u_int32_t)rand() << 16) ^ (u_int32_t)rand();
+}
+
+static FILE*
+make_config(size_t prefixes)
+{
+	FILE* file = tmpfile();
+	if (!file) {
+		LOG_ERROR("failed to create policy file.");
+		return NULL;
+	}
+
+	fprintf(file, "prefix-list bogons\n");
+	fprintf(file, "\t0.0.0.0/8\n\t127.0.0.0/8\n\t224.0.0.0/3\n");
+	fprintf(file, "end\n");
+	fprintf(file, "prefix-list table\n");
+	for (size_t i = 0; i < prefixes; i++) {
+		int       len  = rand() % 4 ? 24 : 8 + rand() % 16;
+		u_int32_t addr = random_u32() & ((u_int32_t)-1 << (32 - len));
+		fprintf(file,
+		        "\t%u.%u.%u.%u/%d\n",
+		        addr >> 24,
+		        (addr >> 16) & 0xff,
+		        (addr >> 8) & 0xff,
+		        addr & 0xff,
+		        len);
+	}
+	fprintf(file, "end\n");
+	fprintf(file,
+	        "import\n"
+	        "\tdeny prefix-list bogons\n"
+	        "\tdeny aspath-contains 65001\n"
+	        "\tdeny weight-min 64\n"
+	        "\tpermit iface bench0 prefix 10.0.0.0/8 set-weight 1\n"
+	        "\tpermit prefix-list table weight-max 16 set-weight 2\n"
+	        "\tdefault deny\n"
+	        "end\n");
+	rewind(file);
+	return file;
+}
+
+static long
+peak_rss_kb()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+static int
+run(size_t prefixes)
+{
+	FILE* file = make_config(prefixes);
+	if (!file) {
+		return -1;
+	}
+	u_int64_t      start   = now_ns();
+	struct policy* policy  = policy_parse(file, "bench");
+	u_int64_t      compile = now_ns() - start;
+	fclose(file);
+	if (!policy) {
+		return -1;
+	}
+
+	// inputs are prepared up front so only the evaluation is timed.
+	struct policy_input* inputs = calloc(BENCH_ADDRS, sizeof(*inputs));
+	u_int64_t            path[BENCH_PATH_LEN];
+	for (int i = 0; i < BENCH_PATH_LEN; i++) {
+		path[i] = 100 + i;
+	}
+	for (size_t i = 0; i < BENCH_ADDRS; i++) {
+		inputs[i] = (struct policy_input){
+		    .addr     = htonl(random_u32()),
+		    .weight   = 1 + rand() % 20,
+		    .path     = path,
+		    .path_len = BENCH_PATH_LEN,
+		    .ifname   = "bench1",
+		};
+	}
+
+	size_t    permitted = 0;
+	u_int64_t weights   = 0;
+	start               = now_ns();
+	for (size_t i = 0; i < BENCH_EVALS; i++) {
+		u_int32_t weight;
+		if (policy_eval(policy,
+		                &policy->import,
+		                &inputs[i & (BENCH_ADDRS - 1)],
+		                &weight)) {
+			++permitted;
+			weights += weight;
+		}
+	}
+	u_int64_t elapsed = now_ns() - start;
+
+	size_t ranges = 0;
+	for (size_t i = 0; i < policy->set_count; i++) {
+		ranges += policy->sets[i].count;
+	}
+	printf("prefixes=%zu ranges=%zu insns=%zu compile_seconds=%.3f "
+	       "evals=%d ns_per_eval=%.1f evals_per_sec=%.0f permitted=%.4f "
+	       "peak_rss_kb=%ld\n",
+	       prefixes,
+	       ranges,
+	       policy->import.count,
+	       compile / 1e9,
+	       BENCH_EVALS,
+	       (double)elapsed / BENCH_EVALS,
+	       BENCH_EVALS / (elapsed / 1e9),
+	       (double)permitted / BENCH_EVALS,
+	       peak_rss_kb());
+	fflush(stdout);
+
+	// keeps the loop from being optimized away.
+	if (weights == (u_int64_t)-1) {
+		printf("\n");
+	}
+	free(inputs);
+	policy_free(policy);
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	set_log_level(LERROR);
+	srand(BENCH_SEED);
+
+	if (argc > 1) {
+		for (int i = 1; i < argc; i++) {
+			if (run(strtoul(argv[i], NULL, 10))) {
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	size_t sizes[] = {1000, 10000, 100000, 1000000};
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (run(sizes[i])) {
+			return 1;
+		}
+	}
+	return 0;
+}
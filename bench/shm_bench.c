@@ -0,0 +1,286 @@
+// measures lookups through the shared memory route export. the exporter of
+// the daemon fills a region of its own and reader threads map it through the
+// client library, like a process on the same host would. every workload
+// prints one line of key=value pairs.
+//
+// usage: shm-bench [routes]
+
+#include "../logger/logger.h"
+#include "../shm/shm_client.h"
+#include "../shm/shm_export.h"
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_ROUTES  50000
+#define BENCH_LOOKUPS (1 << 22)
+#define BENCH_SAMPLE  16  // every that many lookups are timed on their own
+#define BENCH_READERS 4
+#define BENCH_SEED    42
+
+struct bench_reader {
+	pthread_t    tid;
+	const char*  name;
+	u_int64_t    lookups;
+	u_int64_t    found;
+	u_int64_t    elapsed;
+	u_int64_t*   latencies;
+	size_t       sampled;
+	unsigned int seed;
+};
+
+static struct shm_export* shm;
+static size_t             route_count;
+static volatile int       writer_running;
+static u_int64_t          writer_updates;
+
+static u_int64_t
+now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+cmp_latency(const void* a, const void* b)
+{
+	u_int64_t x = *(const u_int64_t*)a;
+	u_int64_t y = *(const u_int64_t*)b;
+	return (x > y) - (x < y);
+}
+
+// most routes are /24s from 11/8 on, every 16th is a /16 from 64/8 on and
+// every 64th a host route in 100/8.
+static void
+route_at(size_t i, in_addr_t* base, u_int8_t* len)
+{
+	if (i % 64 == 63) {
+		*base = htonl((100u << 24) | (u_int32_t)i);
+		*len  = 32;
+	} else if (i % 16 == 15) {
+		*base = htonl((64u << 24) + ((u_int32_t)i / 16 << 16));
+		*len  = 16;
+	} else {
+		*base = htonl((11u << 24) + ((u_int32_t)i << 8));
+		*len  = 24;
+	}
+}
+
+static u_int32_t
+hops_at(size_t i, u_int32_t round, struct shm_rib_hop* hops)
+{
+	u_int32_t count = 1 + (i + round) % 4;
+	for (u_int32_t n = 0; n < count; n++) {
+		hops[n] = (struct shm_rib_hop){0, 1 + n};
+	}
+	return count;
+}
+
+static void
+load_routes(size_t count)
+{
+	struct shm_rib_hop hops[SHM_RIB_HOPS_MAX];
+	for (size_t i = 0; i < count; i++) {
+		in_addr_t base;
+		u_int8_t  len;
+		route_at(i, &base, &len);
+		shm_export_update(
+		    shm, base, len, 3, 2 + i % 5, hops, hops_at(i, 0, hops));
+	}
+}
+
+// half of the addresses fall into a route, the others into 200/8, which
+// has none.
+static in_addr_t
+random_addr(unsigned int* seed)
+{
+	u_int32_t value = rand_r(seed);
+	in_addr_t base;
+	u_int8_t  len;
+	if (value & 1) {
+		return htonl((200u << 24) | (value >> 8));
+	}
+	route_at((value >> 1) % route_count, &base, &len);
+	return base | (htonl(rand_r(seed)) & ~htonl(~0u << (32 - len)));
+}
+
+static void*
+reader_main(void* arg)
+{
+	struct bench_reader*   reader = arg;
+	struct shm_rib_reader* rib    = shm_rib_open(reader->name);
+	struct shm_rib_entry   entry;
+	if (!rib) {
+		perror("shm_rib_open");
+		return NULL;
+	}
+
+	u_int64_t start = now_ns();
+	for (u_int64_t i = 0; i < BENCH_LOOKUPS; i++) {
+		in_addr_t addr = random_addr(&reader->seed);
+		if (i % BENCH_SAMPLE) {
+			reader->found += shm_rib_lookup(rib, addr, &entry) == 1;
+			continue;
+		}
+		u_int64_t before = now_ns();
+		reader->found += shm_rib_lookup(rib, addr, &entry) == 1;
+		reader->latencies[reader->sampled++] = now_ns() - before;
+	}
+	reader->elapsed = now_ns() - start;
+	reader->lookups = BENCH_LOOKUPS;
+	shm_rib_close(rib);
+	return NULL;
+}
+
+// changes the hops of every route in turn, as fast as it can.
+static void*
+writer_main(void* arg)
+{
+	struct shm_rib_hop hops[SHM_RIB_HOPS_MAX];
+	u_int64_t          updates = 0;
+	for (u_int32_t round = 1; writer_running; round++) {
+		for (size_t i = 0; i < route_count && writer_running; i++) {
+			in_addr_t base;
+			u_int8_t  len;
+			route_at(i, &base, &len);
+			shm_export_update(shm,
+			                  base,
+			                  len,
+			                  3,
+			                  2 + i % 5,
+			                  hops,
+			                  hops_at(i, round, hops));
+			++updates;
+		}
+	}
+	writer_updates = updates;
+	return NULL;
+}
+
+static void
+run_readers(const char* workload, const char* name, int readers, int churn)
+{
+	struct bench_reader bench[BENCH_READERS];
+	pthread_t           writer;
+	size_t samples = BENCH_LOOKUPS / BENCH_SAMPLE * readers;
+	u_int64_t* latencies = malloc(samples * sizeof(u_int64_t));
+
+	writer_updates = 0;
+	writer_running = churn;
+	if (churn) {
+		pthread_create(&writer, NULL, writer_main, NULL);
+	}
+	u_int64_t start = now_ns();
+	for (int i = 0; i < readers; i++) {
+		bench[i] = (struct bench_reader){
+		    .name      = name,
+		    .latencies = latencies + i * (BENCH_LOOKUPS / BENCH_SAMPLE),
+		    .seed      = BENCH_SEED + i,
+		};
+		pthread_create(&bench[i].tid, NULL, reader_main, &bench[i]);
+	}
+
+	u_int64_t lookups = 0;
+	u_int64_t found   = 0;
+	u_int64_t busy    = 0;
+	size_t    sampled = 0;
+	for (int i = 0; i < readers; i++) {
+		pthread_join(bench[i].tid, NULL);
+		lookups += bench[i].lookups;
+		found += bench[i].found;
+		busy += bench[i].elapsed;
+		memmove(latencies + sampled,
+		        bench[i].latencies,
+		        bench[i].sampled * sizeof(u_int64_t));
+		sampled += bench[i].sampled;
+	}
+	u_int64_t elapsed = now_ns() - start;
+	writer_running    = 0;
+	if (churn) {
+		pthread_join(writer, NULL);
+	}
+	qsort(latencies, sampled, sizeof(u_int64_t), cmp_latency);
+
+	printf("workload=%s readers=%d routes=%u lookups=%lu hit_ratio=%.3f "
+	       "ns_per_lookup=%.1f lookups_per_sec=%.0f p50_ns=%lu p99_ns=%lu "
+	       "writer_updates_per_sec=%.0f\n",
+	       workload,
+	       readers,
+	       shm->header->count,
+	       lookups,
+	       lookups ? (double)found / lookups : 0,
+	       lookups ? (double)busy / lookups : 0,
+	       lookups / (elapsed / 1e9),
+	       sampled ? latencies[sampled / 2] : 0,
+	       sampled ? latencies[sampled * 99 / 100] : 0,
+	       writer_updates / (elapsed / 1e9));
+	fflush(stdout);
+	free(latencies);
+}
+
+static void
+run_dump(const char* name)
+{
+	struct shm_rib_reader* rib     = shm_rib_open(name);
+	struct shm_rib_entry*  entries = calloc(route_count, sizeof(*entries));
+	if (!rib || !entries) {
+		perror("shm_rib_open");
+		free(entries);
+		shm_rib_close(rib);
+		return;
+	}
+	u_int64_t start   = now_ns();
+	ssize_t   count   = shm_rib_dump(rib, entries, route_count);
+	u_int64_t elapsed = now_ns() - start;
+	printf("workload=dump routes=%zd seconds=%.3f routes_per_sec=%.0f\n",
+	       count,
+	       elapsed / 1e9,
+	       count / (elapsed / 1e9));
+	fflush(stdout);
+	free(entries);
+	shm_rib_close(rib);
+}
+
+int
+main(int argc, char** argv)
+{
+	route_count = BENCH_ROUTES;
+	if (argc > 1) {
+		route_count = strtoul(argv[1], NULL, 10);
+	}
+	if (!route_count) {
+		printf("usage: %s [routes]\n", argv[0]);
+		return 1;
+	}
+
+	set_log_level(LERROR);
+	char name[64];
+	snprintf(name, sizeof(name), "/bgp-shm-bench-%d", getpid());
+	shm = shm_export_create(name, route_count * 8 / 5 + 1, 1);
+	if (!shm) {
+		return 1;
+	}
+
+	u_int64_t start = now_ns();
+	load_routes(route_count);
+	u_int64_t elapsed = now_ns() - start;
+	printf("workload=load routes=%u seconds=%.3f updates_per_sec=%.0f\n",
+	       shm->header->count,
+	       elapsed / 1e9,
+	       route_count / (elapsed / 1e9));
+	fflush(stdout);
+
+	run_readers("lookup", name, 1, 0);
+	run_readers("lookup", name, BENCH_READERS, 0);
+	run_readers("lookup_churn", name, 1, 1);
+	run_readers("lookup_churn", name, BENCH_READERS, 1);
+	run_dump(name);
+
+	shm_export_close(shm);
+	return 0;
+}
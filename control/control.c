@@ -0,0 +1,610 @@
+#define _GNU_SOURCE
+#include "control.h"
+#include "../logger/logger.h"
+#include "../mem/mem_account.h"
+#include "../protocol/protocol.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static void
+append(struct control_conn* conn, const char* format, ...)
+{
+	size_t  space = CONTROL_OUT_SIZE - conn->out_len;
+	va_list args;
+	va_start(args, format);
+	int n = vsnprintf(conn->out + conn->out_len, space, format, args);
+	va_end(args);
+	if (n > 0) {
+		conn->out_len += (size_t)n < space ? (size_t)n : space - 1;
+	}
+}
+
+// route lines make up nearly all of a dump and are formatted by hand,
+// vsnprintf() and inet_ntop() took four times as long.
+static char*
+put_str(char* out, const char* str)
+{
+	while (*str) {
+		*out++ = *str++;
+	}
+	return out;
+}
+
+static char*
+put_u32(char* out, u_int32_t value)
+{
+	char   digits[10];
+	size_t n = 0;
+	do {
+		digits[n++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	while (n) {
+		*out++ = digits[--n];
+	}
+	return out;
+}
+
+static char*
+put_addr(char* out, in_addr_t addr)
+{
+	const u_int8_t* bytes = (const u_int8_t*)&addr;
+	for (int i = 0; i < 4; i++) {
+		out = put_u32(out, bytes[i]);
+		*out++ = i < 3 ? '.' : ' ';
+	}
+	return out;
+}
+
+// at most CONTROL_LINE_MAX bytes, interface names are short.
+static void
+append_route(struct control_conn* conn, const struct control_route* route)
+{
+	char* out = conn->out + conn->out_len;
+	out       = put_str(out, "route prefix=");
+	out       = put_addr(out, route->base);
+	out[-1]   = '/';
+	out       = put_u32(out, __builtin_popcount(route->mask));
+	out       = put_str(out, " gateway=");
+	out       = put_addr(out, route->gateway);
+	out       = put_str(out, "iface=");
+	out       = put_str(out, route->iface->name);
+	out       = put_str(out, " weight=");
+	out       = put_u32(out, route->weight);
+	out       = put_str(out, " path_len=");
+	out       = put_u32(out, route->path_len);
+	out       = put_str(out, " paths=");
+	out       = put_u32(out, route->paths);
+	out       = put_str(out, " hops=");
+	out       = put_u32(out, route->hops);
+	*out++    = '\n';
+	conn->out_len = out - conn->out;
+}
+
+static void
+copy_route(struct control_route* dest, struct routing_entry* best)
+{
+	struct rib_prefix*    prefix = best->prefix;
+	struct nexthop_group* group  = nexthop_handle_group(prefix->handle);
+	dest->base                   = best->base;
+	dest->mask                   = best->mask;
+	dest->gateway                = best->gateway;
+	dest->weight                 = best->weight;
+	dest->path_len               = best->path_len;
+	dest->paths                  = prefix->path_count;
+	dest->hops                   = group ? group->count : 0;
+	dest->iface                  = iface_of(best->if_addr);
+}
+
+static void
+free_snapshot(struct control_snapshot* snapshot)
+{
+	if (snapshot->routes) {
+		mem_uncharge(MEM_BUFFERS,
+		             snapshot->capacity * sizeof(struct control_route));
+	}
+	free(snapshot->routes);
+	snapshot->routes   = NULL;
+	snapshot->count    = 0;
+	snapshot->capacity = 0;
+}
+
+// every prefix in the rib has a best path, prefix_count bounds the copy. the
+// buffer is sized and faulted in before the lock is taken, only the copy
+// holds it, for about 0.1s per million routes.
+static int
+take_snapshot(struct control_server* server, struct control_snapshot* snapshot)
+{
+	free_snapshot(snapshot);
+
+	pthread_mutex_lock(server->lock);
+	size_t capacity = speaker->rib.prefix_count;
+	pthread_mutex_unlock(server->lock);
+
+	capacity += capacity / 16 + 64;
+	struct control_route* routes =
+	    malloc(capacity * sizeof(struct control_route));
+	if (!routes) {
+		LOG_ERROR("failed to allocate control snapshot.");
+		return -1;
+	}
+	memset(routes, 0, capacity * sizeof(struct control_route));
+
+	pthread_mutex_lock(server->lock);
+	if (speaker->rib.prefix_count > capacity) {
+		capacity = speaker->rib.prefix_count;
+		struct control_route* grown =
+		    realloc(routes, capacity * sizeof(struct control_route));
+		if (!grown) {
+			pthread_mutex_unlock(server->lock);
+			LOG_ERROR("failed to allocate control snapshot.");
+			free(routes);
+			return -1;
+		}
+		routes = grown;
+	}
+	size_t                count = 0;
+	struct routing_entry* current;
+	LIST_FOREACH (current, &speaker->routing_table, entries) {
+		if (count == capacity) {
+			break;
+		}
+		copy_route(&routes[count++], current);
+	}
+	pthread_mutex_unlock(server->lock);
+
+	mem_charge(MEM_BUFFERS, capacity * sizeof(struct control_route));
+	snapshot->routes   = routes;
+	snapshot->count    = count;
+	snapshot->capacity = capacity;
+	return 0;
+}
+
+static struct rib_prefix*
+longest_match(in_addr_t addr)
+{
+	for (int len = 32; len >= 0; len--) {
+		in_addr_t          mask   = len ? htonl(~0u << (32 - len)) : 0;
+		struct rib_prefix* prefix = rib_find(&speaker->rib, addr & mask);
+		if (prefix && prefix->best && prefix->best->mask == mask) {
+			return prefix;
+		}
+	}
+	return NULL;
+}
+
+static void
+answer_lookup(struct control_server* server,
+              struct control_conn*   conn,
+              in_addr_t              addr)
+{
+	struct control_route route;
+	struct nexthop       hops[NEXTHOP_GROUP_MAX];
+	u_int32_t            hop_count = 0;
+
+	pthread_mutex_lock(server->lock);
+	struct rib_prefix* prefix = longest_match(addr);
+	if (prefix) {
+		copy_route(&route, prefix->best);
+		struct nexthop_group* group = nexthop_handle_group(prefix->handle);
+		if (group) {
+			hop_count = group->count;
+			memcpy(hops, group->hops, hop_count * sizeof(*hops));
+		}
+	}
+	pthread_mutex_unlock(server->lock);
+
+	if (!prefix) {
+		append(conn, "end routes=0\n");
+		return;
+	}
+	append_route(conn, &route);
+	for (u_int32_t i = 0; i < hop_count; i++) {
+		char gateway[INET_ADDRSTRLEN];
+		inet_ntop(AF_INET, &hops[i].gateway, gateway, sizeof(gateway));
+		append(conn,
+		       "hop gateway=%s iface=%s\n",
+		       gateway,
+		       hops[i].if_addr->ifa_name);
+	}
+	append(conn, "end routes=1\n");
+}
+
+static void
+answer_count(struct control_server* server, struct control_conn* conn)
+{
+	pthread_mutex_lock(server->lock);
+	append(conn,
+	       "count prefixes=%zu paths=%zu groups=%zu memory_bytes=%lu\n",
+	       speaker->rib.prefix_count,
+	       speaker->rib.path_count,
+	       speaker->nexthops.count,
+	       mem_total());
+	struct iface* iface;
+	LIST_FOREACH (iface, &speaker->ifaces, entries) {
+		append(conn,
+		       "iface name=%s up=%d paths=%zu\n",
+		       iface->name,
+		       iface->up,
+		       iface->route_count);
+	}
+	pthread_mutex_unlock(server->lock);
+	append(conn, "end\n");
+}
+
+static int
+matches(const struct control_query* query, const struct control_route* route)
+{
+	if (query->filter == CONTROL_IFACE) {
+		return route->iface == query->iface;
+	}
+	if (query->filter == CONTROL_GATEWAY) {
+		return route->gateway == query->gateway;
+	}
+	return 1;
+}
+
+// stops with room for one more line, the socket takes the rest first.
+static void
+encode_routes(struct control_conn* conn)
+{
+	struct control_query*    query    = &conn->query;
+	struct control_snapshot* snapshot = &conn->snapshot;
+
+	while (CONTROL_OUT_SIZE - conn->out_len > CONTROL_LINE_MAX) {
+		if (!query->remains) {
+			append(conn,
+			       "end routes=%zu next=%zu\n",
+			       query->sent,
+			       query->offset + query->sent);
+			query->running = 0;
+			return;
+		}
+		if (query->cursor == snapshot->count) {
+			append(conn, "end routes=%zu\n", query->sent);
+			query->running = 0;
+			return;
+		}
+		struct control_route* route = &snapshot->routes[query->cursor++];
+		if (!matches(query, route)) {
+			continue;
+		}
+		if (query->skip) {
+			--query->skip;
+			continue;
+		}
+		append_route(conn, route);
+		--query->remains;
+		++query->sent;
+	}
+}
+
+static int
+parse_count(const char* arg, size_t* value)
+{
+	char* end;
+	if (!arg) {
+		return 0;
+	}
+	*value = strtoull(arg, &end, 10);
+	return end == arg || *end ? -1 : 0;
+}
+
+static struct iface*
+find_iface_by_name(struct control_server* server, const char* name)
+{
+	struct iface* iface;
+	pthread_mutex_lock(server->lock);
+	LIST_FOREACH (iface, &speaker->ifaces, entries) {
+		if (!strcmp(iface->name, name)) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(server->lock);
+	return iface;
+}
+
+// what follows the command in args: [iface <name> | gateway <addr>]
+// [offset [limit]].
+static const char*
+start_routes(struct control_server* server,
+             struct control_conn*   conn,
+             enum control_filter    filter,
+             char**                 save)
+{
+	struct control_query* query = &conn->query;
+	memset(query, 0, sizeof(*query));
+	query->filter = filter;
+
+	if (filter == CONTROL_IFACE) {
+		char* name = strtok_r(NULL, " \r", save);
+		if (!name || !(query->iface = find_iface_by_name(server, name))) {
+			return "unknown interface";
+		}
+	} else if (filter == CONTROL_GATEWAY) {
+		char* addr = strtok_r(NULL, " \r", save);
+		if (!addr || inet_pton(AF_INET, addr, &query->gateway) != 1) {
+			return "invalid gateway";
+		}
+	}
+
+	size_t limit = 0;
+	if (parse_count(strtok_r(NULL, " \r", save), &query->offset) ||
+	    parse_count(strtok_r(NULL, " \r", save), &limit)) {
+		return "invalid offset or limit";
+	}
+	query->skip    = query->offset;
+	query->remains = limit ? limit : SIZE_MAX;
+
+	if (!conn->snapshot.routes && take_snapshot(server, &conn->snapshot)) {
+		return "out of memory";
+	}
+	query->running = 1;
+	return NULL;
+}
+
+static void
+handle_request(struct control_server* server,
+               struct control_conn*   conn,
+               char*                  line)
+{
+	char*       save;
+	const char* error   = NULL;
+	char*       command = strtok_r(line, " \r", &save);
+
+	if (!command) {
+		error = "empty request";
+	} else if (!strcmp(command, "lookup")) {
+		char*     arg = strtok_r(NULL, " \r", &save);
+		in_addr_t addr;
+		if (!arg || inet_pton(AF_INET, arg, &addr) != 1) {
+			error = "invalid address";
+		} else {
+			answer_lookup(server, conn, addr);
+		}
+	} else if (!strcmp(command, "routes")) {
+		char* filter = strtok_r(NULL, " \r", &save);
+		if (filter && !strcmp(filter, "iface")) {
+			error = start_routes(server, conn, CONTROL_IFACE, &save);
+		} else if (filter && !strcmp(filter, "gateway")) {
+			error = start_routes(server, conn, CONTROL_GATEWAY, &save);
+		} else {
+			error = "routes needs iface or gateway";
+		}
+	} else if (!strcmp(command, "dump")) {
+		error = start_routes(server, conn, CONTROL_ALL, &save);
+	} else if (!strcmp(command, "count")) {
+		answer_count(server, conn);
+	} else if (!strcmp(command, "snapshot")) {
+		if (take_snapshot(server, &conn->snapshot)) {
+			error = "out of memory";
+		} else {
+			append(conn, "end routes=%zu\n", conn->snapshot.count);
+		}
+	} else {
+		error = "unknown command";
+	}
+
+	if (error) {
+		append(conn, "error message=%s\n", error);
+	}
+}
+
+// returns -1 when the connection is done with.
+static int
+run_conn(struct control_server* server, struct control_conn* conn)
+{
+	while (1) {
+		if (conn->out_sent < conn->out_len) {
+			ssize_t n = send(conn->fd,
+			                 conn->out + conn->out_sent,
+			                 conn->out_len - conn->out_sent,
+			                 MSG_NOSIGNAL);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+			}
+			conn->out_sent += n;
+			continue;
+		}
+		conn->out_len  = 0;
+		conn->out_sent = 0;
+
+		if (conn->query.running) {
+			encode_routes(conn);
+			continue;
+		}
+
+		char* eol = memchr(conn->in, '\n', conn->in_len);
+		if (!eol) {
+			if (conn->in_len == CONTROL_LINE_MAX) {
+				append(conn, "error message=request too long\n");
+				conn->in_len = 0;
+				conn->eof    = 1;
+				continue;
+			}
+			return conn->eof ? -1 : 0;
+		}
+		*eol        = '\0';
+		size_t used = eol - conn->in + 1;
+		handle_request(server, conn, conn->in);
+		memmove(conn->in, conn->in + used, conn->in_len - used);
+		conn->in_len -= used;
+	}
+}
+
+static int
+read_conn(struct control_conn* conn)
+{
+	while (conn->in_len < CONTROL_LINE_MAX) {
+		ssize_t n = read(conn->fd,
+		                 conn->in + conn->in_len,
+		                 CONTROL_LINE_MAX - conn->in_len);
+		if (n == 0) {
+			conn->eof = 1;
+			return 0;
+		}
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		conn->in_len += n;
+	}
+	return 0;
+}
+
+static void
+free_conn(struct control_server* server, struct control_conn* conn)
+{
+	LIST_REMOVE(conn, entries);
+	--server->conn_count;
+	close(conn->fd);
+	free_snapshot(&conn->snapshot);
+	mem_uncharge(MEM_BUFFERS, sizeof(struct control_conn));
+	free(conn);
+}
+
+static void
+accept_conn(struct control_server* server)
+{
+	int fd =
+	    accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			LOG_WARN("failed to accept control connection. errno: %d",
+			         errno);
+		}
+		return;
+	}
+	struct control_conn* conn = calloc(1, sizeof(struct control_conn));
+	if (!conn) {
+		LOG_ERROR("failed to allocate control connection.");
+		close(fd);
+		return;
+	}
+	mem_charge(MEM_BUFFERS, sizeof(struct control_conn));
+	conn->fd = fd;
+	LIST_INSERT_HEAD(&server->conns, conn, entries);
+	++server->conn_count;
+}
+
+struct control_server*
+control_open(const char* path, pthread_mutex_t* lock)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		LOG_ERROR("control socket path too long: %s", path);
+		return NULL;
+	}
+	strcpy(addr.sun_path, path);
+
+	struct control_server* server = calloc(1, sizeof(struct control_server));
+	if (!server || !(server->path = strdup(path))) {
+		LOG_ERROR("failed to allocate control server.");
+		free(server);
+		return NULL;
+	}
+	server->lock = lock;
+	LIST_INIT(&server->conns);
+
+	server->listen_fd =
+	    socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (server->listen_fd < 0) {
+		LOG_ERROR("failed to create control socket. errno: %d", errno);
+		free(server->path);
+		free(server);
+		return NULL;
+	}
+	// a socket file left over by an earlier run would fail the bind.
+	unlink(path);
+	if (bind(server->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+	    listen(server->listen_fd, CONTROL_CONNS_MAX) < 0) {
+		LOG_ERROR("failed to listen on %s. errno: %d", path, errno);
+		close(server->listen_fd);
+		free(server->path);
+		free(server);
+		return NULL;
+	}
+	return server;
+}
+
+// a connection with output pending is not read from, a client that does not
+// read its answers cannot make the daemon buffer more.
+int
+control_serve(struct control_server* server, int timeout)
+{
+	struct pollfd        fds[CONTROL_CONNS_MAX + 1];
+	struct control_conn* conns[CONTROL_CONNS_MAX];
+	size_t               count = 0;
+
+	fds[0] = (struct pollfd){
+	    .fd     = server->listen_fd,
+	    .events = server->conn_count < CONTROL_CONNS_MAX ? POLLIN : 0,
+	};
+	struct control_conn* current;
+	LIST_FOREACH (current, &server->conns, entries) {
+		int writing  = current->out_sent < current->out_len;
+		conns[count] = current;
+		fds[++count] = (struct pollfd){
+		    .fd     = current->fd,
+		    .events = writing ? POLLOUT : POLLIN,
+		};
+	}
+
+	if (poll(fds, count + 1, timeout) < 0) {
+		if (errno != EINTR) {
+			LOG_WARN("control poll failed. errno: %d", errno);
+			return -1;
+		}
+		return 0;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		short revents = fds[i + 1].revents;
+		if (!revents) {
+			continue;
+		}
+		if ((revents & (POLLIN | POLLHUP | POLLERR)) &&
+		    read_conn(conns[i]) < 0) {
+			free_conn(server, conns[i]);
+			continue;
+		}
+		if (run_conn(server, conns[i]) < 0) {
+			free_conn(server, conns[i]);
+		}
+	}
+	if (fds[0].revents & POLLIN) {
+		accept_conn(server);
+	}
+	return 0;
+}
+
+void
+control_close(struct control_server* server)
+{
+	if (!server) {
+		return;
+	}
+	struct control_conn* current;
+	while ((current = LIST_FIRST(&server->conns))) {
+		free_conn(server, current);
+	}
+	close(server->listen_fd);
+	unlink(server->path);
+	free(server->path);
+	free(server);
+}
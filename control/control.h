@@ -0,0 +1,100 @@
+#ifndef BGP_CONTROL_H
+#define BGP_CONTROL_H
+
+#include "../iface/iface.h"
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/queue.h>
+#include <sys/types.h>
+
+// answers queries about the routing table on a unix socket, apart from the
+// cli and the log. a request is one line, the answer lines of key=value pairs
+// closed by an "end" line, or a single "error" line:
+//
+//   lookup <addr>                           best route covering addr
+//   routes iface <name> [offset [limit]]    best routes through an interface
+//   routes gateway <addr> [offset [limit]]  best routes via a gateway
+//   dump [offset [limit]]                   all best routes
+//   count                                   sizes of the tables
+//   snapshot                                takes a new snapshot
+//
+// routes and dump read a copy of the best routes the connection takes on its
+// first such request and keeps until it asks for a new one, so offsets page
+// through one consistent table. the routing lock is only held while copying.
+// answers are encoded as the socket drains, a dump of any size needs no more
+// than one output buffer per connection. the end line of a full page carries
+// the offset of the next one.
+#define CONTROL_CONNS_MAX 8
+#define CONTROL_LINE_MAX  256
+#define CONTROL_OUT_SIZE  (64 * 1024)
+
+struct control_route {
+	in_addr_t     base;
+	in_addr_t     mask;
+	in_addr_t     gateway;
+	u_int32_t     weight;
+	u_int32_t     path_len;
+	u_int32_t     paths;
+	u_int32_t     hops;
+	struct iface* iface;  // ifaces are never freed while running
+};
+
+struct control_snapshot {
+	struct control_route* routes;
+	size_t                count;
+	size_t                capacity;
+};
+
+enum control_filter {
+	CONTROL_ALL = 0,
+	CONTROL_IFACE,
+	CONTROL_GATEWAY,
+};
+
+// a routes or dump answer in progress. cursor is the next route of the
+// snapshot to look at, skip the matches left to pass over for the offset.
+struct control_query {
+	int                 running;
+	enum control_filter filter;
+	struct iface*       iface;
+	in_addr_t           gateway;
+	size_t              cursor;
+	size_t              offset;
+	size_t              skip;
+	size_t              remains;  // SIZE_MAX without a limit
+	size_t              sent;
+};
+
+struct control_conn {
+	int                     fd;
+	int                     eof;  // answered the requests left, then closed
+	char                    in[CONTROL_LINE_MAX];
+	size_t                  in_len;
+	char                    out[CONTROL_OUT_SIZE];
+	size_t                  out_len;
+	size_t                  out_sent;
+	struct control_query    query;
+	struct control_snapshot snapshot;
+	LIST_ENTRY(control_conn) entries;
+};
+
+LIST_HEAD(control_conn_list, control_conn);
+
+// lock guards the speaker, it is the routing lock of the daemon.
+struct control_server {
+	int                      listen_fd;
+	char*                    path;
+	pthread_mutex_t*         lock;
+	size_t                   conn_count;
+	struct control_conn_list conns;
+};
+
+struct control_server* control_open(const char* path, pthread_mutex_t* lock);
+
+// waits up to timeout ms, -1 for ever, for the sockets and serves whatever
+// they are ready for.
+int control_serve(struct control_server* server, int timeout);
+
+void control_close(struct control_server* server);
+
+#endif  // BGP_CONTROL_H
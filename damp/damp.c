@@ -0,0 +1,263 @@
+#include "damp.h"
+#include "../hash/hash.h"
+#include "../logger/logger.h"
+#include "../mem/mem_account.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// defaults follow the route flap damping parameters of RFC 2439.
+void
+damp_default_config(struct damp_config* config, u_int64_t tick_ms)
+{
+	u_int64_t ticks_per_sec = 1000 / tick_ms;
+
+	config->half_life           = 15 * 60 * ticks_per_sec;
+	config->granularity         = 5 * ticks_per_sec;
+	config->withdraw_penalty    = 1000;
+	config->readvertise_penalty = 500;
+	config->suppress_limit      = 2000;
+	config->reuse_limit         = 750;
+	// at most 60 minutes of suppression, i.e. four half lives above reuse.
+	config->max_penalty  = config->reuse_limit * 16;
+	config->forget_limit = config->reuse_limit / 2;
+}
+
+int
+damp_init(struct damp_table*        table,
+          const struct damp_config* config,
+          u_int64_t                 now)
+{
+	table->config       = *config;
+	table->bucket_count = DAMP_HASH_INIT;
+	table->buckets      = calloc(table->bucket_count, sizeof(struct damp_list));
+	if (!table->buckets) {
+		LOG_ERROR("failed to allocate dampening table.");
+		return -1;
+	}
+	mem_charge(MEM_DAMPENING, table->bucket_count * sizeof(struct damp_list));
+	for (size_t i = 0; i < table->bucket_count; i++) {
+		LIST_INIT(&table->buckets[i]);
+	}
+	for (size_t i = 0; i < DAMP_REUSE_SLOTS; i++) {
+		LIST_INIT(&table->reuse[i]);
+	}
+	table->reuse_index = 0;
+	table->reuse_tick  = now;
+	memset(&table->stats, 0, sizeof(table->stats));
+	return 0;
+}
+
+void
+damp_free(struct damp_table* table)
+{
+	struct damp_entry* current;
+	for (size_t i = 0; i < table->bucket_count; i++) {
+		while ((current = LIST_FIRST(&table->buckets[i]))) {
+			LIST_REMOVE(current, hash_entries);
+			LIST_REMOVE(current, reuse_entries);
+			mem_uncharge(MEM_DAMPENING, sizeof(struct damp_entry));
+			free(current);
+		}
+	}
+	if (table->buckets) {
+		mem_uncharge(MEM_DAMPENING,
+		             table->bucket_count * sizeof(struct damp_list));
+	}
+	free(table->buckets);
+	table->buckets      = NULL;
+	table->bucket_count = 0;
+}
+
+static struct damp_entry*
+lookup(struct damp_table* table, in_addr_t base)
+{
+	struct damp_entry* current;
+	LIST_FOREACH (current,
+	              &table->buckets[hash_addr(base, table->bucket_count)],
+	              hash_entries) {
+		if (current->base == base) {
+			return current;
+		}
+	}
+	return NULL;
+}
+
+static void
+grow(struct damp_table* table)
+{
+	size_t            new_count   = table->bucket_count * 2;
+	struct damp_list* new_buckets = calloc(new_count, sizeof(struct damp_list));
+	if (!new_buckets) {
+		LOG_WARN("failed to grow dampening table.");
+		return;
+	}
+	for (size_t i = 0; i < new_count; i++) {
+		LIST_INIT(&new_buckets[i]);
+	}
+
+	struct damp_entry* current;
+	for (size_t i = 0; i < table->bucket_count; i++) {
+		while ((current = LIST_FIRST(&table->buckets[i]))) {
+			LIST_REMOVE(current, hash_entries);
+			LIST_INSERT_HEAD(&new_buckets[hash_addr(current->base, new_count)],
+			                 current,
+			                 hash_entries);
+		}
+	}
+	mem_recharge(MEM_DAMPENING,
+	             table->bucket_count * sizeof(struct damp_list),
+	             new_count * sizeof(struct damp_list));
+	free(table->buckets);
+	table->buckets      = new_buckets;
+	table->bucket_count = new_count;
+}
+
+static void
+decay(struct damp_table* table, struct damp_entry* entry, u_int64_t now)
+{
+	if (now > entry->last_update) {
+		entry->penalty *= exp2(-(double)(now - entry->last_update) /
+		                       table->config.half_life);
+		entry->last_update = now;
+	}
+}
+
+// puts the entry into the bucket of the moment it will drop below the reuse
+// limit, or below the forget limit when it is not suppressed.
+static void
+schedule(struct damp_table* table, struct damp_entry* entry, u_int64_t now)
+{
+	double limit = entry->suppressed ? table->config.reuse_limit
+	                                 : table->config.forget_limit;
+	u_int64_t due = now;
+	if (entry->penalty > limit) {
+		due += (u_int64_t)ceil(table->config.half_life *
+		                       log2(entry->penalty / limit));
+	}
+
+	u_int64_t offset = (due - table->reuse_tick) / table->config.granularity;
+	if (offset < 1) {
+		offset = 1;
+	} else if (offset >= DAMP_REUSE_SLOTS) {
+		offset = DAMP_REUSE_SLOTS - 1;
+	}
+	size_t slot = (table->reuse_index + offset) % DAMP_REUSE_SLOTS;
+	LIST_INSERT_HEAD(&table->reuse[slot], entry, reuse_entries);
+}
+
+static void
+forget(struct damp_table* table, struct damp_entry* entry)
+{
+	LIST_REMOVE(entry, hash_entries);
+	mem_uncharge(MEM_DAMPENING, sizeof(struct damp_entry));
+	free(entry);
+	--table->stats.entries;
+}
+
+// returns 1 when the update must not be propagated. the first announcement
+// of a prefix creates no state. withdrawals only add to the penalty and are
+// never held back, as in rfc 2439: peers would keep forwarding into the gone
+// path until the prefix is reused.
+int
+damp_update(struct damp_table* table,
+            in_addr_t          base,
+            enum damp_event    event,
+            u_int64_t          now)
+{
+	struct damp_entry* entry = lookup(table, base);
+	if (!entry) {
+		if (event == DAMP_ANNOUNCE) {
+			return 0;
+		}
+		entry = calloc(1, sizeof(struct damp_entry));
+		if (!entry) {
+			LOG_ERROR("failed to allocate dampening entry.");
+			return 0;
+		}
+		mem_charge(MEM_DAMPENING, sizeof(struct damp_entry));
+		entry->base        = base;
+		entry->last_update = now;
+		if (table->stats.entries >= table->bucket_count * 2) {
+			grow(table);
+		}
+		LIST_INSERT_HEAD(&table->buckets[hash_addr(base, table->bucket_count)],
+		                 entry,
+		                 hash_entries);
+		++table->stats.entries;
+	} else {
+		LIST_REMOVE(entry, reuse_entries);
+		decay(table, entry, now);
+	}
+
+	entry->penalty += event == DAMP_WITHDRAW ? table->config.withdraw_penalty
+	                                         : table->config.readvertise_penalty;
+	if (entry->penalty > table->config.max_penalty) {
+		entry->penalty = table->config.max_penalty;
+	}
+	if (!entry->suppressed && entry->penalty >= table->config.suppress_limit) {
+		entry->suppressed = 1;
+		++table->stats.suppressions;
+		++table->stats.suppressed;
+	}
+	schedule(table, entry, now);
+
+	if (entry->suppressed && event == DAMP_ANNOUNCE) {
+		++table->stats.suppressed_updates;
+		return 1;
+	}
+	return 0;
+}
+
+int
+damp_is_suppressed(struct damp_table* table, in_addr_t base)
+{
+	struct damp_entry* entry = lookup(table, base);
+	return entry && entry->suppressed;
+}
+
+// walks every bucket that ended by now. prefixes that decayed below the reuse
+// limit are released through handler, decayed idle entries are dropped and
+// the rest is rescheduled. returns the number of released prefixes.
+size_t
+damp_process_reuse(struct damp_table* table,
+                   u_int64_t          now,
+                   damp_reuse_handler handler,
+                   void*              arg)
+{
+	size_t released = 0;
+
+	while (table->reuse_tick + table->config.granularity <= now) {
+		struct damp_list   batch = table->reuse[table->reuse_index];
+		struct damp_entry* entry;
+
+		if (LIST_FIRST(&batch)) {
+			LIST_FIRST(&batch)->reuse_entries.le_prev = &LIST_FIRST(&batch);
+		}
+		LIST_INIT(&table->reuse[table->reuse_index]);
+
+		while ((entry = LIST_FIRST(&batch))) {
+			LIST_REMOVE(entry, reuse_entries);
+			decay(table, entry, now);
+
+			if (entry->suppressed &&
+			    entry->penalty < table->config.reuse_limit) {
+				entry->suppressed = 0;
+				--table->stats.suppressed;
+				++table->stats.reuses;
+				++released;
+				handler(entry->base, arg);
+			}
+			if (!entry->suppressed &&
+			    entry->penalty < table->config.forget_limit) {
+				forget(table, entry);
+			} else {
+				schedule(table, entry, now);
+			}
+		}
+
+		table->reuse_index = (table->reuse_index + 1) % DAMP_REUSE_SLOTS;
+		table->reuse_tick += table->config.granularity;
+	}
+	return released;
+}
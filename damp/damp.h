@@ -0,0 +1,89 @@
+#ifndef BGP_DAMP_H
+#define BGP_DAMP_H
+
+#include <netinet/in.h>
+#include <sys/queue.h>
+#include <sys/types.h>
+
+// suppressed and decaying prefixes are kept in time buckets of
+// config.granularity ticks each. entries further away than the last bucket are
+// parked there and placed again when it is processed.
+#define DAMP_REUSE_SLOTS 256
+
+#define DAMP_HASH_INIT 64
+
+enum damp_event {
+	DAMP_WITHDRAW = 0,
+	DAMP_ANNOUNCE,
+};
+
+struct damp_config {
+	u_int64_t half_life;    // ticks
+	u_int64_t granularity;  // ticks per reuse bucket
+	double    withdraw_penalty;
+	double    readvertise_penalty;
+	double    suppress_limit;
+	double    reuse_limit;
+	double    max_penalty;
+	// entries decayed below this are forgotten.
+	double forget_limit;
+};
+
+struct damp_stats {
+	u_int64_t suppressed_updates;
+	u_int64_t saved_messages;
+	u_int64_t saved_bytes;
+	u_int64_t suppressions;
+	u_int64_t reuses;
+	u_int64_t suppressed;
+	u_int64_t entries;
+};
+
+// penalty is only valid at last_update. it is decayed lazily whenever the
+// entry is touched, so idle prefixes cost nothing between events.
+struct damp_entry {
+	in_addr_t base;
+	int       suppressed;
+	double    penalty;
+	u_int64_t last_update;
+	LIST_ENTRY(damp_entry) hash_entries;
+	LIST_ENTRY(damp_entry) reuse_entries;
+};
+
+LIST_HEAD(damp_list, damp_entry);
+
+struct damp_table {
+	struct damp_config config;
+	struct damp_stats  stats;
+
+	struct damp_list* buckets;
+	size_t            bucket_count;
+
+	struct damp_list reuse[DAMP_REUSE_SLOTS];
+	size_t           reuse_index;
+	u_int64_t        reuse_tick;  // start of the bucket at reuse_index
+};
+
+typedef void (*damp_reuse_handler)(in_addr_t base, void* arg);
+
+void damp_default_config(struct damp_config* config, u_int64_t tick_ms);
+
+int damp_init(struct damp_table*        table,
+              const struct damp_config* config,
+              u_int64_t                 now);
+
+void damp_free(struct damp_table* table);
+
+int damp_update(struct damp_table* table,
+                in_addr_t          base,
+                enum damp_event    event,
+                u_int64_t          now);
+
+int damp_is_suppressed(struct damp_table* table, in_addr_t base);
+
+size_t damp_process_reuse(struct damp_table* table,
+                          u_int64_t          now,
+                          damp_reuse_handler handler,
+                          void*              arg);
+
+#endif  // BGP_DAMP_H
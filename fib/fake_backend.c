@@ -0,0 +1,195 @@
+#include "../hash/hash.h"
+#include "../logger/logger.h"
+#include "fib.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct fake_route {
+	in_addr_t      dst;
+	u_int32_t      hop_count;
+	struct fib_hop hops[FIB_HOPS_MAX];
+	LIST_ENTRY(fake_route) entries;
+};
+
+LIST_HEAD(fake_route_list, fake_route);
+
+struct fake_fib {
+	struct fake_fib_stats   stats;
+	struct fake_route_list* buckets;
+	size_t                  bucket_count;
+};
+
+static struct fake_route_list*
+bucket_of(struct fake_fib* fake, in_addr_t dst)
+{
+	return &fake->buckets[hash_addr(dst, fake->bucket_count)];
+}
+
+static struct fake_route*
+find(struct fake_fib* fake, in_addr_t dst)
+{
+	struct fake_route* current;
+	LIST_FOREACH (current, bucket_of(fake, dst), entries) {
+		if (current->dst == dst) {
+			return current;
+		}
+	}
+	return NULL;
+}
+
+static void
+grow(struct fake_fib* fake)
+{
+	struct fake_route_list* old_buckets = fake->buckets;
+	size_t                  old_count   = fake->bucket_count;
+	struct fake_route_list* new_buckets =
+	    calloc(old_count * 2, sizeof(struct fake_route_list));
+	if (!new_buckets) {
+		return;
+	}
+	fake->buckets      = new_buckets;
+	fake->bucket_count = old_count * 2;
+	for (size_t i = 0; i < fake->bucket_count; i++) {
+		LIST_INIT(&new_buckets[i]);
+	}
+
+	struct fake_route* current;
+	for (size_t i = 0; i < old_count; i++) {
+		while ((current = LIST_FIRST(&old_buckets[i]))) {
+			LIST_REMOVE(current, entries);
+			LIST_INSERT_HEAD(bucket_of(fake, current->dst), current, entries);
+		}
+	}
+	free(old_buckets);
+}
+
+// answers like the kernel: a replaced route has to exist, a deleted one
+// too, and every hop needs an interface.
+static int
+apply(struct fake_fib* fake, struct fib_op* op)
+{
+	struct fake_route* route = find(fake, op->dst);
+
+	if (op->type == FIB_DELETE) {
+		if (!route) {
+			return -ESRCH;
+		}
+		LIST_REMOVE(route, entries);
+		free(route);
+		--fake->stats.routes;
+		return 0;
+	}
+
+	for (u_int32_t i = 0; i < op->hop_count; i++) {
+		if (op->hops[i].ifindex <= 0) {
+			return -ENODEV;
+		}
+	}
+	if (!route) {
+		if (op->type == FIB_REPLACE) {
+			return -ENOENT;
+		}
+		route = calloc(1, sizeof(struct fake_route));
+		if (!route) {
+			return -ENOMEM;
+		}
+		route->dst = op->dst;
+		if (fake->stats.routes >= fake->bucket_count * 2) {
+			grow(fake);
+		}
+		LIST_INSERT_HEAD(bucket_of(fake, op->dst), route, entries);
+		++fake->stats.routes;
+	}
+	route->hop_count = op->hop_count;
+	memcpy(route->hops, op->hops, op->hop_count * sizeof(struct fib_hop));
+	return 0;
+}
+
+static int
+fake_init(struct fib_backend* self)
+{
+	return 0;
+}
+
+static int
+fake_submit(struct fib_backend* self, struct fib_op* ops, int count)
+{
+	struct fake_fib* fake = self->priv;
+
+	for (int i = 0; i < count; i++) {
+		ops[i].seq    = fake->stats.ops + i + 1;
+		ops[i].result = apply(fake, &ops[i]);
+		fake->stats.errors += ops[i].result != 0;
+	}
+	++fake->stats.batches;
+	fake->stats.ops += count;
+	return 0;
+}
+
+static int
+fake_collect(struct fib_backend* self, struct fib_op* ops, int count)
+{
+	int rejected = 0;
+	for (int i = 0; i < count; i++) {
+		rejected += ops[i].result != 0;
+	}
+	return rejected;
+}
+
+static void
+fake_destroy(struct fib_backend* self)
+{
+	struct fake_fib*   fake = self->priv;
+	struct fake_route* current;
+	for (size_t i = 0; i < fake->bucket_count; i++) {
+		while ((current = LIST_FIRST(&fake->buckets[i]))) {
+			LIST_REMOVE(current, entries);
+			free(current);
+		}
+	}
+	free(fake->buckets);
+	free(fake);
+}
+
+int
+fake_fib_lookup(struct fib_backend* backend,
+                in_addr_t           dst,
+                struct fib_hop*     hops)
+{
+	struct fake_route* route = find(backend->priv, dst);
+	if (!route) {
+		return -1;
+	}
+	memcpy(hops, route->hops, route->hop_count * sizeof(struct fib_hop));
+	return route->hop_count;
+}
+
+struct fib_backend*
+make_fake_fib_backend()
+{
+	struct fib_backend*     backend = calloc(1, sizeof(struct fib_backend));
+	struct fake_fib*        fake    = calloc(1, sizeof(struct fake_fib));
+	struct fake_route_list* buckets =
+	    calloc(FIB_HASH_INIT, sizeof(struct fake_route_list));
+	if (!backend || !fake || !buckets) {
+		LOG_ERROR("failed to allocate fake fib backend.");
+		free(backend);
+		free(fake);
+		free(buckets);
+		return NULL;
+	}
+	for (size_t i = 0; i < FIB_HASH_INIT; i++) {
+		LIST_INIT(&buckets[i]);
+	}
+	fake->buckets      = buckets;
+	fake->bucket_count = FIB_HASH_INIT;
+
+	backend->name    = "fake";
+	backend->init    = fake_init;
+	backend->submit  = fake_submit;
+	backend->collect = fake_collect;
+	backend->destroy = fake_destroy;
+	backend->priv    = fake;
+	return backend;
+}
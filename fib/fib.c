@@ -0,0 +1,357 @@
+#include "fib.h"
+#include "../hash/hash.h"
+#include "../logger/logger.h"
+#include "../mem/mem_account.h"
+#include "../metrics/metrics.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int
+same_hops(const struct fib_hop* a,
+          u_int32_t             a_count,
+          const struct fib_hop* b,
+          u_int32_t             b_count)
+{
+	return a_count == b_count &&
+	       (!a_count || !memcmp(a, b, a_count * sizeof(struct fib_hop)));
+}
+
+static int
+set_hops(struct fib_hop**      dest,
+         u_int32_t*            dest_count,
+         const struct fib_hop* hops,
+         u_int32_t             count)
+{
+	if (count != *dest_count) {
+		struct fib_hop* new = NULL;
+		if (count) {
+			new = malloc(count * sizeof(struct fib_hop));
+			if (!new) {
+				LOG_ERROR("failed to allocate fib hops.");
+				return -1;
+			}
+			mem_charge(MEM_FIB, count * sizeof(struct fib_hop));
+		}
+		if (*dest) {
+			mem_uncharge(MEM_FIB, *dest_count * sizeof(struct fib_hop));
+		}
+		free(*dest);
+		*dest       = new;
+		*dest_count = count;
+	}
+	if (count) {
+		memcpy(*dest, hops, count * sizeof(struct fib_hop));
+	}
+	return 0;
+}
+
+// takes over the backend, which is closed with the fib.
+struct fib*
+make_fib(struct fib_backend* backend)
+{
+	struct fib* fib = calloc(1, sizeof(struct fib));
+	if (!fib) {
+		LOG_ERROR("failed to allocate fib.");
+		return NULL;
+	}
+	fib->bucket_count = FIB_HASH_INIT;
+	fib->buckets = calloc(fib->bucket_count, sizeof(struct fib_route_list));
+	if (!fib->buckets) {
+		LOG_ERROR("failed to allocate fib.");
+		free(fib);
+		return NULL;
+	}
+	mem_charge(MEM_FIB, fib->bucket_count * sizeof(struct fib_route_list));
+	for (size_t i = 0; i < fib->bucket_count; i++) {
+		LIST_INIT(&fib->buckets[i]);
+	}
+	TAILQ_INIT(&fib->dirty);
+	pthread_cond_init(&fib->ready, NULL);
+	fib->backend = backend;
+	return fib;
+}
+
+static void
+free_route(struct fib_route* route)
+{
+	set_hops(&route->want, &route->want_count, NULL, 0);
+	set_hops(&route->installed, &route->installed_count, NULL, 0);
+	mem_uncharge(MEM_FIB, sizeof(struct fib_route));
+	free(route);
+}
+
+void
+free_fib(struct fib* fib)
+{
+	if (!fib) {
+		return;
+	}
+	struct fib_route* current;
+	for (size_t i = 0; i < fib->bucket_count; i++) {
+		while ((current = LIST_FIRST(&fib->buckets[i]))) {
+			LIST_REMOVE(current, hash_entries);
+			free_route(current);
+		}
+	}
+	mem_uncharge(MEM_FIB, fib->bucket_count * sizeof(struct fib_route_list));
+	free(fib->buckets);
+	pthread_cond_destroy(&fib->ready);
+	close_fib_backend(fib->backend);
+	free(fib);
+}
+
+static struct fib_route*
+find(struct fib* fib, in_addr_t dst)
+{
+	struct fib_route* current;
+	LIST_FOREACH (current,
+	              &fib->buckets[hash_addr(dst, fib->bucket_count)],
+	              hash_entries) {
+		if (current->dst == dst) {
+			return current;
+		}
+	}
+	return NULL;
+}
+
+static void
+grow(struct fib* fib)
+{
+	size_t                 new_count = fib->bucket_count * 2;
+	struct fib_route_list* new_buckets =
+	    calloc(new_count, sizeof(struct fib_route_list));
+	if (!new_buckets) {
+		// lookups only get slower.
+		return;
+	}
+	for (size_t i = 0; i < new_count; i++) {
+		LIST_INIT(&new_buckets[i]);
+	}
+
+	struct fib_route* current;
+	for (size_t i = 0; i < fib->bucket_count; i++) {
+		while ((current = LIST_FIRST(&fib->buckets[i]))) {
+			LIST_REMOVE(current, hash_entries);
+			LIST_INSERT_HEAD(&new_buckets[hash_addr(current->dst, new_count)],
+			                 current,
+			                 hash_entries);
+		}
+	}
+	mem_recharge(MEM_FIB,
+	             fib->bucket_count * sizeof(struct fib_route_list),
+	             new_count * sizeof(struct fib_route_list));
+	free(fib->buckets);
+	fib->buckets      = new_buckets;
+	fib->bucket_count = new_count;
+}
+
+static struct fib_route*
+insert(struct fib* fib, in_addr_t dst)
+{
+	struct fib_route* route = calloc(1, sizeof(struct fib_route));
+	if (!route) {
+		LOG_ERROR("failed to allocate fib route.");
+		return NULL;
+	}
+	mem_charge(MEM_FIB, sizeof(struct fib_route));
+	route->dst = dst;
+
+	if (fib->count >= fib->bucket_count * 2) {
+		grow(fib);
+	}
+	LIST_INSERT_HEAD(
+	    &fib->buckets[hash_addr(dst, fib->bucket_count)], route, hash_entries);
+	++fib->count;
+	return route;
+}
+
+static void
+remove_route(struct fib* fib, struct fib_route* route)
+{
+	LIST_REMOVE(route, hash_entries);
+	--fib->count;
+	free_route(route);
+}
+
+static void
+mark_dirty(struct fib* fib, struct fib_route* route)
+{
+	if (route->dirty) {
+		return;
+	}
+	if (TAILQ_EMPTY(&fib->dirty)) {
+		pthread_cond_signal(&fib->ready);
+	}
+	route->dirty = 1;
+	TAILQ_INSERT_TAIL(&fib->dirty, route, dirty_entries);
+}
+
+// records what dst should point to, without hops to remove it. only the
+// queue is touched here, the backend is left to fib_sync().
+void
+fib_update(struct fib*           fib,
+           in_addr_t             dst,
+           u_int8_t              dst_len,
+           const struct fib_hop* hops,
+           u_int32_t             count)
+{
+	struct fib_route* route = find(fib, dst);
+	if (!route) {
+		if (!count) {
+			return;
+		}
+		route = insert(fib, dst);
+		if (!route) {
+			return;
+		}
+	}
+	if (route->dst_len == dst_len &&
+	    same_hops(route->want, route->want_count, hops, count)) {
+		return;
+	}
+	if (set_hops(&route->want, &route->want_count, hops, count)) {
+		return;
+	}
+	route->dst_len = dst_len;
+	mark_dirty(fib, route);
+}
+
+// turns queued routes into ops until the batch is full. routes whose wanted
+// state is installed already drop out without an op.
+static int
+collect(struct fib* fib)
+{
+	struct fib_route* route;
+	int               count = 0;
+
+	while (count < FIB_BATCH_MAX && (route = TAILQ_FIRST(&fib->dirty))) {
+		TAILQ_REMOVE(&fib->dirty, route, dirty_entries);
+		route->dirty = 0;
+		if (same_hops(route->want,
+		              route->want_count,
+		              route->installed,
+		              route->installed_count)) {
+			if (!route->want_count) {
+				remove_route(fib, route);
+			}
+			continue;
+		}
+
+		struct fib_op* op = &fib->ops[count++];
+		if (!route->want_count) {
+			op->type = FIB_DELETE;
+		} else if (route->installed_count) {
+			op->type = FIB_REPLACE;
+		} else {
+			op->type = FIB_ADD;
+		}
+		op->dst       = route->dst;
+		op->dst_len   = route->dst_len;
+		op->hop_count = route->want_count < FIB_HOPS_MAX ? route->want_count
+		                                                 : FIB_HOPS_MAX;
+		if (op->hop_count) {
+			memcpy(op->hops,
+			       route->want,
+			       op->hop_count * sizeof(struct fib_hop));
+		}
+		op->result = 0;
+		op->route  = route;
+	}
+	return count;
+}
+
+static void
+commit(struct fib* fib, int count)
+{
+	for (int i = 0; i < count; i++) {
+		struct fib_op*    op    = &fib->ops[i];
+		struct fib_route* route = op->route;
+
+		// the kernel drops routes of interfaces that go down by itself.
+		if (op->type == FIB_DELETE && op->result == -ESRCH) {
+			op->result = 0;
+		}
+		if (op->type == FIB_REPLACE && op->result == -ENOENT) {
+			set_hops(&route->installed, &route->installed_count, NULL, 0);
+			mark_dirty(fib, route);
+			continue;
+		}
+		if (op->result) {
+			char dst[INET_ADDRSTRLEN];
+			inet_ntop(AF_INET, &op->dst, dst, sizeof(dst));
+			LOG_WARN("failed to program route to %s/%u. errno: %d",
+			         dst,
+			         op->dst_len,
+			         -op->result);
+			metrics_inc(METRIC_FIB_ERRORS);
+			continue;
+		}
+
+		set_hops(&route->installed,
+		         &route->installed_count,
+		         op->hops,
+		         op->type == FIB_DELETE ? 0 : op->hop_count);
+		if (!route->dirty && !route->want_count && !route->installed_count) {
+			remove_route(fib, route);
+		}
+	}
+}
+
+// sends every queued change, a batch at a time. the lock, when given, is
+// only held while the queue and the routes are touched, never while the
+// backend works, so decision() is not held up by the kernel.
+int
+fib_sync(struct fib* fib, pthread_mutex_t* lock)
+{
+	int total = 0;
+
+	while (1) {
+		if (lock) {
+			pthread_mutex_lock(lock);
+		}
+		int count = collect(fib);
+		if (lock) {
+			pthread_mutex_unlock(lock);
+		}
+		if (!count) {
+			break;
+		}
+
+		u_int64_t start = metrics_now();
+		if (fib->backend->submit(fib->backend, fib->ops, count) < 0) {
+			for (int i = 0; i < count; i++) {
+				fib->ops[i].result = -EIO;
+			}
+		} else {
+			fib->backend->collect(fib->backend, fib->ops, count);
+		}
+		metrics_record(METRIC_FIB_BATCH_NS, metrics_now() - start);
+		metrics_add(METRIC_FIB_OPS, count);
+		metrics_inc(METRIC_FIB_BATCHES);
+
+		if (lock) {
+			pthread_mutex_lock(lock);
+		}
+		commit(fib, count);
+		if (lock) {
+			pthread_mutex_unlock(lock);
+		}
+		total += count;
+	}
+	return total;
+}
+
+// queues the removal of every route, for a fib_sync() before shutdown.
+void
+fib_flush(struct fib* fib)
+{
+	struct fib_route* current;
+	for (size_t i = 0; i < fib->bucket_count; i++) {
+		LIST_FOREACH (current, &fib->buckets[i], hash_entries) {
+			set_hops(&current->want, &current->want_count, NULL, 0);
+			mark_dirty(fib, current);
+		}
+	}
+}
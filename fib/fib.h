@@ -0,0 +1,130 @@
+#ifndef BGP_FIB_H
+#define BGP_FIB_H
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/queue.h>
+#include <sys/types.h>
+
+#define FIB_HASH_INIT   64
+#define FIB_BATCH_MAX   256  // route changes per message to the backend
+#define FIB_HOPS_MAX    16
+#define FIB_COALESCE_MS 10  // a burst of updates settles before a sync
+
+struct fib_hop {
+	in_addr_t gateway;  // 0 for a route straight out of the interface
+	int       ifindex;
+};
+
+enum fib_op_type {
+	FIB_ADD = 0,
+	FIB_REPLACE,
+	FIB_DELETE,
+};
+
+// one route change. seq and result are filled in by the backend.
+struct fib_op {
+	enum fib_op_type  type;
+	in_addr_t         dst;
+	u_int8_t          dst_len;
+	u_int32_t         hop_count;
+	struct fib_hop    hops[FIB_HOPS_MAX];
+	u_int32_t         seq;
+	int               result;  // 0, or -errno once the backend rejected it
+	struct fib_route* route;
+};
+
+struct fib_backend {
+	const char* name;
+
+	int (*init)(struct fib_backend* self);
+
+	// hands every op over without waiting for the outcome, in as few
+	// messages as the backend allows. returns -1 when nothing was sent.
+	int (*submit)(struct fib_backend* self, struct fib_op* ops, int count);
+
+	// waits for the outcome of every submitted op and stores it in result.
+	// returns the number of rejected ops.
+	int (*collect)(struct fib_backend* self, struct fib_op* ops, int count);
+
+	void (*destroy)(struct fib_backend* self);
+
+	void* priv;
+};
+
+// programs the routes into the main table of the kernel.
+struct fib_backend* make_netlink_fib_backend();
+
+// what the fake backend holds and was asked to do. kept in its priv.
+struct fake_fib_stats {
+	u_int64_t batches;
+	u_int64_t ops;
+	u_int64_t errors;
+	size_t    routes;
+};
+
+// keeps the routes in memory and answers like the kernel would, for running
+// the fib stage without touching the host.
+struct fib_backend* make_fake_fib_backend();
+
+// returns the hops the fake backend holds for dst, or -1 if it has no route.
+int fake_fib_lookup(struct fib_backend* backend,
+                    in_addr_t           dst,
+                    struct fib_hop*     hops);
+
+struct fib_backend* open_fib_backend(const char* name);
+
+void close_fib_backend(struct fib_backend* backend);
+
+// the state of one destination. want is what the rib selected last,
+// installed what the backend confirmed.
+struct fib_route {
+	in_addr_t       dst;
+	u_int8_t        dst_len;
+	int             dirty;
+	u_int32_t       want_count;
+	u_int32_t       installed_count;
+	struct fib_hop* want;
+	struct fib_hop* installed;
+	LIST_ENTRY(fib_route) hash_entries;
+	TAILQ_ENTRY(fib_route) dirty_entries;
+};
+
+LIST_HEAD(fib_route_list, fib_route);
+
+TAILQ_HEAD(fib_dirty_queue, fib_route);
+
+// changes queue up in dirty until a sync sends them. a destination that
+// changes again before that is sent once, in its latest state.
+struct fib {
+	struct fib_backend*    backend;
+	struct fib_route_list* buckets;
+	size_t                 bucket_count;
+	size_t                 count;
+	struct fib_dirty_queue dirty;
+	pthread_cond_t         ready;  // signalled when dirty becomes non-empty
+	struct fib_op          ops[FIB_BATCH_MAX];
+};
+
+struct fib* make_fib(struct fib_backend* backend);
+
+void free_fib(struct fib* fib);
+
+void fib_update(struct fib*           fib,
+                in_addr_t             dst,
+                u_int8_t              dst_len,
+                const struct fib_hop* hops,
+                u_int32_t             count);
+
+static inline int
+fib_pending(struct fib* fib)
+{
+	return !TAILQ_EMPTY(&fib->dirty);
+}
+
+int fib_sync(struct fib* fib, pthread_mutex_t* lock);
+
+void fib_flush(struct fib* fib);
+
+#endif  // BGP_FIB_H
@@ -0,0 +1,40 @@
+#include "../logger/logger.h"
+#include "fib.h"
+#include <stdlib.h>
+#include <string.h>
+
+// creates and initializes the named backend. unlike the io backends there
+// is no fallback, a fib that silently went nowhere would hide the routes.
+struct fib_backend*
+open_fib_backend(const char* name)
+{
+	struct fib_backend* backend = NULL;
+
+	if (!strcmp(name, "netlink")) {
+		backend = make_netlink_fib_backend();
+	} else if (!strcmp(name, "fake")) {
+		backend = make_fake_fib_backend();
+	} else {
+		LOG_ERROR("unknown fib backend: %s", name);
+		return NULL;
+	}
+
+	if (backend && backend->init(backend) < 0) {
+		close_fib_backend(backend);
+		backend = NULL;
+	}
+	if (backend) {
+		LOG_INFO("fib backend in use: %s", backend->name);
+	}
+	return backend;
+}
+
+void
+close_fib_backend(struct fib_backend* backend)
+{
+	if (!backend) {
+		return;
+	}
+	backend->destroy(backend);
+	free(backend);
+}
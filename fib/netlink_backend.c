@@ -0,0 +1,267 @@
+#include "../logger/logger.h"
+#include "fib.h"
+#include <errno.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define FIB_MSG_MAX        512  // one route with FIB_HOPS_MAX hops fits
+#define FIB_ACK_TIMEOUT_MS 1000
+#define FIB_RCVBUF         (1 << 20)
+#define FIB_PENDING        1  // result of an op without acknowledgement
+
+struct netlink_fib {
+	int       fd;
+	u_int32_t seq;
+	char*     buffer;  // FIB_BATCH_MAX messages of up to FIB_MSG_MAX
+};
+
+static struct rtattr*
+add_attr(struct nlmsghdr* nlh, unsigned short type, const void* data, int len)
+{
+	struct rtattr* rta =
+	    (struct rtattr*)((char*)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len  = RTA_LENGTH(len);
+	if (len) {
+		memcpy(RTA_DATA(rta), data, len);
+	}
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+	return rta;
+}
+
+static void
+add_multipath(struct nlmsghdr* nlh, struct fib_op* op)
+{
+	struct rtattr* multipath = add_attr(nlh, RTA_MULTIPATH, NULL, 0);
+	for (u_int32_t i = 0; i < op->hop_count; i++) {
+		struct rtnexthop* nh =
+		    (struct rtnexthop*)((char*)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+		memset(nh, 0, sizeof(*nh));
+		nh->rtnh_len     = sizeof(*nh);
+		nh->rtnh_ifindex = op->hops[i].ifindex;
+		nlh->nlmsg_len =
+		    NLMSG_ALIGN(nlh->nlmsg_len) + RTNH_ALIGN(nh->rtnh_len);
+		if (op->hops[i].gateway) {
+			struct rtattr* gateway = add_attr(
+			    nlh, RTA_GATEWAY, &op->hops[i].gateway, sizeof(in_addr_t));
+			nh->rtnh_len += RTA_ALIGN(gateway->rta_len);
+		}
+	}
+	multipath->rta_len = (char*)nlh + nlh->nlmsg_len - (char*)multipath;
+}
+
+// a new route replaces whatever a previous run left behind. a replaced one
+// has to exist, so a route the kernel flushed on its own is noticed.
+static int
+build_route(struct fib_op* op, u_int32_t seq, char* buffer)
+{
+	struct nlmsghdr* nlh = (struct nlmsghdr*)buffer;
+	memset(nlh, 0, NLMSG_SPACE(sizeof(struct rtmsg)));
+	nlh->nlmsg_len   = NLMSG_LENGTH(sizeof(struct rtmsg));
+	nlh->nlmsg_seq   = seq;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	if (op->type == FIB_DELETE) {
+		nlh->nlmsg_type = RTM_DELROUTE;
+	} else {
+		nlh->nlmsg_type = RTM_NEWROUTE;
+		nlh->nlmsg_flags |= NLM_F_REPLACE;
+		if (op->type == FIB_ADD) {
+			nlh->nlmsg_flags |= NLM_F_CREATE;
+		}
+	}
+
+	int via_gateway = 0;
+	for (u_int32_t i = 0; i < op->hop_count; i++) {
+		via_gateway |= op->hops[i].gateway != 0;
+	}
+
+	struct rtmsg* rtm = NLMSG_DATA(nlh);
+	rtm->rtm_family   = AF_INET;
+	rtm->rtm_dst_len  = op->dst_len;
+	rtm->rtm_table    = RT_TABLE_MAIN;
+	rtm->rtm_protocol = RTPROT_BGP;
+	rtm->rtm_type     = RTN_UNICAST;
+	if (op->type == FIB_DELETE) {
+		rtm->rtm_scope = RT_SCOPE_NOWHERE;
+	} else {
+		rtm->rtm_scope = via_gateway ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+	}
+	add_attr(nlh, RTA_DST, &op->dst, sizeof(in_addr_t));
+
+	if (op->type == FIB_DELETE) {
+		// the protocol keeps routes of others from being deleted.
+	} else if (op->hop_count == 1) {
+		if (op->hops[0].gateway) {
+			add_attr(
+			    nlh, RTA_GATEWAY, &op->hops[0].gateway, sizeof(in_addr_t));
+		}
+		add_attr(nlh, RTA_OIF, &op->hops[0].ifindex, sizeof(int));
+	} else {
+		add_multipath(nlh, op);
+	}
+	return NLMSG_ALIGN(nlh->nlmsg_len);
+}
+
+static int
+netlink_init(struct fib_backend* self)
+{
+	struct netlink_fib* nl = self->priv;
+
+	nl->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (nl->fd < 0) {
+		LOG_ERROR("failed to create fib netlink socket. errno: %d", errno);
+		return -1;
+	}
+
+	// acknowledgements of a whole batch arrive at once. they leave out the
+	// request they answer, which the sequence number identifies anyway.
+	int one    = 1;
+	int rcvbuf = FIB_RCVBUF;
+	setsockopt(nl->fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+	setsockopt(nl->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	struct sockaddr_nl addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	if (bind(nl->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		LOG_ERROR("failed to bind fib netlink socket. errno: %d", errno);
+		return -1;
+	}
+	return 0;
+}
+
+// the whole batch goes out with a single sendmsg().
+static int
+netlink_submit(struct fib_backend* self, struct fib_op* ops, int count)
+{
+	struct netlink_fib* nl  = self->priv;
+	size_t              len = 0;
+
+	for (int i = 0; i < count; i++) {
+		ops[i].seq    = ++nl->seq;
+		ops[i].result = FIB_PENDING;
+		len += build_route(&ops[i], ops[i].seq, nl->buffer + len);
+	}
+
+	struct sockaddr_nl kernel = {.nl_family = AF_NETLINK};
+	struct iovec       iov    = {.iov_base = nl->buffer, .iov_len = len};
+	struct msghdr      msg    = {
+	    .msg_name    = &kernel,
+	    .msg_namelen = sizeof(kernel),
+	    .msg_iov     = &iov,
+	    .msg_iovlen  = 1,
+	};
+	while (sendmsg(nl->fd, &msg, 0) < 0) {
+		if (errno != EINTR) {
+			LOG_ERROR("failed to send fib batch. errno: %d", errno);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int
+fail_pending(struct fib_op* ops, int count, int error)
+{
+	int failed = 0;
+	for (int i = 0; i < count; i++) {
+		if (ops[i].result == FIB_PENDING) {
+			ops[i].result = -error;
+			++failed;
+		}
+	}
+	return failed;
+}
+
+// acknowledgements are matched to ops by sequence number, in whatever order
+// they come.
+static int
+netlink_collect(struct fib_backend* self, struct fib_op* ops, int count)
+{
+	struct netlink_fib* nl = self->priv;
+	char                buffer[16384]
+	    __attribute__((aligned(__alignof__(struct nlmsghdr))));
+	int pending  = count;
+	int rejected = 0;
+
+	while (pending) {
+		struct pollfd pfd = {.fd = nl->fd, .events = POLLIN};
+		int           ret = poll(&pfd, 1, FIB_ACK_TIMEOUT_MS);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ret <= 0) {
+			LOG_WARN("%d fib acknowledgements missing. errno: %d",
+			         pending,
+			         ret ? errno : ETIMEDOUT);
+			return rejected + fail_pending(ops, count, ETIMEDOUT);
+		}
+
+		int n = recv(nl->fd, buffer, sizeof(buffer), 0);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			LOG_ERROR("fib netlink receive failed. errno: %d", errno);
+			return rejected + fail_pending(ops, count, errno);
+		}
+
+		struct nlmsghdr* nlh = (struct nlmsghdr*)buffer;
+		for (; NLMSG_OK(nlh, n); nlh = NLMSG_NEXT(nlh, n)) {
+			if (nlh->nlmsg_type != NLMSG_ERROR) {
+				continue;
+			}
+			u_int32_t index = nlh->nlmsg_seq - ops[0].seq;
+			if (index >= (u_int32_t)count ||
+			    ops[index].result != FIB_PENDING) {
+				continue;
+			}
+			struct nlmsgerr* err = NLMSG_DATA(nlh);
+			ops[index].result    = err->error;
+			rejected += err->error != 0;
+			--pending;
+		}
+	}
+	return rejected;
+}
+
+static void
+netlink_destroy(struct fib_backend* self)
+{
+	struct netlink_fib* nl = self->priv;
+	if (nl->fd >= 0) {
+		close(nl->fd);
+	}
+	free(nl->buffer);
+	free(nl);
+}
+
+struct fib_backend*
+make_netlink_fib_backend()
+{
+	struct fib_backend* backend = calloc(1, sizeof(struct fib_backend));
+	struct netlink_fib* nl      = calloc(1, sizeof(struct netlink_fib));
+	char*               buffer  = malloc(FIB_BATCH_MAX * FIB_MSG_MAX);
+	if (!backend || !nl || !buffer) {
+		LOG_ERROR("failed to allocate netlink fib backend.");
+		free(backend);
+		free(nl);
+		free(buffer);
+		return NULL;
+	}
+	nl->fd     = -1;
+	nl->buffer = buffer;
+
+	backend->name    = "netlink";
+	backend->init    = netlink_init;
+	backend->submit  = netlink_submit;
+	backend->collect = netlink_collect;
+	backend->destroy = netlink_destroy;
+	backend->priv    = nl;
+	return backend;
+}
@@ -0,0 +1,28 @@
+#ifndef BGP_HASH_H
+#define BGP_HASH_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// multiplicative hashing of addresses for the tables keyed by a prefix base
+// or destination. the bucket comes from the top bits of the product, the low
+// ones only depend on the first octets of an address in network order, which
+// most prefixes share. bucket_count must be a power of two.
+//
+// header only and free of the rest of the daemon, the shared memory reader
+// library probes with it too.
+#define HASH_ADDR_MUL 2654435761u
+
+static inline size_t
+hash_addr(in_addr_t addr, size_t bucket_count)
+{
+	// shifting the product by 32 would be undefined.
+	if (bucket_count <= 1) {
+		return 0;
+	}
+	return ((u_int32_t)addr * HASH_ADDR_MUL) >>
+	       (32 - __builtin_ctzl(bucket_count));
+}
+
+#endif  // BGP_HASH_H
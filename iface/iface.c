@@ -0,0 +1,327 @@
+#include "iface.h"
+#include "../logger/logger.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define IFACE_WATCH_BUFFER 8192
+
+static void
+set_sockaddr(struct sockaddr_in* sockaddr, in_addr_t addr)
+{
+	memset(sockaddr, 0, sizeof(*sockaddr));
+	sockaddr->sin_family      = AF_INET;
+	sockaddr->sin_addr.s_addr = addr;
+}
+
+void
+iface_set_addr(struct iface* iface,
+               in_addr_t     addr,
+               in_addr_t     netmask,
+               in_addr_t     broadaddr)
+{
+	set_sockaddr(&iface->addr, addr);
+	set_sockaddr(&iface->netmask, netmask);
+	set_sockaddr(&iface->broadaddr, broadaddr);
+}
+
+struct iface*
+make_iface(const char*  name,
+           int          index,
+           unsigned int flags,
+           in_addr_t    addr,
+           in_addr_t    netmask,
+           in_addr_t    broadaddr)
+{
+	struct iface* iface = calloc(1, sizeof(struct iface));
+	if (!iface) {
+		LOG_ERROR("failed to allocate interface.");
+		return NULL;
+	}
+	strncpy(iface->name, name, IF_NAMESIZE - 1);
+	iface->index = index;
+	iface->up    = 1;
+	iface_set_addr(iface, addr, netmask, broadaddr);
+	LIST_INIT(&iface->routes);
+
+	iface->ifa.ifa_name      = iface->name;
+	iface->ifa.ifa_flags     = flags;
+	iface->ifa.ifa_addr      = (struct sockaddr*)&iface->addr;
+	iface->ifa.ifa_netmask   = (struct sockaddr*)&iface->netmask;
+	iface->ifa.ifa_broadaddr = (struct sockaddr*)&iface->broadaddr;
+	return iface;
+}
+
+static in_addr_t
+sockaddr_to_addr(struct sockaddr* sockaddr)
+{
+	if (!sockaddr || sockaddr->sa_family != AF_INET) {
+		return 0;
+	}
+	return ((struct sockaddr_in*)sockaddr)->sin_addr.s_addr;
+}
+
+struct iface*
+make_iface_from_ifaddrs(struct ifaddrs* src)
+{
+	return make_iface(src->ifa_name,
+	                  if_nametoindex(src->ifa_name),
+	                  src->ifa_flags,
+	                  sockaddr_to_addr(src->ifa_addr),
+	                  sockaddr_to_addr(src->ifa_netmask),
+	                  sockaddr_to_addr(src->ifa_broadaddr));
+}
+
+struct iface*
+find_iface(struct iface_list* ifaces, int index)
+{
+	struct iface* current;
+	LIST_FOREACH (current, ifaces, entries) {
+		if (current->index == index) {
+			return current;
+		}
+	}
+	return NULL;
+}
+
+// rebuilds the ifa_next chain over the interfaces that are up and returns its
+// head.
+struct ifaddrs*
+link_ifaces(struct iface_list* ifaces)
+{
+	struct ifaddrs* head = NULL;
+	struct ifaddrs* tail = NULL;
+	struct iface*   current;
+
+	LIST_FOREACH (current, ifaces, entries) {
+		current->ifa.ifa_next = NULL;
+		if (!current->up) {
+			continue;
+		}
+		if (tail) {
+			tail->ifa_next = &current->ifa;
+		} else {
+			head = &current->ifa;
+		}
+		tail = &current->ifa;
+	}
+	return head;
+}
+
+void
+free_ifaces(struct iface_list* ifaces)
+{
+	struct iface* current;
+	while ((current = LIST_FIRST(ifaces))) {
+		LIST_REMOVE(current, entries);
+		free(current);
+	}
+}
+
+int
+iface_watch_open()
+{
+	int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0) {
+		LOG_ERROR("failed to create netlink socket. errno: %d", errno);
+		return -1;
+	}
+
+	struct sockaddr_nl addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		LOG_ERROR("failed to bind netlink socket. errno: %d", errno);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int
+parse_link(struct nlmsghdr* nlh, struct iface_event* event)
+{
+	struct ifinfomsg* info = NLMSG_DATA(nlh);
+	int               len  = IFLA_PAYLOAD(nlh);
+
+	event->index = info->ifi_index;
+	event->flags = info->ifi_flags;
+	event->type  = (info->ifi_flags & IFF_UP) && (info->ifi_flags & IFF_RUNNING)
+	                  ? IFACE_LINK_UP
+	                  : IFACE_LINK_DOWN;
+	if (nlh->nlmsg_type == RTM_DELLINK) {
+		event->type = IFACE_LINK_DOWN;
+	}
+
+	struct rtattr* attr = IFLA_RTA(info);
+	while (RTA_OK(attr, len)) {
+		if (attr->rta_type == IFLA_IFNAME) {
+			strncpy(event->name, RTA_DATA(attr), IF_NAMESIZE - 1);
+		}
+		attr = RTA_NEXT(attr, len);
+	}
+	return 0;
+}
+
+static int
+parse_addr(struct nlmsghdr* nlh, struct iface_event* event)
+{
+	struct ifaddrmsg* info = NLMSG_DATA(nlh);
+	int               len  = IFA_PAYLOAD(nlh);
+
+	if (info->ifa_family != AF_INET) {
+		return -1;
+	}
+	event->type      = nlh->nlmsg_type == RTM_NEWADDR ? IFACE_ADDR_ADD
+	                                                  : IFACE_ADDR_DEL;
+	event->index     = info->ifa_index;
+	event->prefixlen = info->ifa_prefixlen;
+
+	// IFA_ADDRESS is the peer on point to point links and equals IFA_LOCAL
+	// everywhere else.
+	in_addr_t      address = 0;
+	struct rtattr* attr    = IFA_RTA(info);
+	while (RTA_OK(attr, len)) {
+		if (attr->rta_type == IFA_LOCAL) {
+			memcpy(&event->addr, RTA_DATA(attr), sizeof(in_addr_t));
+		} else if (attr->rta_type == IFA_ADDRESS) {
+			memcpy(&address, RTA_DATA(attr), sizeof(in_addr_t));
+		} else if (attr->rta_type == IFA_BROADCAST) {
+			memcpy(&event->broadaddr, RTA_DATA(attr), sizeof(in_addr_t));
+		} else if (attr->rta_type == IFA_LABEL) {
+			strncpy(event->name, RTA_DATA(attr), IF_NAMESIZE - 1);
+		}
+		attr = RTA_NEXT(attr, len);
+	}
+
+	if (!event->addr) {
+		event->addr = address;
+	} else if (!event->broadaddr && address != event->addr) {
+		event->broadaddr = address;
+	}
+	return 0;
+}
+
+static void
+dispatch_events(struct nlmsghdr*    nlh,
+                int                 n,
+                iface_event_handler handler,
+                void*               arg)
+{
+	for (; NLMSG_OK(nlh, n); nlh = NLMSG_NEXT(nlh, n)) {
+		struct iface_event event;
+		memset(&event, 0, sizeof(event));
+
+		int ret = -1;
+		if (nlh->nlmsg_type == RTM_NEWLINK || nlh->nlmsg_type == RTM_DELLINK) {
+			ret = parse_link(nlh, &event);
+		} else if (nlh->nlmsg_type == RTM_NEWADDR ||
+		           nlh->nlmsg_type == RTM_DELADDR) {
+			ret = parse_addr(nlh, &event);
+		}
+		if (!ret) {
+			handler(&event, arg);
+		}
+	}
+}
+
+// blocks until the kernel reports interface changes and calls handler once
+// per link or IPv4 address event. returns 1 when the socket overflowed and
+// events were lost, the caller has to catch up with iface_dump().
+int
+iface_watch_read(int fd, iface_event_handler handler, void* arg)
+{
+	char buffer[IFACE_WATCH_BUFFER]
+	    __attribute__((aligned(__alignof__(struct nlmsghdr))));
+
+	int n = recv(fd, buffer, sizeof(buffer), 0);
+	if (n < 0) {
+		if (errno == ENOBUFS) {
+			LOG_WARN("netlink events overflowed. some changes were lost.");
+			return 1;
+		}
+		LOG_ERROR("netlink receive failed. errno: %d", errno);
+		return -1;
+	}
+
+	dispatch_events((struct nlmsghdr*)buffer, n, handler, arg);
+	return 0;
+}
+
+static int
+run_dump(int                 fd,
+         int                 type,
+         int                 family,
+         u_int32_t           seq,
+         iface_event_handler handler,
+         void*               arg)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct rtgenmsg gen;
+	} req;
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len    = NLMSG_LENGTH(sizeof(struct rtgenmsg));
+	req.nlh.nlmsg_type   = type;
+	req.nlh.nlmsg_flags  = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq    = seq;
+	req.gen.rtgen_family = family;
+	if (send(fd, &req, req.nlh.nlmsg_len, 0) < 0) {
+		LOG_ERROR("failed to request netlink dump. errno: %d", errno);
+		return -1;
+	}
+
+	char buffer[IFACE_WATCH_BUFFER]
+	    __attribute__((aligned(__alignof__(struct nlmsghdr))));
+	while (1) {
+		int n = recv(fd, buffer, sizeof(buffer), 0);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			LOG_ERROR("netlink dump failed. errno: %d", errno);
+			return -1;
+		}
+
+		struct nlmsghdr* nlh = (struct nlmsghdr*)buffer;
+		dispatch_events(nlh, n, handler, arg);
+		for (int len = n; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_type == NLMSG_DONE) {
+				return 0;
+			}
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr* err = NLMSG_DATA(nlh);
+				LOG_ERROR("netlink dump refused. errno: %d", -err->error);
+				return -1;
+			}
+		}
+	}
+}
+
+// calls handler with an IFACE_LINK_UP or IFACE_LINK_DOWN event for every
+// link the kernel has, then with an IFACE_ADDR_ADD event for every IPv4
+// address. the dump runs on a socket of its own, the watch socket keeps
+// collecting the changes made meanwhile.
+int
+iface_dump(iface_event_handler handler, void* arg)
+{
+	int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0) {
+		LOG_ERROR("failed to create netlink socket. errno: %d", errno);
+		return -1;
+	}
+
+	int ret = 0;
+	if (run_dump(fd, RTM_GETLINK, AF_UNSPEC, 1, handler, arg) < 0 ||
+	    run_dump(fd, RTM_GETADDR, AF_INET, 2, handler, arg) < 0) {
+		ret = -1;
+	}
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,85 @@
+#ifndef BGP_IFACE_H
+#define BGP_IFACE_H
+
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/queue.h>
+#include <sys/types.h>
+
+struct routing_entry;
+
+// an interface owned by the daemon. the embedded ifaddrs is what the rest of
+// the code passes around, chained through ifa_next over all usable
+// interfaces. ifaces are never freed while running, so pointers to them stay
+// valid after the link goes down.
+struct iface {
+	struct ifaddrs     ifa;  // must stay first
+	char               name[IF_NAMESIZE];
+	struct sockaddr_in addr;
+	struct sockaddr_in netmask;
+	struct sockaddr_in broadaddr;  // peer address on point to point links
+	int                index;
+	int                up;
+
+	// intrusive list of the routes learned through this interface.
+	LIST_HEAD(, routing_entry) routes;
+	size_t route_count;
+
+	LIST_ENTRY(iface) entries;
+};
+
+LIST_HEAD(iface_list, iface);
+
+enum iface_event_type {
+	IFACE_ADDR_ADD = 0,
+	IFACE_ADDR_DEL,
+	IFACE_LINK_UP,
+	IFACE_LINK_DOWN,
+};
+
+struct iface_event {
+	enum iface_event_type type;
+	int                   index;
+	char                  name[IF_NAMESIZE];
+	unsigned int          flags;
+	in_addr_t             addr;
+	in_addr_t             broadaddr;
+	u_int8_t              prefixlen;
+};
+
+typedef void (*iface_event_handler)(struct iface_event* event, void* arg);
+
+static inline struct iface*
+iface_of(struct ifaddrs* ifap)
+{
+	return (struct iface*)ifap;
+}
+
+struct iface* make_iface(const char*  name,
+                         int          index,
+                         unsigned int flags,
+                         in_addr_t    addr,
+                         in_addr_t    netmask,
+                         in_addr_t    broadaddr);
+
+struct iface* make_iface_from_ifaddrs(struct ifaddrs* src);
+
+void iface_set_addr(struct iface* iface,
+                    in_addr_t     addr,
+                    in_addr_t     netmask,
+                    in_addr_t     broadaddr);
+
+struct iface* find_iface(struct iface_list* ifaces, int index);
+
+struct ifaddrs* link_ifaces(struct iface_list* ifaces);
+
+void free_ifaces(struct iface_list* ifaces);
+
+int iface_watch_open();
+
+int iface_watch_read(int fd, iface_event_handler handler, void* arg);
+
+int iface_dump(iface_event_handler handler, void* arg);
+
+#endif  // BGP_IFACE_H
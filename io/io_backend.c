@@ -0,0 +1,64 @@
+#include "io_backend.h"
+#include "../logger/logger.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// only errors that pass by themselves are worth another try. anything else
+// means the socket or the ring is unusable and every further receive would
+// fail the same way.
+int
+io_recv_error(int err)
+{
+	switch (err) {
+	case EINTR:
+	case EAGAIN:
+	case ENOBUFS:
+	case ENOMEM:
+	case ECONNREFUSED:
+		return -1;
+	default:
+		return IO_RECV_FATAL;
+	}
+}
+
+struct io_backend*
+open_io_backend(const char* name, u_int16_t port)
+{
+	struct io_backend* backend = NULL;
+
+	if (name && !strcmp(name, "uring")) {
+		backend = make_uring_backend();
+		if (backend && backend->init(backend, port) < 0) {
+			LOG_WARN("io_uring backend unavailable. fall back to syscalls.");
+			close_io_backend(backend);
+			backend = NULL;
+		}
+	} else if (name && strcmp(name, "syscall")) {
+		LOG_ERROR("unknown io backend: %s", name);
+		return NULL;
+	}
+
+	if (!backend) {
+		backend = make_syscall_backend();
+		if (backend && backend->init(backend, port) < 0) {
+			close_io_backend(backend);
+			backend = NULL;
+		}
+	}
+
+	if (backend) {
+		LOG_INFO("io backend in use: %s", backend->name);
+	}
+	return backend;
+}
+
+void
+close_io_backend(struct io_backend* backend)
+{
+	if (!backend) {
+		return;
+	}
+	backend->destroy(backend);
+	free(backend);
+}
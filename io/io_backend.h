@@ -0,0 +1,78 @@
+#ifndef BGP_IO_BACKEND_H
+#define BGP_IO_BACKEND_H
+
+#include <netinet/in.h>
+#include <sys/types.h>
+
+#define SEND_TRY 3
+
+#define MAX_MESSAGE_SIZE 4096
+
+// returned by recv() when the backend can not receive anymore, so the caller
+// stops instead of trying again.
+#define IO_RECV_FATAL -2
+
+// a received datagram. data points into memory owned by the backend and stays
+// valid until the datagram is handed back with release().
+struct io_datagram {
+	char*              data;
+	int                len;
+	struct sockaddr_in sender;
+	u_int32_t          buf_id;
+};
+
+struct io_send_req {
+	struct sockaddr_in dest;
+	const char*        msg;
+	int                len;
+	int                result;   // bytes sent, or -errno once all tries failed
+	int                retries;  // failed tries that were sent again
+	void*              owner;   // opaque to the backend
+};
+
+struct io_backend {
+	const char* name;
+
+	int (*init)(struct io_backend* self, u_int16_t port);
+
+	// blocks until the next datagram arrives. returns -1 when one datagram
+	// could not be received and IO_RECV_FATAL when no more will be.
+	int (*recv)(struct io_backend* self, struct io_datagram* dgram);
+
+	void (*release)(struct io_backend* self, struct io_datagram* dgram);
+
+	// sends every request, retrying each failed one up to SEND_TRY times.
+	// returns the number of requests that could not be sent.
+	int (*send_batch)(struct io_backend* self,
+	                  struct io_send_req* reqs,
+	                  int                 count);
+
+	void (*destroy)(struct io_backend* self);
+
+	void* priv;
+};
+
+struct io_backend* make_syscall_backend();
+
+struct io_backend* make_uring_backend();
+
+// what the null backend was asked to send. kept in its priv.
+struct null_backend_stats {
+	u_int64_t messages;
+	u_int64_t bytes;
+};
+
+// swallows every datagram and never receives one, for running the protocol
+// without a network.
+struct io_backend* make_null_backend();
+
+// maps the errno of a failed receive to the result of recv().
+int io_recv_error(int err);
+
+// creates and initializes the named backend, falling back to the syscall
+// backend when the requested one is not available on this kernel.
+struct io_backend* open_io_backend(const char* name, u_int16_t port);
+
+void close_io_backend(struct io_backend* backend);
+
+#endif  // BGP_IO_BACKEND_H
@@ -0,0 +1,62 @@
+#include "../logger/logger.h"
+#include "io_backend.h"
+#include <stdlib.h>
+
+static int
+null_init(struct io_backend* self, u_int16_t port)
+{
+	return 0;
+}
+
+static int
+null_recv(struct io_backend* self, struct io_datagram* dgram)
+{
+	return -1;
+}
+
+static void
+null_release(struct io_backend* self, struct io_datagram* dgram)
+{
+}
+
+static int
+null_send_batch(struct io_backend* self, struct io_send_req* reqs, int count)
+{
+	struct null_backend_stats* stats = self->priv;
+
+	for (int i = 0; i < count; i++) {
+		reqs[i].result = reqs[i].len;
+		stats->bytes += reqs[i].len;
+	}
+	stats->messages += count;
+	return 0;
+}
+
+static void
+null_destroy(struct io_backend* self)
+{
+	free(self->priv);
+}
+
+struct io_backend*
+make_null_backend()
+{
+	struct io_backend*         backend = calloc(1, sizeof(struct io_backend));
+	struct null_backend_stats* stats =
+	    calloc(1, sizeof(struct null_backend_stats));
+	if (!backend || !stats) {
+		LOG_ERROR("failed to allocate null backend.");
+		free(backend);
+		free(stats);
+		return NULL;
+	}
+
+	backend->name       = "null";
+	backend->init       = null_init;
+	backend->recv       = null_recv;
+	backend->release    = null_release;
+	backend->send_batch = null_send_batch;
+	backend->destroy    = null_destroy;
+	backend->priv       = stats;
+	return backend;
+}
@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+
+#include "../logger/logger.h"
+#include "io_backend.h"
+#include <errno.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// upper bound of datagrams handed to a single sendmmsg() call.
+#define SYSCALL_BATCH_MAX 64
+
+struct syscall_backend {
+	int  recv_fd;
+	int  send_fd;
+	char buffer[MAX_MESSAGE_SIZE];
+};
+
+static int
+syscall_init(struct io_backend* self, u_int16_t port)
+{
+	struct syscall_backend* priv = self->priv;
+
+	if ((priv->recv_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+	    (priv->send_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+		LOG_ERROR("failed to create socket. errno: %d", errno);
+		return -1;
+	}
+
+	struct sockaddr_in recv_addr;
+	memset(&recv_addr, 0, sizeof(recv_addr));
+	recv_addr.sin_family      = AF_INET;
+	recv_addr.sin_port        = htons(port);
+	recv_addr.sin_addr.s_addr = INADDR_ANY;
+
+	if (bind(priv->recv_fd,
+	         (const struct sockaddr*)&recv_addr,
+	         sizeof(recv_addr)) < 0) {
+		LOG_ERROR("failed to bind the socket. errno: %d", errno);
+		return -1;
+	}
+
+	int broadcast_enable = 1;
+	if (setsockopt(priv->send_fd,
+	               SOL_SOCKET,
+	               SO_BROADCAST,
+	               &broadcast_enable,
+	               sizeof(broadcast_enable)) < 0) {
+		LOG_WARN("can not set broadcast enabled. errno: %d", errno);
+	}
+	return 0;
+}
+
+static int
+syscall_recv(struct io_backend* self, struct io_datagram* dgram)
+{
+	struct syscall_backend* priv    = self->priv;
+	socklen_t               addrlen = sizeof(dgram->sender);
+
+	memset(&dgram->sender, 0, sizeof(dgram->sender));
+	int n = recvfrom(priv->recv_fd,
+	                 priv->buffer,
+	                 MAX_MESSAGE_SIZE,
+	                 0,
+	                 (struct sockaddr*)&dgram->sender,
+	                 &addrlen);
+	if (n < 0) {
+		LOG_ERROR("message receive failed. errno: %d", errno);
+		return io_recv_error(errno);
+	}
+	dgram->data   = priv->buffer;
+	dgram->len    = n;
+	dgram->buf_id = 0;
+	return n;
+}
+
+static void
+syscall_release(struct io_backend* self, struct io_datagram* dgram)
+{
+	dgram->data = NULL;
+}
+
+static int
+syscall_send_batch(struct io_backend* self,
+                   struct io_send_req* reqs,
+                   int                 count)
+{
+	struct syscall_backend* priv   = self->priv;
+	int                     failed = 0;
+
+	for (int start = 0; start < count; start += SYSCALL_BATCH_MAX) {
+		struct mmsghdr msgs[SYSCALL_BATCH_MAX];
+		struct iovec   iovs[SYSCALL_BATCH_MAX];
+		int            batch = count - start;
+		if (batch > SYSCALL_BATCH_MAX) {
+			batch = SYSCALL_BATCH_MAX;
+		}
+
+		memset(msgs, 0, sizeof(msgs[0]) * batch);
+		for (int i = 0; i < batch; i++) {
+			struct io_send_req* req = &reqs[start + i];
+
+			iovs[i].iov_base            = (void*)req->msg;
+			iovs[i].iov_len             = req->len;
+			msgs[i].msg_hdr.msg_name    = &req->dest;
+			msgs[i].msg_hdr.msg_namelen = sizeof(req->dest);
+			msgs[i].msg_hdr.msg_iov     = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen  = 1;
+		}
+
+		// sendmmsg() stops at the first failing datagram, which is then
+		// retried on its own before the rest of the batch continues.
+		int done  = 0;
+		int retry = 0;
+		while (done < batch) {
+			int n = sendmmsg(priv->send_fd, msgs + done, batch - done, 0);
+			if (n > 0) {
+				for (int i = done; i < done + n; i++) {
+					reqs[start + i].result = msgs[i].msg_len;
+				}
+				done += n;
+				retry = 0;
+				continue;
+			}
+
+			int err = errno;
+			++retry;
+			LOG_WARN("message send failed. times %d, errno %d", retry, err);
+			if (retry >= SEND_TRY) {
+				reqs[start + done].result = -err;
+				++failed;
+				++done;
+				retry = 0;
+			} else {
+				++reqs[start + done].retries;
+			}
+		}
+	}
+	return failed;
+}
+
+static void
+syscall_destroy(struct io_backend* self)
+{
+	struct syscall_backend* priv = self->priv;
+	if (!priv) {
+		return;
+	}
+	if (priv->recv_fd >= 0) {
+		close(priv->recv_fd);
+	}
+	if (priv->send_fd >= 0) {
+		close(priv->send_fd);
+	}
+	free(priv);
+	self->priv = NULL;
+}
+
+struct io_backend*
+make_syscall_backend()
+{
+	struct io_backend*      backend = calloc(1, sizeof(struct io_backend));
+	struct syscall_backend* priv    = malloc(sizeof(struct syscall_backend));
+	if (!backend || !priv) {
+		LOG_ERROR("failed to allocate syscall backend.");
+		free(backend);
+		free(priv);
+		return NULL;
+	}
+	priv->recv_fd = -1;
+	priv->send_fd = -1;
+
+	backend->name       = "syscall";
+	backend->init       = syscall_init;
+	backend->recv       = syscall_recv;
+	backend->release    = syscall_release;
+	backend->send_batch = syscall_send_batch;
+	backend->destroy    = syscall_destroy;
+	backend->priv       = priv;
+	return backend;
+}
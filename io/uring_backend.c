@@ -0,0 +1,639 @@
+#include "../logger/logger.h"
+#include "io_backend.h"
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define URING_ENTRIES 256
+
+// number of provided receive buffers, must be a power of two.
+#define URING_BUF_COUNT 256
+
+#define URING_BUF_GROUP 0
+
+// every provided buffer holds the recvmsg header, the sender address and the
+// payload of one datagram.
+#define URING_BUF_SIZE                                                         \
+	(sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) +        \
+	 MAX_MESSAGE_SIZE)
+
+#define URING_RECV_TAG ((u_int64_t)-1)
+
+struct uring {
+	int fd;
+
+	unsigned*            sq_head;
+	unsigned*            sq_tail;
+	unsigned*            sq_mask;
+	unsigned*            sq_array;
+	struct io_uring_sqe* sqes;
+	unsigned             sq_entries;
+
+	unsigned*            cq_head;
+	unsigned*            cq_tail;
+	unsigned*            cq_mask;
+	struct io_uring_cqe* cqes;
+
+	void*  ring_ptr;
+	size_t ring_size;
+	size_t sqes_size;
+
+	// sqes written since the last io_uring_enter().
+	unsigned to_submit;
+};
+
+struct uring_backend {
+	int recv_fd;
+	int send_fd;
+
+	struct uring recv_ring;
+	int          recv_armed;
+	// referenced by the multishot request for as long as it stays armed.
+	struct msghdr recv_hdr;
+
+	struct io_uring_buf_ring* buf_ring;
+	size_t                    buf_ring_size;
+	u_int16_t                 buf_tail;
+	char*                     bufs;
+
+	struct uring    send_ring;
+	pthread_mutex_t send_lock;
+};
+
+static int
+uring_setup(struct uring* ring, unsigned entries)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+
+	int fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (fd < 0) {
+		LOG_WARN("io_uring_setup failed. errno: %d", errno);
+		return -1;
+	}
+	ring->fd = fd;
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+		LOG_WARN("io_uring without single mmap is not supported.");
+		return -1;
+	}
+
+	size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	size_t cq_size =
+	    params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+	ring->ring_ptr  = mmap(NULL,
+                          ring->ring_size,
+                          PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE,
+                          fd,
+                          IORING_OFF_SQ_RING);
+	if (ring->ring_ptr == MAP_FAILED) {
+		LOG_WARN("failed to map io_uring rings. errno: %d", errno);
+		ring->ring_ptr = NULL;
+		return -1;
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes      = mmap(NULL,
+                      ring->sqes_size,
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE,
+                      fd,
+                      IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		LOG_WARN("failed to map io_uring sqes. errno: %d", errno);
+		ring->sqes = NULL;
+		return -1;
+	}
+
+	char* ptr        = ring->ring_ptr;
+	ring->sq_head    = (unsigned*)(ptr + params.sq_off.head);
+	ring->sq_tail    = (unsigned*)(ptr + params.sq_off.tail);
+	ring->sq_mask    = (unsigned*)(ptr + params.sq_off.ring_mask);
+	ring->sq_array   = (unsigned*)(ptr + params.sq_off.array);
+	ring->sq_entries = params.sq_entries;
+	ring->cq_head    = (unsigned*)(ptr + params.cq_off.head);
+	ring->cq_tail    = (unsigned*)(ptr + params.cq_off.tail);
+	ring->cq_mask    = (unsigned*)(ptr + params.cq_off.ring_mask);
+	ring->cqes       = (struct io_uring_cqe*)(ptr + params.cq_off.cqes);
+	return 0;
+}
+
+static void
+uring_teardown(struct uring* ring)
+{
+	if (ring->sqes) {
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if (ring->ring_ptr) {
+		munmap(ring->ring_ptr, ring->ring_size);
+	}
+	if (ring->fd >= 0) {
+		close(ring->fd);
+	}
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+}
+
+static struct io_uring_sqe*
+uring_get_sqe(struct uring* ring)
+{
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	unsigned tail = *ring->sq_tail;
+	if (tail - head >= ring->sq_entries) {
+		return NULL;
+	}
+
+	unsigned             index = tail & *ring->sq_mask;
+	struct io_uring_sqe* sqe   = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++ring->to_submit;
+	return sqe;
+}
+
+static int
+uring_enter(struct uring* ring, unsigned wait_nr)
+{
+	while (1) {
+		int ret = syscall(__NR_io_uring_enter,
+		                  ring->fd,
+		                  ring->to_submit,
+		                  wait_nr,
+		                  wait_nr ? IORING_ENTER_GETEVENTS : 0,
+		                  NULL,
+		                  0);
+		if (ret >= 0) {
+			ring->to_submit -= ret;
+			return 0;
+		}
+		if (errno != EINTR) {
+			int err = errno;
+			LOG_ERROR("io_uring_enter failed. errno: %d", err);
+			return -err;
+		}
+	}
+}
+
+// waits in poll() for the ring to hold a completion. unlike io_uring_enter()
+// it is a cancellation point, so the receive thread can be cancelled while it
+// waits for a datagram.
+static int
+uring_wait(struct uring* ring)
+{
+	if (ring->to_submit && uring_enter(ring, 0) < 0) {
+		return -1;
+	}
+
+	struct pollfd pfd = {.fd = ring->fd, .events = POLLIN};
+	while (poll(&pfd, 1, -1) < 0) {
+		if (errno != EINTR) {
+			LOG_ERROR("io_uring poll failed. errno: %d", errno);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static struct io_uring_cqe*
+uring_peek_cqe(struct uring* ring)
+{
+	unsigned head = *ring->cq_head;
+	unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	if (head == tail) {
+		return NULL;
+	}
+	return &ring->cqes[head & *ring->cq_mask];
+}
+
+static void
+uring_cqe_seen(struct uring* ring)
+{
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+static void
+provide_buffer(struct uring_backend* priv, u_int16_t bid)
+{
+	struct io_uring_buf* buf =
+	    &priv->buf_ring->bufs[priv->buf_tail & (URING_BUF_COUNT - 1)];
+	buf->addr = (u_int64_t)(priv->bufs + (size_t)bid * URING_BUF_SIZE);
+	buf->len  = URING_BUF_SIZE;
+	buf->bid  = bid;
+	++priv->buf_tail;
+	__atomic_store_n(&priv->buf_ring->tail, priv->buf_tail, __ATOMIC_RELEASE);
+}
+
+static int
+register_buffers(struct uring_backend* priv)
+{
+	priv->buf_ring_size = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+	priv->buf_ring      = mmap(NULL,
+                          priv->buf_ring_size,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS,
+                          -1,
+                          0);
+	if (priv->buf_ring == MAP_FAILED) {
+		LOG_WARN("failed to map buffer ring. errno: %d", errno);
+		priv->buf_ring = NULL;
+		return -1;
+	}
+
+	priv->bufs = aligned_alloc(sizeof(u_int64_t),
+	                           (size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+	if (!priv->bufs) {
+		LOG_ERROR("failed to allocate receive buffers.");
+		return -1;
+	}
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr    = (u_int64_t)priv->buf_ring;
+	reg.ring_entries = URING_BUF_COUNT;
+	reg.bgid         = URING_BUF_GROUP;
+	if (syscall(__NR_io_uring_register,
+	            priv->recv_ring.fd,
+	            IORING_REGISTER_PBUF_RING,
+	            &reg,
+	            1) < 0) {
+		LOG_WARN("failed to register buffer ring. errno: %d", errno);
+		return -1;
+	}
+
+	priv->buf_ring->tail = 0;
+	priv->buf_tail       = 0;
+	for (u_int16_t bid = 0; bid < URING_BUF_COUNT; bid++) {
+		provide_buffer(priv, bid);
+	}
+	return 0;
+}
+
+static int
+arm_recv(struct uring_backend* priv)
+{
+	struct io_uring_sqe* sqe = uring_get_sqe(&priv->recv_ring);
+	if (!sqe) {
+		LOG_ERROR("no sqe left for receive.");
+		return -1;
+	}
+	sqe->opcode    = IORING_OP_RECVMSG;
+	sqe->fd        = priv->recv_fd;
+	sqe->addr      = (u_int64_t)&priv->recv_hdr;
+	sqe->len       = 1;
+	sqe->flags     = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUF_GROUP;
+	sqe->ioprio    = IORING_RECV_MULTISHOT;
+	sqe->user_data = URING_RECV_TAG;
+
+	priv->recv_armed = 1;
+	return uring_enter(&priv->recv_ring, 0);
+}
+
+static int
+uring_init(struct io_backend* self, u_int16_t port)
+{
+	struct uring_backend* priv = self->priv;
+
+	if (uring_setup(&priv->recv_ring, URING_ENTRIES) < 0 ||
+	    uring_setup(&priv->send_ring, URING_ENTRIES) < 0) {
+		return -1;
+	}
+	if (register_buffers(priv) < 0) {
+		return -1;
+	}
+
+	if ((priv->recv_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+	    (priv->send_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+		LOG_ERROR("failed to create socket. errno: %d", errno);
+		return -1;
+	}
+
+	struct sockaddr_in recv_addr;
+	memset(&recv_addr, 0, sizeof(recv_addr));
+	recv_addr.sin_family      = AF_INET;
+	recv_addr.sin_port        = htons(port);
+	recv_addr.sin_addr.s_addr = INADDR_ANY;
+	if (bind(priv->recv_fd,
+	         (const struct sockaddr*)&recv_addr,
+	         sizeof(recv_addr)) < 0) {
+		LOG_ERROR("failed to bind the socket. errno: %d", errno);
+		return -1;
+	}
+
+	int broadcast_enable = 1;
+	if (setsockopt(priv->send_fd,
+	               SOL_SOCKET,
+	               SO_BROADCAST,
+	               &broadcast_enable,
+	               sizeof(broadcast_enable)) < 0) {
+		LOG_WARN("can not set broadcast enabled. errno: %d", errno);
+	}
+
+	memset(&priv->recv_hdr, 0, sizeof(priv->recv_hdr));
+	priv->recv_hdr.msg_namelen = sizeof(struct sockaddr_in);
+	if (arm_recv(priv) < 0) {
+		return -1;
+	}
+
+	// provided buffer rings arrived in 5.19 but multishot recvmsg only in
+	// 6.0. an older kernel rejects the request as soon as it is submitted,
+	// while a supported one has nothing to complete before a datagram
+	// arrives.
+	struct io_uring_cqe* cqe = uring_peek_cqe(&priv->recv_ring);
+	if (cqe && cqe->res < 0) {
+		LOG_WARN("multishot receive is not supported. errno: %d", -cqe->res);
+		uring_cqe_seen(&priv->recv_ring);
+		priv->recv_armed = 0;
+		return -1;
+	}
+	return 0;
+}
+
+// the multishot receive stays armed across calls. it is only re-armed when
+// the kernel terminates it, e.g. after running out of provided buffers.
+static int
+uring_recv(struct io_backend* self, struct io_datagram* dgram)
+{
+	struct uring_backend* priv = self->priv;
+
+	while (1) {
+		if (!priv->recv_armed && arm_recv(priv) < 0) {
+			return IO_RECV_FATAL;
+		}
+
+		struct io_uring_cqe* cqe = uring_peek_cqe(&priv->recv_ring);
+		if (!cqe) {
+			if (uring_wait(&priv->recv_ring) < 0) {
+				return IO_RECV_FATAL;
+			}
+			continue;
+		}
+
+		int       res   = cqe->res;
+		u_int32_t flags = cqe->flags;
+		uring_cqe_seen(&priv->recv_ring);
+
+		if (!(flags & IORING_CQE_F_MORE)) {
+			priv->recv_armed = 0;
+		}
+		if (res < 0) {
+			if (res != -ENOBUFS) {
+				LOG_ERROR("message receive failed. errno: %d", -res);
+				return io_recv_error(-res);
+			}
+			LOG_WARN("receive buffers exhausted. re-arming.");
+			continue;
+		}
+		if (!(flags & IORING_CQE_F_BUFFER)) {
+			continue;
+		}
+
+		u_int16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		char*     buf = priv->bufs + (size_t)bid * URING_BUF_SIZE;
+		struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*)buf;
+		char* name    = buf + sizeof(*out);
+		char* payload = name + priv->recv_hdr.msg_namelen + out->controllen;
+
+		if (out->flags & MSG_TRUNC) {
+			LOG_WARN("truncated message received. dispose.");
+			provide_buffer(priv, bid);
+			continue;
+		}
+
+		memset(&dgram->sender, 0, sizeof(dgram->sender));
+		memcpy(&dgram->sender,
+		       name,
+		       out->namelen < sizeof(dgram->sender) ? out->namelen
+		                                            : sizeof(dgram->sender));
+		dgram->data   = payload;
+		dgram->len    = out->payloadlen;
+		dgram->buf_id = bid;
+		return dgram->len;
+	}
+}
+
+static void
+uring_release(struct io_backend* self, struct io_datagram* dgram)
+{
+	struct uring_backend* priv = self->priv;
+	if (dgram->data) {
+		provide_buffer(priv, dgram->buf_id);
+		dgram->data = NULL;
+	}
+}
+
+static int
+queue_send(struct uring_backend* priv,
+           struct io_send_req*   req,
+           struct msghdr*        hdr,
+           struct iovec*         iov,
+           u_int64_t             index)
+{
+	struct io_uring_sqe* sqe = uring_get_sqe(&priv->send_ring);
+	if (!sqe) {
+		return -1;
+	}
+	iov->iov_base    = (void*)req->msg;
+	iov->iov_len     = req->len;
+	hdr->msg_name    = &req->dest;
+	hdr->msg_namelen = sizeof(req->dest);
+	hdr->msg_iov     = iov;
+	hdr->msg_iovlen  = 1;
+
+	sqe->opcode    = IORING_OP_SENDMSG;
+	sqe->fd        = priv->send_fd;
+	sqe->addr      = (u_int64_t)hdr;
+	sqe->len       = 1;
+	sqe->user_data = index;
+	return 0;
+}
+
+// io_uring_enter() failed in the middle of a batch. the sqes it did not
+// submit are taken back, the kernel has not read them yet. the sends it did
+// submit still point at the headers of the batch and are waited out before
+// those are freed. returns -1 when they could not be waited out and the
+// headers must stay allocated.
+static int
+abort_send_batch(struct uring_backend* priv,
+                 struct io_send_req*   reqs,
+                 int                   inflight)
+{
+	struct uring* ring = &priv->send_ring;
+
+	__atomic_store_n(
+	    ring->sq_tail, *ring->sq_tail - ring->to_submit, __ATOMIC_RELEASE);
+	inflight -= ring->to_submit;
+	ring->to_submit = 0;
+
+	while (inflight > 0) {
+		if (uring_wait(ring) < 0) {
+			LOG_ERROR("%d sends left in flight. leaking their headers.",
+			          inflight);
+			return -1;
+		}
+		struct io_uring_cqe* cqe;
+		while ((cqe = uring_peek_cqe(ring))) {
+			reqs[cqe->user_data].result = cqe->res;
+			uring_cqe_seen(ring);
+			--inflight;
+		}
+	}
+	return 0;
+}
+
+// all sends of a batch are submitted with a single io_uring_enter() and
+// reaped together. failed sends are resubmitted up to SEND_TRY times.
+static int
+uring_send_batch(struct io_backend* self,
+                 struct io_send_req* reqs,
+                 int                 count)
+{
+	struct uring_backend* priv   = self->priv;
+	int                   failed = 0;
+
+	struct msghdr* hdrs  = calloc(count, sizeof(struct msghdr));
+	struct iovec*  iovs  = calloc(count, sizeof(struct iovec));
+	int*           tries = calloc(count, sizeof(int));
+	if (!hdrs || !iovs || !tries) {
+		LOG_ERROR("failed to allocate send batch.");
+		free(hdrs);
+		free(iovs);
+		free(tries);
+		return count;
+	}
+
+	// a request still in progress when the batch ends was never sent.
+	for (int i = 0; i < count; i++) {
+		reqs[i].result = -EINPROGRESS;
+	}
+
+	pthread_mutex_lock(&priv->send_lock);
+
+	int next     = 0;
+	int inflight = 0;
+	int err      = 0;
+	while (next < count || inflight) {
+		while (next < count &&
+		       !queue_send(priv, &reqs[next], &hdrs[next], &iovs[next], next)) {
+			++next;
+			++inflight;
+		}
+		if ((err = uring_enter(&priv->send_ring, 1)) < 0) {
+			if (abort_send_batch(priv, reqs, inflight) < 0) {
+				hdrs = NULL;
+				iovs = NULL;
+			}
+			break;
+		}
+
+		struct io_uring_cqe* cqe;
+		while ((cqe = uring_peek_cqe(&priv->send_ring))) {
+			u_int64_t index = cqe->user_data;
+			int       res   = cqe->res;
+			uring_cqe_seen(&priv->send_ring);
+			--inflight;
+
+			if (res >= 0) {
+				reqs[index].result = res;
+				continue;
+			}
+			++tries[index];
+			LOG_WARN("message send failed. times %d, errno %d",
+			         tries[index],
+			         -res);
+			if (tries[index] >= SEND_TRY ||
+			    queue_send(priv,
+			               &reqs[index],
+			               &hdrs[index],
+			               &iovs[index],
+			               index) < 0) {
+				reqs[index].result = res;
+				++failed;
+			} else {
+				++reqs[index].retries;
+				++inflight;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&priv->send_lock);
+
+	if (err < 0) {
+		failed = 0;
+		for (int i = 0; i < count; i++) {
+			if (reqs[i].result == -EINPROGRESS) {
+				reqs[i].result = err;
+			}
+			if (reqs[i].result < 0) {
+				++failed;
+			}
+		}
+	}
+
+	free(hdrs);
+	free(iovs);
+	free(tries);
+	return failed;
+}
+
+static void
+uring_destroy(struct io_backend* self)
+{
+	struct uring_backend* priv = self->priv;
+	if (!priv) {
+		return;
+	}
+	uring_teardown(&priv->recv_ring);
+	uring_teardown(&priv->send_ring);
+	if (priv->buf_ring) {
+		munmap(priv->buf_ring, priv->buf_ring_size);
+	}
+	free(priv->bufs);
+	if (priv->recv_fd >= 0) {
+		close(priv->recv_fd);
+	}
+	if (priv->send_fd >= 0) {
+		close(priv->send_fd);
+	}
+	pthread_mutex_destroy(&priv->send_lock);
+	free(priv);
+	self->priv = NULL;
+}
+
+struct io_backend*
+make_uring_backend()
+{
+	struct io_backend*    backend = calloc(1, sizeof(struct io_backend));
+	struct uring_backend* priv    = calloc(1, sizeof(struct uring_backend));
+	if (!backend || !priv) {
+		LOG_ERROR("failed to allocate io_uring backend.");
+		free(backend);
+		free(priv);
+		return NULL;
+	}
+	priv->recv_fd      = -1;
+	priv->send_fd      = -1;
+	priv->recv_ring.fd = -1;
+	priv->send_ring.fd = -1;
+	pthread_mutex_init(&priv->send_lock, NULL);
+
+	backend->name       = "uring";
+	backend->init       = uring_init;
+	backend->recv       = uring_recv;
+	backend->release    = uring_release;
+	backend->send_batch = uring_send_batch;
+	backend->destroy    = uring_destroy;
+	backend->priv       = priv;
+	return backend;
+}
@@ -0,0 +1,342 @@
+#include "journal.h"
+#include "../logger/logger.h"
+#include <endian.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define JOURNAL_HEADER_SIZE 28
+#define JOURNAL_VARINT_MAX  10
+
+static u_int64_t
+monotonic_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static size_t
+put_varint(u_int8_t* out, u_int64_t value)
+{
+	size_t n = 0;
+	while (value >= 0x80) {
+		out[n++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	out[n++] = value;
+	return n;
+}
+
+static size_t
+put_addr(u_int8_t* out, in_addr_t addr)
+{
+	memcpy(out, &addr, sizeof(addr));
+	return sizeof(addr);
+}
+
+struct journal_writer*
+journal_create(const char* path, const struct journal_header* header)
+{
+	struct journal_writer* writer = calloc(1, sizeof(struct journal_writer));
+	if (!writer) {
+		LOG_ERROR("failed to allocate journal writer.");
+		return NULL;
+	}
+	writer->file = fopen(path, "wb");
+	if (!writer->file) {
+		LOG_ERROR("failed to create journal %s. errno: %d", path, errno);
+		free(writer);
+		return NULL;
+	}
+
+	u_int8_t  raw[JOURNAL_HEADER_SIZE] = {0};
+	u_int32_t tick_ms                  = htole32(header->tick_ms);
+	u_int64_t host_id                  = htole64(header->host_id);
+	u_int64_t route_max_age            = htole64(header->route_max_age);
+	memcpy(raw, JOURNAL_MAGIC, 4);
+	raw[4] = JOURNAL_VERSION;
+	raw[5] = header->damp_enabled;
+	memcpy(raw + 8, &tick_ms, sizeof(tick_ms));
+	memcpy(raw + 12, &host_id, sizeof(host_id));
+	memcpy(raw + 20, &route_max_age, sizeof(route_max_age));
+
+	if (fwrite(raw, sizeof(raw), 1, writer->file) != 1) {
+		LOG_ERROR("failed to write journal header. errno: %d", errno);
+		journal_close(writer);
+		return NULL;
+	}
+	writer->bytes = sizeof(raw);
+	writer->start = monotonic_ns();
+	return writer;
+}
+
+// returns 1 when recv_if has not been written with its current address yet.
+static int
+remember_iface(struct journal_writer* writer, struct iface* recv_if)
+{
+	in_addr_t addr = recv_if->addr.sin_addr.s_addr;
+
+	for (size_t i = 0; i < writer->known_count; i++) {
+		if (writer->known[i].index == recv_if->index) {
+			if (writer->known[i].addr == addr) {
+				return 0;
+			}
+			writer->known[i].addr = addr;
+			return 1;
+		}
+	}
+
+	if (writer->known_count == writer->known_capacity) {
+		size_t capacity =
+		    writer->known_capacity ? writer->known_capacity * 2 : 8;
+		struct journal_known_iface* new =
+		    reallocarray(writer->known, capacity, sizeof(*new));
+		if (!new) {
+			return 1;
+		}
+		writer->known          = new;
+		writer->known_capacity = capacity;
+	}
+	writer->known[writer->known_count++] = (struct journal_known_iface){
+	    .index = recv_if->index,
+	    .addr  = addr,
+	};
+	return 1;
+}
+
+static int
+write_iface(struct journal_writer* writer, struct iface* recv_if)
+{
+	u_int8_t raw[1 + 2 * JOURNAL_VARINT_MAX + 12 + 1 + IF_NAMESIZE];
+	size_t   name_len = strnlen(recv_if->name, IF_NAMESIZE - 1);
+	size_t   n        = 0;
+
+	raw[n++] = JOURNAL_IFACE;
+	n += put_varint(raw + n, recv_if->index);
+	n += put_varint(raw + n, recv_if->ifa.ifa_flags);
+	n += put_addr(raw + n, recv_if->addr.sin_addr.s_addr);
+	n += put_addr(raw + n, recv_if->netmask.sin_addr.s_addr);
+	n += put_addr(raw + n, recv_if->broadaddr.sin_addr.s_addr);
+	raw[n++] = name_len;
+	memcpy(raw + n, recv_if->name, name_len);
+	n += name_len;
+
+	if (fwrite(raw, n, 1, writer->file) != 1) {
+		return -1;
+	}
+	writer->bytes += n;
+	return 0;
+}
+
+// writes an iface record unless the interface is already in the journal with
+// its current address.
+int
+journal_iface(struct journal_writer* writer, struct iface* iface)
+{
+	if (remember_iface(writer, iface) && write_iface(writer, iface)) {
+		LOG_WARN("failed to write journal. errno: %d", errno);
+		return -1;
+	}
+	return 0;
+}
+
+// appends one received update. the journal is buffered by stdio, so this
+// normally costs a copy and no system call.
+int
+journal_record(struct journal_writer*   writer,
+               enum journal_record_type type,
+               struct iface*            recv_if,
+               in_addr_t                sender,
+               const char*              data,
+               u_int32_t                len)
+{
+	if (journal_iface(writer, recv_if)) {
+		return -1;
+	}
+
+	u_int64_t now = monotonic_ns() - writer->start;
+	u_int8_t  raw[1 + 3 * JOURNAL_VARINT_MAX + 4];
+	size_t    n = 0;
+
+	raw[n++] = type;
+	n += put_varint(raw + n, now - writer->last);
+	n += put_varint(raw + n, recv_if->index);
+	n += put_addr(raw + n, sender);
+	n += put_varint(raw + n, len);
+	writer->last = now;
+
+	if (fwrite(raw, n, 1, writer->file) != 1 ||
+	    (len && fwrite(data, len, 1, writer->file) != 1)) {
+		LOG_WARN("failed to write journal. errno: %d", errno);
+		return -1;
+	}
+	++writer->records;
+	writer->bytes += n + len;
+	return 0;
+}
+
+void
+journal_close(struct journal_writer* writer)
+{
+	if (!writer) {
+		return;
+	}
+	if (fclose(writer->file)) {
+		LOG_WARN("failed to flush journal. errno: %d", errno);
+	}
+	free(writer->known);
+	free(writer);
+}
+
+struct journal_reader*
+journal_open(const char* path)
+{
+	struct journal_reader* reader = calloc(1, sizeof(struct journal_reader));
+	if (!reader) {
+		LOG_ERROR("failed to allocate journal reader.");
+		return NULL;
+	}
+	reader->file = fopen(path, "rb");
+	if (!reader->file) {
+		LOG_ERROR("failed to open journal %s. errno: %d", path, errno);
+		free(reader);
+		return NULL;
+	}
+
+	u_int8_t raw[JOURNAL_HEADER_SIZE];
+	if (fread(raw, sizeof(raw), 1, reader->file) != 1 ||
+	    memcmp(raw, JOURNAL_MAGIC, 4) || raw[4] != JOURNAL_VERSION) {
+		LOG_ERROR("%s is not a journal of version %d.", path, JOURNAL_VERSION);
+		journal_reader_close(reader);
+		return NULL;
+	}
+
+	u_int32_t tick_ms;
+	u_int64_t host_id;
+	u_int64_t route_max_age;
+	memcpy(&tick_ms, raw + 8, sizeof(tick_ms));
+	memcpy(&host_id, raw + 12, sizeof(host_id));
+	memcpy(&route_max_age, raw + 20, sizeof(route_max_age));
+	reader->header.damp_enabled  = raw[5];
+	reader->header.tick_ms       = le32toh(tick_ms);
+	reader->header.host_id       = le64toh(host_id);
+	reader->header.route_max_age = le64toh(route_max_age);
+	return reader;
+}
+
+static int
+get_varint(FILE* file, u_int64_t* value)
+{
+	*value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int c = fgetc(file);
+		if (c == EOF) {
+			return -1;
+		}
+		*value |= (u_int64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int
+get_addr(FILE* file, in_addr_t* addr)
+{
+	return fread(addr, sizeof(*addr), 1, file) == 1 ? 0 : -1;
+}
+
+static int
+read_iface(struct journal_reader* reader, struct journal_entry* entry)
+{
+	u_int64_t index;
+	u_int64_t flags;
+	int       name_len;
+
+	if (get_varint(reader->file, &index) || get_varint(reader->file, &flags) ||
+	    get_addr(reader->file, &entry->addr) ||
+	    get_addr(reader->file, &entry->netmask) ||
+	    get_addr(reader->file, &entry->broadaddr) ||
+	    (name_len = fgetc(reader->file)) == EOF || name_len >= IF_NAMESIZE) {
+		return -1;
+	}
+	memset(entry->name, 0, sizeof(entry->name));
+	if (name_len && fread(entry->name, name_len, 1, reader->file) != 1) {
+		return -1;
+	}
+	entry->index = index;
+	entry->flags = flags;
+	return 0;
+}
+
+static int
+read_update(struct journal_reader* reader, struct journal_entry* entry)
+{
+	u_int64_t delta;
+	u_int64_t index;
+	u_int64_t len;
+
+	if (get_varint(reader->file, &delta) || get_varint(reader->file, &index) ||
+	    get_addr(reader->file, &entry->sender) ||
+	    get_varint(reader->file, &len) || len > UINT32_MAX) {
+		return -1;
+	}
+	if (len > reader->capacity) {
+		char* new = realloc(reader->buffer, len);
+		if (!new) {
+			LOG_ERROR("failed to allocate %lu bytes for a record.", len);
+			return -1;
+		}
+		reader->buffer   = new;
+		reader->capacity = len;
+	}
+	if (len && fread(reader->buffer, len, 1, reader->file) != 1) {
+		return -1;
+	}
+
+	reader->time += delta;
+	entry->time  = reader->time;
+	entry->index = index;
+	entry->data  = reader->buffer;
+	entry->len   = len;
+	return 0;
+}
+
+// returns 1 when an entry was read, 0 at the end of the journal and -1 for a
+// truncated or corrupt record.
+int
+journal_next(struct journal_reader* reader, struct journal_entry* entry)
+{
+	int type = fgetc(reader->file);
+	if (type == EOF) {
+		return 0;
+	}
+
+	entry->type = type;
+	int ret     = -1;
+	if (type == JOURNAL_IFACE) {
+		ret = read_iface(reader, entry);
+	} else if (type == JOURNAL_DATAGRAM || type == JOURNAL_FRAME) {
+		ret = read_update(reader, entry);
+	}
+	if (ret) {
+		LOG_WARN("journal record of type %d is corrupt or truncated.", type);
+		return -1;
+	}
+	return 1;
+}
+
+void
+journal_reader_close(struct journal_reader* reader)
+{
+	if (!reader) {
+		return;
+	}
+	fclose(reader->file);
+	free(reader->buffer);
+	free(reader);
+}
@@ -0,0 +1,104 @@
+#ifndef BGP_JOURNAL_H
+#define BGP_JOURNAL_H
+
+#include "../iface/iface.h"
+#include <netinet/in.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+// a journal starts with a fixed header followed by records. every record is
+// a type byte and its fields. integers are LEB128 encoded, addresses are four
+// bytes in network order:
+//
+//   JOURNAL_IFACE    index, flags, addr, netmask, broadaddr, name length, name
+//   JOURNAL_DATAGRAM time delta, iface index, sender, length, payload
+//   JOURNAL_FRAME    same as a datagram, received over a stream connection
+//
+// time deltas are nanoseconds since the previous update record. an iface
+// record is written before the first update through an interface and again
+// whenever its address changed.
+#define JOURNAL_MAGIC   "BGPJ"
+#define JOURNAL_VERSION 1
+
+enum journal_record_type {
+	JOURNAL_IFACE = 1,
+	JOURNAL_DATAGRAM,
+	JOURNAL_FRAME,
+};
+
+// the settings decision() depends on, so that a replay takes the same
+// decisions as the recording daemon.
+struct journal_header {
+	u_int64_t host_id;
+	u_int64_t route_max_age;  // ticks
+	u_int32_t tick_ms;
+	u_int8_t  damp_enabled;
+};
+
+struct journal_entry {
+	enum journal_record_type type;
+
+	// JOURNAL_IFACE
+	int          index;
+	unsigned int flags;
+	in_addr_t    addr;
+	in_addr_t    netmask;
+	in_addr_t    broadaddr;
+	char         name[IF_NAMESIZE];
+
+	// JOURNAL_DATAGRAM and JOURNAL_FRAME. data is owned by the reader and
+	// valid until the next call to journal_next().
+	u_int64_t time;  // nanoseconds since the recording started
+	in_addr_t sender;
+	char*     data;
+	u_int32_t len;
+};
+
+struct journal_known_iface {
+	int       index;
+	in_addr_t addr;
+};
+
+struct journal_writer {
+	FILE*     file;
+	u_int64_t start;  // monotonic nanoseconds
+	u_int64_t last;   // time of the previous update record
+
+	struct journal_known_iface* known;
+	size_t                      known_count;
+	size_t                      known_capacity;
+
+	u_int64_t records;
+	u_int64_t bytes;
+};
+
+struct journal_reader {
+	FILE*                 file;
+	struct journal_header header;
+	u_int64_t             time;
+
+	char*  buffer;
+	size_t capacity;
+};
+
+struct journal_writer* journal_create(const char*                  path,
+                                      const struct journal_header* header);
+
+int journal_iface(struct journal_writer* writer, struct iface* iface);
+
+int journal_record(struct journal_writer*   writer,
+                   enum journal_record_type type,
+                   struct iface*            recv_if,
+                   in_addr_t                sender,
+                   const char*              data,
+                   u_int32_t                len);
+
+void journal_close(struct journal_writer* writer);
+
+struct journal_reader* journal_open(const char* path);
+
+int journal_next(struct journal_reader* reader, struct journal_entry* entry);
+
+void journal_reader_close(struct journal_reader* reader);
+
+#endif  // BGP_JOURNAL_H
@@ -1,5 +1,9 @@
+#include "control/control.h"
+#include "journal/journal.h"
 #include "logger/logger.h"
+#include "mem/mem_account.h"
 #include "mem/mem_utils.h"
+#include "protocol/protocol.h"
 #include "vector/vector.h"
 #include <arpa/inet.h>
 #include <bits/pthreadtypes.h>
@@ -9,12 +13,14 @@
 #include <net/if.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <printf.h>
 #include <pthread.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/queue.h>
 #include <sys/socket.h>
@@ -22,247 +28,31 @@
 #include <time.h>
 #include <unistd.h>
 
-#define BROADCAST_PORT 5151
-// #define RECV_PORT      5152
+const char* io_backend_name = "syscall";
 
-#define SEND_TRY 3
+// records every received update when set with -r, guarded by routing_lock.
+const char*            journal_path = NULL;
+struct journal_writer* journal      = NULL;
 
-#define MAX_MESSAGE_SIZE 4096
+// serves metrics in prometheus text format when set with -m.
+const char* metrics_path = NULL;
 
-struct ifaddrs* filtered_ifap = NULL;
+// answers route queries on a unix socket when set with -c.
+const char* control_path = NULL;
 
-u_int64_t host_id = 0;
+// programs the best routes into the kernel when set with -f.
+const char* fib_backend_name = NULL;
 
-struct update_message {
-	u_int32_t size;
-	u_int32_t path_len;
-	enum {
-		MADD = 0,
-		MWITHDRAW,
-	} type;
-	in_addr_t addr;
-	in_addr_t gateway;
-	u_int32_t weight;
-	u_int64_t ASPATH[];
-};
-
-struct update_message*
-make_message()
-{
-	struct update_message* p = calloc(1, sizeof(struct update_message));
-	p->size                  = sizeof(*p);
-	return p;
-}
-
-void
-free_message(struct update_message* ptr)
-{
-	free(ptr);
-}
-
-struct routing_entry {
-	u_int32_t       weight;
-	in_addr_t       mask;
-	in_addr_t       base;
-	in_addr_t       gateway;
-	struct ifaddrs* if_addr;
-	LIST_ENTRY(routing_entry) entries;
-};
-
-int
-routing_entry_eq(struct routing_entry* a, struct routing_entry* b)
-{
-	return (a->base == b->base) && (a->mask == b->mask) &&
-	       (a->gateway == b->gateway) && (a->if_addr == b->if_addr) &&
-	       (a->weight == b->weight);
-}
-
-int
-copy_routing_entry(struct routing_entry* src, struct routing_entry* dest)
-{
-	if (!src || !dest) {
-		LOG_ERROR("null pointer when copying routing entry");
-		return -1;
-	}
-	dest->weight  = src->weight;
-	dest->mask    = src->mask;
-	dest->base    = src->base;
-	dest->gateway = src->gateway;
-	dest->if_addr = src->if_addr;
-	return 0;
-}
-
-#ifndef LIST_FOREACH_SAFE
-#define LIST_FOREACH_SAFE(var, head, field, tvar)                              \
-	for ((var) = LIST_FIRST((head));                                           \
-	     (var) && ((tvar) = LIST_NEXT((var), field), 1);                       \
-	     (var) = (tvar))
-#endif
-
-LIST_HEAD(, routing_entry) routing_table;
-
-void
-log_routing_table()
-{
-	struct routing_entry* current;
-
-	union seg4_addr {
-		struct {
-			u_int8_t seg1;
-			u_int8_t seg2;
-			u_int8_t seg3;
-			u_int8_t seg4;
-		} addr;
-		in_addr_t raw;
-	};
-
-	LOG_INFO("start logging routing table");
-	LIST_FOREACH (current, &routing_table, entries) {
-		union seg4_addr base = {.raw = current->base};
-		LOG_INFO("\tbase:%d:%d:%d:%d",
-		         base.addr.seg1,
-		         base.addr.seg2,
-		         base.addr.seg3,
-		         base.addr.seg4);
-		union seg4_addr gateway = {.raw = current->gateway};
-		LOG_INFO("\tgateway:%d:%d:%d:%d",
-		         gateway.addr.seg1,
-		         gateway.addr.seg2,
-		         gateway.addr.seg3,
-		         gateway.addr.seg4);
-		LOG_INFO("\tweight: %d", current->weight);
-		LOG_INFO("\tif_name: %s", current->if_addr->ifa_name);
-	}
-	LOG_INFO("logging routing table finished");
-}
-
-void
-free_routing_table()
-{
-	struct routing_entry* current;
-	struct routing_entry* temp;
-	LIST_FOREACH_SAFE (current, &routing_table, entries, temp) {
-		free(current);
-	}
-	LIST_INIT(&routing_table);
-}
-
-// TODO(134ARG): optimize
-struct update_message*
-add_aspath(struct update_message* m_ptr, u_int64_t new_host_id)
-{
-	unsigned int original_len = m_ptr->path_len;
-	unsigned int original_size =
-	    sizeof(struct update_message) + original_len * sizeof(u_int64_t);
-	unsigned int new_size =
-	    sizeof(struct update_message) + (original_len + 1) * sizeof(u_int64_t);
-	struct update_message* new_p = malloc(new_size);
-	memcpy(new_p, m_ptr, original_size);
-	memcpy(&(new_p->ASPATH)[original_len], &new_host_id, sizeof(u_int64_t));
-
-	++(new_p->path_len);
-	new_p->size = new_size;
-
-	LOG_INFO("ASPATH added.");
-
-	return new_p;
-}
-
-int
-route_aggregate(struct routing_entry* new, struct routing_entry* old)
-{
-	// TODO(134ARG): to be implemented
-	return 1;
-}
-
-int
-route_disaggregate(struct routing_entry* new, struct routing_entry* old)
-{
-	// TODO(134ARG): to be implemented
-	return 1;
-}
-
-enum add_status {
-	SNEW = 0,
-	SEXISTED,
-};
-
-enum add_status
-add_new_route(struct routing_entry* new)
-{
-	struct routing_entry* current;
-
-	LIST_FOREACH (current, &routing_table, entries) {
-		int ret = route_aggregate(new, current);
-		if (!ret) {
-			return SEXISTED;
-		}
-
-		if (routing_entry_eq(new, current)) {
-			return SEXISTED;
-		}
-
-		if ((new->base == current->base) &&
-		    (!strcmp(new->if_addr->ifa_name, current->if_addr->ifa_name)) &&
-		    (new->weight < current->weight)) {
-			copy_routing_entry(new, current);
-			return SEXISTED;
-		}
-	}
-
-	struct routing_entry* copy = malloc(sizeof(struct routing_entry));
-	memcpy(copy, new, sizeof(struct routing_entry));
+// mirrors the best routes into POSIX shared memory when set with -e.
+const char* shm_name = NULL;
 
-	LIST_INSERT_HEAD(&routing_table, copy, entries);
-
-	return SNEW;
-}
-
-enum withdraw_status {
-	SWITHDREW = 0,
-	SNO,
-};
-
-int
-withdraw_route(struct routing_entry* withdraw)
-{
-	struct routing_entry* current;
-	struct routing_entry* temp;
-
-	LIST_FOREACH_SAFE (current, &routing_table, entries, temp) {
-		int ret = route_disaggregate(withdraw, current);
-		if (!ret) {
-			return SWITHDREW;
-		}
-
-		if (withdraw->base == current->base) {
-			LIST_REMOVE(current, entries);
-			free(current);
-			return SWITHDREW;
-		}
-	}
-
-	return SNO;
-}
+// protects the routing table, the interfaces, the neighbors and the timers.
+pthread_mutex_t routing_lock = PTHREAD_MUTEX_INITIALIZER;
 
 // use inet_pton() to set ip address, example:
 // 	struct sockaddr_in* addr = (struct sockaddr_in*)&ifr.ifr_addr;
 // 	inet_pton(AF_INET, "10.12.0.1", &addr->sin_addr);
 
-int
-get_addr_str(struct sockaddr* ifa_addr, char* str)
-{
-	return getnameinfo(ifa_addr,
-	                   (ifa_addr->sa_family == AF_INET)
-	                       ? sizeof(struct sockaddr_in)
-	                       : sizeof(struct sockaddr_in6),
-	                   str,
-	                   NI_MAXHOST,
-	                   NULL,
-	                   0,
-	                   NI_NUMERICHOST);
-}
-
 struct ifaddrs*
 get_valid_ifs(struct ifaddrs* ifap, int accept_ipv6, int accept_lo)
 {
@@ -325,17 +115,6 @@ get_valid_ifs(struct ifaddrs* ifap, int accept_ipv6, int accept_lo)
 	return ret_addr;
 }
 
-unsigned int
-len_ifs(struct ifaddrs* ifs)
-{
-	unsigned int length = 0;
-	while (ifs) {
-		++length;
-		ifs = ifs->ifa_next;
-	}
-	return length;
-}
-
 void
 print_ifaddrs(struct ifaddrs* ifap)
 {
@@ -379,270 +158,274 @@ close_socket(int* socketfd)
 	close(*socketfd);
 }
 
-int
-broadcast_message_from_if(struct ifaddrs* ifap, char* msg, int len)
+u_int64_t
+current_tick()
 {
-	CLEANUP(close_socket) int socketfd;
-
-	if ((socketfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-		LOG_ERROR("failed to create socket. errno: %d", errno);
-		return -1;
-	}
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((u_int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000) /
+	       TIMER_TICK_MS;
+}
 
-	struct sockaddr_in dest_addr;
-	memset(&dest_addr, 0, sizeof(dest_addr));
-	struct sockaddr_in* if_addr = NULL;
+void*
+timer_main_loop(void* arg)
+{
+	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+	while (1) {
+		usleep(TIMER_TICK_MS * 1000);
 
-	if (ifap->ifa_flags & IFF_BROADCAST) {
-		if_addr              = (struct sockaddr_in*)ifap->ifa_broadaddr;
-		int broadcast_enable = 1;
-		int ret              = setsockopt(socketfd,
-                             SOL_SOCKET,
-                             SO_BROADCAST,
-                             &broadcast_enable,
-                             sizeof(broadcast_enable));
-		if (ret < 0) {
-			LOG_WARN("[%s] can not set broadcast enabled. errno: %d. SKIP",
-			         ifap->ifa_name,
-			         errno);
-			goto TERM;
-		}
-	} else if (ifap->ifa_flags & IFF_POINTOPOINT ||
-	           ifap->ifa_flags & IFF_LOOPBACK) {
-		if_addr = (struct sockaddr_in*)ifap->ifa_dstaddr;
-	} else {
-		LOG_INFO("[%s] skipping current interface for unsupported flag",
-		         ifap->ifa_name);
-		goto TERM;
-	}
-
-	dest_addr.sin_family      = AF_INET;
-	dest_addr.sin_port        = htons(BROADCAST_PORT);
-	dest_addr.sin_addr.s_addr = if_addr->sin_addr.s_addr;
-
-	int retry = 0;
-	while (retry < SEND_TRY) {
-		int ret = sendto(socketfd,
-		                 msg,
-		                 len,
-		                 MSG_CONFIRM,
-		                 (const struct sockaddr*)&dest_addr,
-		                 sizeof(dest_addr));
-		if (ret < 0) {
-			++retry;
-			LOG_WARN("[%s] message send failed. times %d, errno %d",
-			         ifap->ifa_name,
-			         retry,
-			         errno);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		pthread_mutex_lock(&routing_lock);
+		timer_wheel_advance(&speaker->timers, current_tick());
+		pthread_mutex_unlock(&routing_lock);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 
-		} else {
-			break;
-		}
-	}
-	if (retry >= SEND_TRY) {
-		LOG_WARN("[%s] message send failed. all retry failed. SKIP",
-		         ifap->ifa_name);
-	} else {
-		LOG_INFO("[%s] message sent", ifap->ifa_name);
+		pthread_testcancel();
 	}
-
-TERM:
-	ifap = ifap->ifa_next;
-	return 0;
 }
 
-int
-recv_message(in_addr_t           in_addr,
-             char*               buffer,
-             int                 len,
-             struct sockaddr_in* sender_return)
+unsigned int
+get_if_flags(int index)
 {
-	CLEANUP(close_socket) int socketfd;
+	char         name[IF_NAMESIZE];
+	struct ifreq ifr;
+	memset(&ifr, 0, sizeof(ifr));
 
-	struct sockaddr_in recv_addr;
-	struct sockaddr_in sender_addr;
-	memset(&recv_addr, 0, sizeof(recv_addr));
-	memset(&sender_addr, 0, sizeof(sender_addr));
-
-	if ((socketfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-		LOG_ERROR("failed to create socket. errno: %d", errno);
-		return -1;
+	if (!if_indextoname(index, name)) {
+		return 0;
+	}
+	CLEANUP(close_socket) int socketfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (socketfd < 0) {
+		return 0;
 	}
+	strncpy(ifr.ifr_name, name, IF_NAMESIZE - 1);
+	if (ioctl(socketfd, SIOCGIFFLAGS, &ifr) < 0) {
+		LOG_WARN("[%s] failed to get interface flags. errno: %d", name, errno);
+		return 0;
+	}
+	return ifr.ifr_flags;
+}
 
-	recv_addr.sin_family      = AF_INET;
-	recv_addr.sin_port        = htons(BROADCAST_PORT);
-	recv_addr.sin_addr.s_addr = in_addr;
+// new interfaces go through the same filter get_valid_ifs() applies at
+// startup.
+void
+apply_iface_event(struct iface_event* event)
+{
+	struct iface* iface = find_iface(&speaker->ifaces, event->index);
+
+	if (event->type == IFACE_ADDR_ADD) {
+		in_addr_t netmask =
+		    event->prefixlen ? htonl(~0u << (32 - event->prefixlen)) : 0;
+		if (iface) {
+			iface_set_addr(iface, event->addr, netmask, event->broadaddr);
+			iface_up(iface);
+			return;
+		}
 
-	if (bind(socketfd, (const struct sockaddr*)&recv_addr, sizeof(recv_addr)) <
-	    0) {
-		LOG_ERROR("failed to bind the socket. errno: %d", errno);
-		return -1;
+		unsigned int flags = get_if_flags(event->index);
+		if (flags & IFF_LOOPBACK ||
+		    !(flags & (IFF_BROADCAST | IFF_POINTOPOINT))) {
+			LOG_INFO("[%s] skipping new interface", event->name);
+			return;
+		}
+		iface = make_iface(event->name,
+		                   event->index,
+		                   flags,
+		                   event->addr,
+		                   netmask,
+		                   event->broadaddr);
+		if (!iface) {
+			return;
+		}
+		if (!if_indextoname(event->index, iface->name)) {
+			strncpy(iface->name, event->name, IF_NAMESIZE - 1);
+		}
+		LOG_INFO("[%s] new interface.", iface->name);
+		iface->up = 0;
+		LIST_INSERT_HEAD(&speaker->ifaces, iface, entries);
+		iface_up(iface);
+	} else if (!iface) {
+		return;
+	} else if (event->type == IFACE_ADDR_DEL) {
+		if (event->addr == iface->addr.sin_addr.s_addr) {
+			iface_down(iface);
+		}
+	} else if (event->type == IFACE_LINK_DOWN) {
+		iface_down(iface);
+	} else if (event->type == IFACE_LINK_UP) {
+		iface->ifa.ifa_flags = event->flags;
+		iface_up(iface);
 	}
+}
 
-	unsigned int addrlen = sizeof(sender_addr);
+// the threads touching the speaker hold off cancellation while they hold the
+// routing lock. logging and sending are cancellation points, a thread
+// cancelled there would leave the lock taken and the tables half updated.
+void
+handle_iface_event(struct iface_event* event, void* arg)
+{
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_mutex_lock(&routing_lock);
+	apply_iface_event(event);
+	pthread_mutex_unlock(&routing_lock);
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+}
 
-	int n = recvfrom(socketfd,
-	                 buffer,
-	                 len,
-	                 MSG_WAITFORONE,
-	                 (struct sockaddr*)&sender_addr,
-	                 &addrlen);
-	if (n < 0) {
-		LOG_ERROR("message receive failed. errno: %d", errno);
-		return -1;
-	}
-	char addr_str[NI_MAXHOST];
-	if (get_addr_str((struct sockaddr*)&sender_addr, addr_str)) {
-		strcpy(addr_str, "no addr");
-	}
-	LOG_INFO("message received. sender address: %s", addr_str);
-	if (sender_return) {
-		*sender_return = sender_addr;
-	}
+INITIALIZE_VECTOR(iface_event_vector, struct iface_event)
+
+void
+free_iface_event_vector(iface_event_vector* v)
+{
+	clean_iface_event_vector(v);
+}
 
-	return n;
+void
+collect_iface_event(struct iface_event* event, void* arg)
+{
+	iface_event_vector_push((iface_event_vector*)arg, *event);
 }
 
+// an interface is usable when the dump has its link up and an IPv4 address
+// on it.
 int
-recv_message_from_if(struct ifaddrs* if_addr, char* buffer, int len)
+iface_usable(iface_event_vector* events, int index)
 {
-	return recv_message(
-	    ((struct sockaddr_in*)if_addr->ifa_addr)->sin_addr.s_addr,
-	    buffer,
-	    len,
-	    NULL);
+	int link_up  = 0;
+	int has_addr = 0;
+	for (size_t i = 0; i < events->length; i++) {
+		if (events->data[i].index != index) {
+			continue;
+		}
+		link_up |= events->data[i].type == IFACE_LINK_UP;
+		has_addr |= events->data[i].type == IFACE_ADDR_ADD;
+	}
+	return link_up && has_addr;
 }
 
-int
-broadcast_update(struct ifaddrs* all_ifs, struct update_message* m_ptr)
+// interface events were lost. the links and addresses the kernel has now are
+// dumped and the interfaces brought in line with them, whatever happened in
+// between: the ones no longer usable go down, the others are updated or
+// added as if their events had just arrived.
+void
+resync_ifaces()
 {
-	struct ifaddrs* current      = all_ifs;
-	int             with_failure = 0;
+	CLEANUP(free_iface_event_vector)
+	iface_event_vector events = make_iface_event_vector();
+	if (iface_dump(collect_iface_event, &events) < 0) {
+		LOG_WARN("failed to resync interfaces. changes may be missed.");
+		return;
+	}
 
-	LOG_INFO("start broadcast.");
-	while (current) {
-		int n = broadcast_message_from_if(current, (char*)m_ptr, m_ptr->size);
-		if (n < 0) {
-			LOG_WARN("broadcast update message failed at %s",
-			         current->ifa_name);
-			with_failure = 1;
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_mutex_lock(&routing_lock);
+	struct iface* iface;
+	LIST_FOREACH (iface, &speaker->ifaces, entries) {
+		if (!iface_usable(&events, iface->index)) {
+			iface_down(iface);
 		}
-		current = current->ifa_next;
 	}
-	if (with_failure) {
-		LOG_WARN("sending update failed on some interfaces.");
-	} else {
-		LOG_INFO("sending update success.");
+	for (size_t i = 0; i < events.length; i++) {
+		if (iface_usable(&events, events.data[i].index)) {
+			apply_iface_event(&events.data[i]);
+		}
 	}
-	return 0;
+	pthread_mutex_unlock(&routing_lock);
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	LOG_INFO("interfaces resynced. links and addresses: %zu", events.length);
 }
 
-int
-self_update(struct ifaddrs* all_ifs)
+void*
+iface_main_loop(void* arg)
 {
-	int with_failure = 0;
-
-	struct ifaddrs*                     current = all_ifs;
-	CLEANUP_FREE struct update_message* m_ptr   = make_message();
+	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
 
-	m_ptr->type                = MADD;
-	m_ptr->weight              = 1;
-	struct update_message* new = add_aspath(m_ptr, host_id);
-	free(m_ptr);
-	m_ptr = new;
+	CLEANUP(close_socket) int watch_fd = iface_watch_open();
+	if (watch_fd < 0) {
+		LOG_ERROR("interface changes will not be noticed.");
+		return NULL;
+	}
 
-	while (current) {
-		m_ptr->addr = ((struct sockaddr_in*)current->ifa_addr)->sin_addr.s_addr;
-		m_ptr->gateway = 0;  // TODO(134ARG)
-		int n = broadcast_message_from_if(current, (char*)m_ptr, m_ptr->size);
-		if (n < 0) {
-			LOG_WARN("broadcast update message failed at %s",
-			         current->ifa_name);
-			with_failure = 1;
+	while (1) {
+		int ret = iface_watch_read(watch_fd, handle_iface_event, NULL);
+		if (ret < 0) {
+			LOG_WARN("failed to read interface changes. skip.");
+		} else if (ret > 0) {
+			resync_ifaces();
 		}
-		current = current->ifa_next;
+		pthread_testcancel();
 	}
+}
 
-	if (with_failure) {
-		LOG_WARN("sending update failed on some interfaces.");
-	} else {
-		LOG_INFO("sending update success.");
+void*
+metrics_main_loop(void* arg)
+{
+	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+
+	CLEANUP(close_socket) int listen_fd = metrics_listen(metrics_path);
+	if (listen_fd < 0) {
+		LOG_ERROR("metrics endpoint disabled.");
+		return NULL;
+	}
+
+	while (1) {
+		metrics_serve(listen_fd);
+		pthread_testcancel();
 	}
-	return 0;
 }
 
-struct routing_entry
-make_routing_from_update(struct update_message* m_ptr, struct ifaddrs* if_addr)
+void
+close_control(void* arg)
 {
-	return (struct routing_entry){
-	    .weight  = m_ptr->weight,
-	    .base    = m_ptr->addr,
-	    .mask    = (in_addr_t)-1,
-	    .gateway = m_ptr->gateway,
-	    .if_addr = if_addr,
-	};
+	control_close(arg);
 }
 
-int
-check_if_valid_ASPATH(struct update_message* m_ptr)
+// joined at shutdown, the snapshots of the clients point to the interfaces.
+void*
+control_main_loop(void* arg)
 {
-	for (size_t i = 0; i < m_ptr->path_len; i++) {
-		if (m_ptr->ASPATH[i] == host_id) {
-			LOG_INFO("host id found in ASPATH. self: %lu, found: %lu",
-			         host_id,
-			         m_ptr->ASPATH[i]);
-			return 0;
-		}
-	}
-	return 1;
-}
+	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
 
-int
-decision(struct ifaddrs* all_ifs,
-         struct ifaddrs* recv_if,
-         char*           buffer,
-         int             len)
-{
-	struct update_message* m_ptr = (struct update_message*)buffer;
-	if (m_ptr->size > len) {
-		LOG_ERROR("incompelete message. parsing abort.");
-		return -1;
+	struct control_server* server = control_open(control_path, &routing_lock);
+	if (!server) {
+		LOG_ERROR("control socket disabled.");
+		return NULL;
 	}
 
-	if (!check_if_valid_ASPATH(m_ptr)) {
-		LOG_INFO(
-		    "[%s] circle detected. invalid ASPATH. skip current update message.",
-		    recv_if->ifa_name);
-		return 0;
+	pthread_cleanup_push(close_control, server);
+	while (1) {
+		control_serve(server, -1);
+		pthread_testcancel();
 	}
+	pthread_cleanup_pop(1);
+}
 
-	struct routing_entry new_route = make_routing_from_update(m_ptr, recv_if);
+void
+unlock_routing(void* arg)
+{
+	pthread_mutex_unlock(&routing_lock);
+}
 
-	if (m_ptr->type == MWITHDRAW) {
-		LOG_INFO("WITHDRAW update.");
-		if (withdraw_route(&new_route) == SWITHDREW) {
-			LOG_INFO("WITHDRAW finished. start broadcast to peers");
-			broadcast_update(all_ifs, m_ptr);
-		} else {
-			LOG_INFO("No new update.");
-		}
-
-	} else if (m_ptr->type == MADD) {
-		LOG_INFO("ADD update received.");
-		if (add_new_route(&new_route) == SNEW) {
-			LOG_INFO("ADD finished. start broadcast to peers");
-			m_ptr = add_aspath(m_ptr, host_id);
-			++(m_ptr->weight);
-			broadcast_update(all_ifs, m_ptr);
-			LOG_INFO("start new self broadcasting");
-			self_update(all_ifs);
-			free(m_ptr);
-		} else {
-			LOG_INFO("No new update.");
+// waits for queued route changes and lets a burst settle before sending
+// them. a running sync is not cancelled, so the routes the fib stage counts
+// as installed match the kernel when the thread stops.
+void*
+fib_main_loop(void* arg)
+{
+	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+	while (1) {
+		pthread_mutex_lock(&routing_lock);
+		pthread_cleanup_push(unlock_routing, NULL);
+		while (!fib_pending(speaker->fib)) {
+			pthread_cond_wait(&speaker->fib->ready, &routing_lock);
 		}
-	}
+		pthread_cleanup_pop(1);
 
-	return 0;
+		usleep(FIB_COALESCE_MS * 1000);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		fib_sync(speaker->fib, &routing_lock);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		pthread_testcancel();
+	}
 }
 
 struct thread_arg {
@@ -650,93 +433,413 @@ struct thread_arg {
 	struct ifaddrs* all_ifs;
 };
 
-struct ifaddrs*
-find_recv_if(struct ifaddrs* all_ifs, struct sockaddr_in* addr)
+// the side with the lower address opens the stream so that a link never ends
+// up with two connections.
+void
+stream_discover(struct ifaddrs* recv_if, struct sockaddr_in* sender_addr)
 {
-	char addr_str[NI_MAXHOST];
-	if (get_addr_str((struct sockaddr*)addr, addr_str)) {
-		LOG_DEBUG("finding for address: %s", addr_str);
+	in_addr_t self_addr =
+	    ((struct sockaddr_in*)recv_if->ifa_addr)->sin_addr.s_addr;
+	in_addr_t peer_addr = sender_addr->sin_addr.s_addr;
+	if (peer_addr == self_addr || ntohl(self_addr) > ntohl(peer_addr)) {
+		return;
 	}
-	LOG_DEBUG("finding interface");
-
-	struct ifaddrs* current = all_ifs;
 
-	in_addr_t addr_in = addr->sin_addr.s_addr;
+	pthread_mutex_lock(&stream_peers_lock);
+	if (!find_stream_peer(recv_if, peer_addr)) {
+		struct stream_peer* peer = stream_peer_connect(peer_addr, STREAM_PORT);
+		if (peer) {
+			LOG_INFO("[%s] stream connection to neighbor started",
+			         recv_if->ifa_name);
+			peer->owner = recv_if;
+			LIST_INSERT_HEAD(&stream_peers, peer, entries);
+		}
+	}
+	pthread_mutex_unlock(&stream_peers_lock);
 
-	while (current) {
-		in_addr_t mask =
-		    ((struct sockaddr_in*)current->ifa_netmask)->sin_addr.s_addr;
-		in_addr_t addr_if =
-		    ((struct sockaddr_in*)current->ifa_addr)->sin_addr.s_addr;
+	stream_wakeup();
+}
 
-		if ((addr_in & mask) == (addr_if & mask)) {
-			LOG_DEBUG("interface found: %s", current->ifa_name);
-			return current;
+// datagrams and stream frames arrive on different threads. both reach
+// decision() only through here, so updates are decided one at a time under
+// the routing lock whichever transport carried them.
+void
+process_update(struct ifaddrs*          recv_if,
+               enum journal_record_type type,
+               struct sockaddr_in*      sender,
+               char*                    data,
+               u_int32_t                len)
+{
+	int cancel_state;
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+	pthread_mutex_lock(&routing_lock);
+	if (type == JOURNAL_DATAGRAM && stream_enabled &&
+	    stream_established(recv_if, sender->sin_addr.s_addr)) {
+		// the same update also arrives on the stream, which keeps the order.
+		LOG_INFO("[%s] datagram from a stream neighbor. skip.",
+		         recv_if->ifa_name);
+	} else if (iface_of(recv_if)->up) {
+		if (journal) {
+			journal_record(journal,
+			               type,
+			               iface_of(recv_if),
+			               sender->sin_addr.s_addr,
+			               data,
+			               len);
+		}
+		decision(speaker->filtered_ifap,
+		         recv_if,
+		         sender->sin_addr.s_addr,
+		         data,
+		         len);
+		log_routing_table();
+		if (type == JOURNAL_DATAGRAM && stream_enabled) {
+			stream_discover(recv_if, sender);
 		}
-		current = current->ifa_next;
 	}
-	LOG_DEBUG("interface not found. skip.");
-	return NULL;
+	pthread_mutex_unlock(&routing_lock);
+	pthread_setcancelstate(cancel_state, NULL);
 }
 
 void*
 receive_main_loop(void* arg)
 {
 	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
-	struct ifaddrs* all_ifs = (struct ifaddrs*)arg;
 	while (1) {
-		char               buffer[MAX_MESSAGE_SIZE];
-		struct sockaddr_in sender_addr;
-
-		int n =
-		    recv_message(INADDR_ANY, buffer, MAX_MESSAGE_SIZE, &sender_addr);
-		if (n < 0) {
+		// the datagram is parsed in place inside the backend buffer.
+		struct io_datagram dgram;
+
+		int n = speaker->io_backend->recv(speaker->io_backend, &dgram);
+		if (n == IO_RECV_FATAL) {
+			LOG_ERROR("io backend can not receive anymore. receiver stopped.");
+			return NULL;
+		} else if (n < 0) {
 			LOG_WARN("failed to receive message. skip.");
 		} else {
-			LOG_INFO("message received.");
-			struct ifaddrs* recv_if = find_recv_if(all_ifs, &sender_addr);
+			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+			char addr_str[NI_MAXHOST];
+			if (get_addr_str((struct sockaddr*)&dgram.sender, addr_str)) {
+				strcpy(addr_str, "no addr");
+			}
+			LOG_INFO("message received. sender address: %s", addr_str);
+			metrics_inc(METRIC_DATAGRAMS_RECEIVED);
+			pthread_mutex_lock(&routing_lock);
+			struct ifaddrs* recv_if =
+			    find_recv_if(speaker->filtered_ifap, &dgram.sender);
+			pthread_mutex_unlock(&routing_lock);
 			if (!recv_if) {
 				LOG_WARN("message from unkonwn source. dispose.");
+				metrics_inc(METRIC_DATAGRAMS_UNKNOWN);
 			} else {
 				LOG_INFO("receiver found. start decision process.");
-				decision(all_ifs, recv_if, buffer, MAX_MESSAGE_SIZE);
-				log_routing_table();
+				process_update(recv_if,
+				               JOURNAL_DATAGRAM,
+				               &dgram.sender,
+				               dgram.data,
+				               n);
 			}
+			speaker->io_backend->release(speaker->io_backend, &dgram);
+			pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 		}
 		pthread_testcancel();
 	}
 }
 
 int
-dispatch(struct ifaddrs* all_ifs, pthread_t* tid)
+handle_stream_frame(struct stream_peer* peer,
+                    char*               frame,
+                    u_int32_t           len,
+                    void*               arg)
+{
+	struct ifaddrs* recv_if = peer->owner;
+	LOG_INFO("[%s] stream frame received. start decision process.",
+	         recv_if->ifa_name);
+	metrics_inc(METRIC_FRAMES_RECEIVED);
+	struct sockaddr_in sender = {.sin_family      = AF_INET,
+	                             .sin_addr.s_addr = peer->addr};
+	process_update(recv_if, JOURNAL_FRAME, &sender, frame, len);
+	return 0;
+}
+
+void
+stream_accept_peers(int listen_fd)
+{
+	struct stream_peer* peer;
+	while ((peer = stream_peer_accept(listen_fd))) {
+		struct sockaddr_in addr = {.sin_family      = AF_INET,
+		                           .sin_addr.s_addr = peer->addr};
+		pthread_mutex_lock(&routing_lock);
+		struct ifaddrs* recv_if = find_recv_if(speaker->filtered_ifap, &addr);
+		pthread_mutex_unlock(&routing_lock);
+		if (!recv_if) {
+			LOG_WARN("stream connection from unknown source. dispose.");
+			stream_peer_free(peer);
+			continue;
+		}
+
+		pthread_mutex_lock(&stream_peers_lock);
+		struct stream_peer* existed = find_stream_peer(recv_if, peer->addr);
+		if (existed && existed->state == SESTABLISHED) {
+			LOG_INFO("[%s] duplicated stream connection. dispose.",
+			         recv_if->ifa_name);
+			stream_peer_free(peer);
+		} else {
+			if (existed) {
+				existed->state = SCLOSED;
+			}
+			LOG_INFO("[%s] stream connection accepted", recv_if->ifa_name);
+			peer->owner = recv_if;
+			LIST_INSERT_HEAD(&stream_peers, peer, entries);
+		}
+		pthread_mutex_unlock(&stream_peers_lock);
+	}
+}
+
+INITIALIZE_VECTOR(pollfd_vector, struct pollfd)
+INITIALIZE_VECTOR(stream_peer_vector, struct stream_peer*)
+
+void
+free_pollfd_vector(pollfd_vector* v)
+{
+	clean_pollfd_vector(v);
+}
+
+void
+free_stream_peer_vector(stream_peer_vector* v)
+{
+	clean_stream_peer_vector(v);
+}
+
+void
+remove_closed_stream_peers()
 {
-	struct ifaddrs* current = all_ifs;
+	struct stream_peer* current;
+	struct stream_peer* temp;
+
+	pthread_mutex_lock(&stream_peers_lock);
+	LIST_FOREACH_SAFE (current, &stream_peers, entries, temp) {
+		if (current->state == SCLOSED) {
+			LOG_INFO("[%s] stream connection closed",
+			         ((struct ifaddrs*)current->owner)->ifa_name);
+			LIST_REMOVE(current, entries);
+			stream_peer_free(current);
+		}
+	}
+	pthread_mutex_unlock(&stream_peers_lock);
+}
 
-	int ret = pthread_create(tid, NULL, receive_main_loop, (void*)all_ifs);
+void
+free_stream_peers()
+{
+	struct stream_peer* current;
+	struct stream_peer* temp;
+	LIST_FOREACH_SAFE (current, &stream_peers, entries, temp) {
+		stream_peer_free(current);
+	}
+	LIST_INIT(&stream_peers);
+}
+
+// peers are only freed by this loop, so the snapshot taken at the beginning of
+// every iteration stays valid while frames are being dispatched.
+void*
+stream_main_loop(void* arg)
+{
+	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+
+	CLEANUP(close_socket) int listen_fd = stream_listen(INADDR_ANY, STREAM_PORT);
+	if (listen_fd < 0) {
+		LOG_ERROR("stream transport disabled.");
+		stream_enabled = 0;
+		return NULL;
+	}
+
+	CLEANUP(free_pollfd_vector) pollfd_vector fds = make_pollfd_vector();
+	CLEANUP(free_stream_peer_vector)
+	stream_peer_vector peers = make_stream_peer_vector();
+
+	while (1) {
+		resize_pollfd_vector(&fds, 0);
+		resize_stream_peer_vector(&peers, 0);
+		pollfd_vector_push(&fds,
+		                   (struct pollfd){.fd = listen_fd, .events = POLLIN});
+		pollfd_vector_push(
+		    &fds, (struct pollfd){.fd = stream_wakeup_fd, .events = POLLIN});
+
+		struct stream_peer* current;
+		pthread_mutex_lock(&stream_peers_lock);
+		LIST_FOREACH (current, &stream_peers, entries) {
+			short events = POLLIN;
+			if (stream_peer_wants_write(current)) {
+				events |= POLLOUT;
+			}
+			pollfd_vector_push(
+			    &fds, (struct pollfd){.fd = current->fd, .events = events});
+			stream_peer_vector_push(&peers, current);
+		}
+		pthread_mutex_unlock(&stream_peers_lock);
+
+		if (poll(fds.data, fds.length, -1) < 0) {
+			if (errno != EINTR) {
+				LOG_WARN("stream poll failed. errno: %d", errno);
+			}
+			continue;
+		}
+
+		if (fds.data[1].revents & POLLIN) {
+			u_int64_t count;
+			if (read(stream_wakeup_fd, &count, sizeof(count)) < 0) {
+				LOG_WARN("failed to drain stream wakeup. errno: %d", errno);
+			}
+		}
+		if (fds.data[0].revents & POLLIN) {
+			stream_accept_peers(listen_fd);
+		}
+
+		for (size_t i = 0; i < peers.length; i++) {
+			struct stream_peer* peer    = peers.data[i];
+			short               revents = fds.data[i + 2].revents;
+
+			if (peer->state == SCONNECTING &&
+			    (revents & (POLLOUT | POLLERR | POLLHUP))) {
+				if (!stream_peer_finish_connect(peer)) {
+					LOG_INFO("[%s] stream connection established",
+					         ((struct ifaddrs*)peer->owner)->ifa_name);
+				}
+			}
+			if (peer->state == SESTABLISHED &&
+			    (revents & (POLLIN | POLLHUP | POLLERR))) {
+				if (stream_peer_read(peer, handle_stream_frame, NULL) < 0) {
+					peer->state = SCLOSED;
+				}
+			}
+			// every queued frame since the last iteration goes out in as few
+			// writev() calls as possible.
+			if (peer->state == SESTABLISHED && stream_peer_flush(peer) < 0) {
+				peer->state = SCLOSED;
+			}
+		}
+
+		remove_closed_stream_peers();
+		pthread_testcancel();
+	}
+}
+
+int
+dispatch(pthread_t* tid,
+         pthread_t* stream_tid,
+         pthread_t* timer_tid,
+         pthread_t* iface_tid,
+         pthread_t* metrics_tid,
+         pthread_t* control_tid,
+         pthread_t* fib_tid)
+{
+	// every thread is joined at shutdown before the state it uses is freed.
+	int ret = pthread_create(tid, NULL, receive_main_loop, NULL);
 	if (ret) {
 		LOG_ERROR("failed to create thread. abort.");
 		return ret;
 	}
-	pthread_detach((*tid));
 
 	LOG_INFO("thread for all interfaces created and dispatched.");
 
+	ret = pthread_create(timer_tid, NULL, timer_main_loop, NULL);
+	if (ret) {
+		LOG_ERROR("failed to create timer thread. abort.");
+		return ret;
+	}
+
+	LOG_INFO("thread for timers created and dispatched.");
+
+	ret = pthread_create(iface_tid, NULL, iface_main_loop, NULL);
+	if (ret) {
+		LOG_ERROR("failed to create interface thread. abort.");
+		return ret;
+	}
+
+	LOG_INFO("thread for interface changes created and dispatched.");
+
+	if (metrics_path) {
+		ret = pthread_create(metrics_tid, NULL, metrics_main_loop, NULL);
+		if (ret) {
+			LOG_ERROR("failed to create metrics thread. abort.");
+			return ret;
+		}
+
+		LOG_INFO("thread for metrics created and dispatched.");
+	}
+
+	if (control_path) {
+		ret = pthread_create(control_tid, NULL, control_main_loop, NULL);
+		if (ret) {
+			LOG_ERROR("failed to create control thread. abort.");
+			return ret;
+		}
+
+		LOG_INFO("thread for the control socket created and dispatched.");
+	}
+
+	// the routes are flushed only after it stopped.
+	if (speaker->fib) {
+		ret = pthread_create(fib_tid, NULL, fib_main_loop, NULL);
+		if (ret) {
+			LOG_ERROR("failed to create fib thread. abort.");
+			return ret;
+		}
+
+		LOG_INFO("thread for fib programming created and dispatched.");
+	}
+
+	if (stream_enabled) {
+		stream_wakeup_fd = eventfd(0, EFD_NONBLOCK);
+		if (stream_wakeup_fd < 0) {
+			LOG_ERROR("failed to create stream wakeup. errno: %d", errno);
+			return -1;
+		}
+		ret = pthread_create(stream_tid, NULL, stream_main_loop, NULL);
+		if (ret) {
+			LOG_ERROR("failed to create stream thread. abort.");
+			return ret;
+		}
+
+		LOG_INFO("thread for stream transport created and dispatched.");
+	}
+
 	return 0;
 }
 
 // TODO(134ARG): refactor
 int
-execute_command(char command, struct ifaddrs* all_ifs)
+execute_command(char command)
 {
 	const char self_broadcast_cmd    = 'b';
 	const char log_routing_table_cmd = 'r';
+	const char log_dampening_cmd     = 'd';
+	const char log_metrics_cmd       = 'm';
+	const char log_memory_cmd        = 'u';
 	const char quit_cmd              = 'q';
 	const char enter                 = '\n';
 
 	if (command == self_broadcast_cmd) {
-		self_update(all_ifs);
+		pthread_mutex_lock(&routing_lock);
+		self_update(speaker->filtered_ifap);
+		pthread_mutex_unlock(&routing_lock);
 	} else if (command == log_routing_table_cmd) {
+		pthread_mutex_lock(&routing_lock);
 		log_routing_table();
+		pthread_mutex_unlock(&routing_lock);
+	} else if (command == log_dampening_cmd) {
+		pthread_mutex_lock(&routing_lock);
+		log_dampening_stats();
+		pthread_mutex_unlock(&routing_lock);
+	} else if (command == log_metrics_cmd) {
+		struct metrics_snapshot snapshot;
+		metrics_collect(&snapshot);
+		metrics_log(&snapshot);
+	} else if (command == log_memory_cmd) {
+		pthread_mutex_lock(&routing_lock);
+		mem_log();
+		log_limits();
+		pthread_mutex_unlock(&routing_lock);
 	} else if (command == quit_cmd) {
 		return -1;
 	} else if (command == enter) {
@@ -747,11 +850,96 @@ execute_command(char command, struct ifaddrs* all_ifs)
 	return 0;
 }
 
+void
+print_usage(const char* name)
+{
+	printf("usage: %s [-s] [-D] [-i syscall|uring] [-a seconds] [-r journal] "
+	       "[-m socket] [-T]\n"
+	       "       [-P policy] [-f netlink|fake] [-e shm name] "
+	       "[-L [iface=]max[:action]]\n"
+	       "       [-G max[:action]] [-M megabytes] [-c socket]\n",
+	       name);
+	printf("\t-s\texchange updates with neighbors over stream connections\n");
+	printf("\t-i\tdatagram io backend, syscall by default\n");
+	printf("\t-a\tage out routes not announced again within seconds\n");
+	printf("\t-D\tdisable route flap dampening\n");
+	printf("\t-r\trecord received updates to a journal for journal-replay\n");
+	printf("\t-m\tserve prometheus metrics on a unix socket\n");
+	printf("\t-T\ttrace originated updates to measure convergence\n");
+	printf("\t-P\tload import and export policies from a file\n");
+	printf("\t-f\tprogram the best routes through a fib backend\n");
+	printf("\t-e\texport the best routes to shared memory, e.g. /bgp-rib\n");
+	printf("\t-L\tpaths a neighbor may announce, all of them without "
+	       "iface=.\n\t\tthe action beyond is warn, reject or drop\n");
+	printf("\t-G\tprefixes in the whole routing table\n");
+	printf("\t-M\tmemory budget, half of the cgroup limit by default. "
+	       "0 disables it\n");
+	printf("\t-c\tanswer route queries on a unix socket, e.g. with\n"
+	       "\t\techo 'lookup 10.0.0.1' | nc -U socket\n");
+}
+
 int
-main(void)
+main(int argc, char** argv)
 {
+	mem_budget = mem_default_budget();
+
+	int opt;
+	while ((opt = getopt(argc, argv, "si:a:Dr:m:TP:f:e:L:G:M:c:h")) != -1) {
+		if (opt == 's') {
+			stream_enabled = 1;
+		} else if (opt == 'i') {
+			io_backend_name = optarg;
+		} else if (opt == 'a') {
+			speaker->route_max_age =
+			    strtoull(optarg, NULL, 10) * 1000 / TIMER_TICK_MS;
+		} else if (opt == 'D') {
+			speaker->damp_enabled = 0;
+		} else if (opt == 'r') {
+			journal_path = optarg;
+		} else if (opt == 'm') {
+			metrics_path = optarg;
+		} else if (opt == 'T') {
+			speaker->trace_enabled = 1;
+		} else if (opt == 'f') {
+			fib_backend_name = optarg;
+		} else if (opt == 'e') {
+			shm_name = optarg;
+		} else if (opt == 'c') {
+			control_path = optarg;
+		} else if (opt == 'L') {
+			if (speaker->neighbor_limit_count == PREFIX_LIMITS_MAX) {
+				LOG_ERROR("too many prefix limits.");
+				return 1;
+			}
+			struct prefix_limit* limit =
+			    &speaker->neighbor_limits[speaker->neighbor_limit_count++];
+			if (parse_prefix_limit(optarg, limit)) {
+				return 1;
+			}
+		} else if (opt == 'G') {
+			if (parse_prefix_limit(optarg, &speaker->global_limit)) {
+				return 1;
+			}
+		} else if (opt == 'M') {
+			mem_budget = strtoull(optarg, NULL, 10) << 20;
+		} else if (opt == 'P') {
+			policy_free(speaker->policy);
+			speaker->policy = policy_load(optarg);
+			if (!speaker->policy) {
+				return 1;
+			}
+		} else {
+			print_usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
 	set_log_level(LDEBUG);
-	LIST_INIT(&routing_table);
+	if (protocol_init(current_tick())) {
+		LOG_ERROR("failed to set up protocol state. exit.");
+		return 0;
+	}
+	LIST_INIT(&stream_peers);
 
 	char test_buffer[20];
 	memset(test_buffer, 0, 20);
@@ -759,24 +947,100 @@ main(void)
 	struct ifaddrs* ifap = NULL;
 
 	srand(time(NULL));
-	host_id = rand();
-	LOG_INFO("report host id: %lu", host_id);
+	speaker->host_id = rand();
+	LOG_INFO("report host id: %lu", speaker->host_id);
 
 	int ret = getifaddrs(&ifap);
 	if (ret) {
 		LOG_ERROR("failed to get ifs. errno: %d", errno);
 		return 0;
 	}
-	filtered_ifap = get_valid_ifs(ifap, 0, 0);
+	struct ifaddrs* current = get_valid_ifs(ifap, 0, 0);
+	while (current) {
+		struct iface* iface = make_iface_from_ifaddrs(current);
+		if (iface) {
+			LIST_INSERT_HEAD(&speaker->ifaces, iface, entries);
+		}
+		current = current->ifa_next;
+	}
+	freeifaddrs(ifap);
+	speaker->filtered_ifap = link_ifaces(&speaker->ifaces);
+
+	print_ifaddrs(speaker->filtered_ifap);
+
+	unsigned int if_length = len_ifs(speaker->filtered_ifap);
+
+	speaker->io_backend = open_io_backend(io_backend_name, BROADCAST_PORT);
+	if (!speaker->io_backend) {
+		LOG_ERROR("failed to open io backend. exit.");
+		free_ifaces(&speaker->ifaces);
+		return 0;
+	}
 
-	print_ifaddrs(filtered_ifap);
+	if (fib_backend_name) {
+		struct fib_backend* backend = open_fib_backend(fib_backend_name);
+		speaker->fib                = backend ? make_fib(backend) : NULL;
+		if (!speaker->fib) {
+			LOG_ERROR("failed to set up fib programming. exit.");
+			close_fib_backend(backend);
+			free_ifaces(&speaker->ifaces);
+			close_io_backend(speaker->io_backend);
+			return 0;
+		}
+	}
 
-	unsigned int if_length = len_ifs(filtered_ifap);
+	if (shm_name) {
+		speaker->shm =
+		    shm_export_create(shm_name, SHM_EXPORT_CAPACITY, speaker->host_id);
+		if (!speaker->shm) {
+			LOG_ERROR("failed to set up route export. exit.");
+			free_ifaces(&speaker->ifaces);
+			close_io_backend(speaker->io_backend);
+			free_fib(speaker->fib);
+			return 0;
+		}
+		LOG_INFO("exporting routes to shared memory %s", shm_name);
+	}
 
-	self_update(filtered_ifap);
+	if (journal_path) {
+		struct journal_header header = {
+		    .host_id       = speaker->host_id,
+		    .route_max_age = speaker->route_max_age,
+		    .tick_ms       = TIMER_TICK_MS,
+		    .damp_enabled  = speaker->damp_enabled,
+		};
+		journal = journal_create(journal_path, &header);
+		if (!journal) {
+			LOG_ERROR("failed to create journal. exit.");
+			free_ifaces(&speaker->ifaces);
+			close_io_backend(speaker->io_backend);
+			free_fib(speaker->fib);
+			shm_export_close(speaker->shm);
+			return 0;
+		}
+		struct iface* iface;
+		LIST_FOREACH (iface, &speaker->ifaces, entries) {
+			journal_iface(journal, iface);
+		}
+		LOG_INFO("recording received updates to %s", journal_path);
+	}
+
+	self_update(speaker->filtered_ifap);
 
 	pthread_t tid;
-	if (dispatch(filtered_ifap, &tid)) {
+	pthread_t stream_tid;
+	pthread_t timer_tid;
+	pthread_t iface_tid;
+	pthread_t metrics_tid;
+	pthread_t control_tid;
+	pthread_t fib_tid;
+	if (dispatch(&tid,
+	             &stream_tid,
+	             &timer_tid,
+	             &iface_tid,
+	             &metrics_tid,
+	             &control_tid,
+	             &fib_tid)) {
 		LOG_ERROR("thread creation failed. exit.");
 		return 0;
 	}
@@ -785,17 +1049,64 @@ main(void)
 	const char* prompt = "> ";
 
 	while (1) {
-		printf("cli host-%lu %s", host_id, prompt);
+		printf("cli host-%lu %s", speaker->host_id, prompt);
 		fgets(cmd, 20, stdin);
-		int ret = execute_command(cmd[0], filtered_ifap);
+		int ret = execute_command(cmd[0]);
 		if (ret) {
 			pthread_cancel(tid);
+			pthread_join(tid, NULL);
+			pthread_cancel(timer_tid);
+			pthread_join(timer_tid, NULL);
+			pthread_cancel(iface_tid);
+			pthread_join(iface_tid, NULL);
+			if (stream_enabled) {
+				pthread_cancel(stream_tid);
+				pthread_join(stream_tid, NULL);
+			}
+			if (metrics_path) {
+				pthread_cancel(metrics_tid);
+				pthread_join(metrics_tid, NULL);
+			}
+			if (control_path) {
+				pthread_cancel(control_tid);
+				pthread_join(control_tid, NULL);
+			}
+			if (speaker->fib) {
+				pthread_cancel(fib_tid);
+				pthread_join(fib_tid, NULL);
+			}
 			break;
 		}
 	}
 
-	freeifaddrs(ifap);
-	free_routing_table();
+	if (speaker->fib) {
+		pthread_mutex_lock(&routing_lock);
+		fib_flush(speaker->fib);
+		pthread_mutex_unlock(&routing_lock);
+		LOG_INFO("fib flushed. changes: %d",
+		         fib_sync(speaker->fib, &routing_lock));
+	}
+
+	pthread_mutex_lock(&routing_lock);
+	if (journal) {
+		LOG_INFO("journal closed. records: %lu, bytes: %lu",
+		         journal->records,
+		         journal->bytes);
+		journal_close(journal);
+		journal = NULL;
+	}
+	protocol_free();
+	shm_export_close(speaker->shm);
+	speaker->shm = NULL;
+	pthread_mutex_unlock(&routing_lock);
+	policy_free(speaker->policy);
+	free_stream_peers();
+	free_ifaces(&speaker->ifaces);
+	close_io_backend(speaker->io_backend);
+	free_fib(speaker->fib);
+	if (metrics_path) {
+		unlink(metrics_path);
+	}
 
 	return 0;
 }
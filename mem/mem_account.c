@@ -0,0 +1,132 @@
+#include "mem_account.h"
+#include "../logger/logger.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+#define MEM_CGROUP_MAX "/sys/fs/cgroup/memory.max"
+
+struct mem_usage mem_usage[MEM_KINDS];
+u_int64_t        mem_budget = 0;
+
+static int mem_pressured = 0;
+
+static const char* kind_names[MEM_KINDS] = {
+    [MEM_ROUTES]     = "routes",
+    [MEM_ATTRIBUTES] = "attributes",
+    [MEM_PREFIXES]   = "prefixes",
+    [MEM_NEXTHOPS]   = "nexthops",
+    [MEM_DAMPENING]  = "dampening",
+    [MEM_FIB]        = "fib",
+    [MEM_BUFFERS]    = "buffers",
+};
+
+u_int64_t
+mem_total()
+{
+	u_int64_t total = 0;
+	for (int kind = 0; kind < MEM_KINDS; kind++) {
+		total += __atomic_load_n(&mem_usage[kind].bytes, __ATOMIC_RELAXED);
+	}
+	return total;
+}
+
+int
+mem_pressure()
+{
+	if (!mem_budget) {
+		return 0;
+	}
+	u_int64_t total = mem_total();
+	if (!mem_pressured && total > mem_budget) {
+		LOG_WARN("memory budget exceeded, no new paths are accepted. "
+		         "accounted: %lu bytes, budget: %lu bytes",
+		         total,
+		         mem_budget);
+		mem_pressured = 1;
+	} else if (mem_pressured && total < mem_budget / 8 * 7) {
+		LOG_INFO("memory back below the budget, accepting new paths. "
+		         "accounted: %lu bytes",
+		         total);
+		mem_pressured = 0;
+	}
+	return mem_pressured;
+}
+
+u_int64_t
+mem_default_budget()
+{
+	FILE* file = fopen(MEM_CGROUP_MAX, "r");
+	if (!file) {
+		return 0;
+	}
+	char value[32] = {0};
+	if (!fgets(value, sizeof(value), file)) {
+		value[0] = '\0';
+	}
+	fclose(file);
+	// "max" when the cgroup has no limit.
+	return strtoull(value, NULL, 10) / 2;
+}
+
+u_int64_t
+mem_rss()
+{
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (!file) {
+		return 0;
+	}
+	unsigned long size     = 0;
+	unsigned long resident = 0;
+	if (fscanf(file, "%lu %lu", &size, &resident) != 2) {
+		resident = 0;
+	}
+	fclose(file);
+	return (u_int64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+void
+mem_log()
+{
+	LOG_INFO("start logging memory");
+	for (int kind = 0; kind < MEM_KINDS; kind++) {
+		LOG_INFO("\t%s: %lu bytes in %lu objects",
+		         kind_names[kind],
+		         __atomic_load_n(&mem_usage[kind].bytes, __ATOMIC_RELAXED),
+		         __atomic_load_n(&mem_usage[kind].objects, __ATOMIC_RELAXED));
+	}
+	LOG_INFO("\taccounted: %lu bytes", mem_total());
+	LOG_INFO("\tbudget: %lu bytes%s",
+	         mem_budget,
+	         mem_budget ? (mem_pressured ? ", exceeded" : "") : ", disabled");
+	LOG_INFO("\tresident: %lu bytes", mem_rss());
+	LOG_INFO("logging memory finished");
+}
+
+int
+mem_write_prometheus(FILE* out)
+{
+	fprintf(out, "# HELP bgp_memory_bytes accounted bytes per subsystem\n");
+	fprintf(out, "# TYPE bgp_memory_bytes gauge\n");
+	for (int kind = 0; kind < MEM_KINDS; kind++) {
+		fprintf(out,
+		        "bgp_memory_bytes{kind=\"%s\"} %lu\n",
+		        kind_names[kind],
+		        __atomic_load_n(&mem_usage[kind].bytes, __ATOMIC_RELAXED));
+	}
+	fprintf(out,
+	        "# HELP bgp_memory_objects accounted allocations per subsystem\n");
+	fprintf(out, "# TYPE bgp_memory_objects gauge\n");
+	for (int kind = 0; kind < MEM_KINDS; kind++) {
+		fprintf(out,
+		        "bgp_memory_objects{kind=\"%s\"} %lu\n",
+		        kind_names[kind],
+		        __atomic_load_n(&mem_usage[kind].objects, __ATOMIC_RELAXED));
+	}
+	fprintf(out, "# HELP bgp_memory_budget_bytes memory budget, 0 if none\n");
+	fprintf(out, "# TYPE bgp_memory_budget_bytes gauge\n");
+	fprintf(out, "bgp_memory_budget_bytes %lu\n", mem_budget);
+	fprintf(out, "# HELP bgp_resident_bytes resident set size\n");
+	fprintf(out, "# TYPE bgp_resident_bytes gauge\n");
+	fprintf(out, "bgp_resident_bytes %lu\n", mem_rss());
+	return ferror(out) ? -1 : 0;
+}
@@ -0,0 +1,75 @@
+#ifndef BGP_MEM_ACCOUNT_H
+#define BGP_MEM_ACCOUNT_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+// live bytes and allocations of every part of the daemon that grows with what
+// the neighbors send. the counters are process wide and updated atomically,
+// the simulated speakers of netsim all count into the same ones. update
+// messages only live for one decision and are left out, logging formats into
+// stack buffers and allocates nothing.
+enum mem_kind {
+	MEM_ROUTES = 0,  // paths of the adj-rib-in
+	MEM_ATTRIBUTES,  // ASPATHs stored with the paths
+	MEM_PREFIXES,    // rib prefixes and their hash table
+	MEM_NEXTHOPS,
+	MEM_DAMPENING,
+	MEM_FIB,
+	MEM_BUFFERS,  // stream peer queues and buffers, control connections
+	MEM_KINDS,
+};
+
+struct mem_usage {
+	u_int64_t bytes;
+	u_int64_t objects;
+};
+
+extern struct mem_usage mem_usage[MEM_KINDS];
+
+// accounted bytes above which no new paths are accepted. 0 disables the
+// budget.
+extern u_int64_t mem_budget;
+
+static inline void
+mem_charge(enum mem_kind kind, size_t bytes)
+{
+	__atomic_fetch_add(&mem_usage[kind].bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&mem_usage[kind].objects, 1, __ATOMIC_RELAXED);
+}
+
+static inline void
+mem_uncharge(enum mem_kind kind, size_t bytes)
+{
+	__atomic_fetch_sub(&mem_usage[kind].bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_sub(&mem_usage[kind].objects, 1, __ATOMIC_RELAXED);
+}
+
+// for an allocation that grows or shrinks in place.
+static inline void
+mem_recharge(enum mem_kind kind, size_t old_bytes, size_t new_bytes)
+{
+	__atomic_fetch_add(
+	    &mem_usage[kind].bytes, new_bytes - old_bytes, __ATOMIC_RELAXED);
+}
+
+u_int64_t mem_total();
+
+// returns 1 while the accounted bytes are above the budget. the pressure only
+// ends below 7/8 of it, so the daemon does not flap at the boundary.
+int mem_pressure();
+
+// half of the memory limit of the cgroup the daemon runs in, which leaves
+// room for what is not accounted, like allocator overhead and stacks. 0 when
+// there is no limit.
+u_int64_t mem_default_budget();
+
+// resident set size of the process, for comparison with the accounted bytes.
+u_int64_t mem_rss();
+
+void mem_log();
+
+int mem_write_prometheus(FILE* out);
+
+#endif  // BGP_MEM_ACCOUNT_H
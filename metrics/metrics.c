@@ -0,0 +1,320 @@
+#include "metrics.h"
+#include "../logger/logger.h"
+#include "../mem/mem_account.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+__thread struct metrics_shard* metrics_local = NULL;
+
+static struct metrics_shard metrics_shards[METRICS_MAX_THREADS];
+static size_t               metrics_threads = 0;
+
+struct metric_info {
+	const char* name;
+	const char* help;
+};
+
+static const struct metric_info counter_info[METRIC_COUNTERS] = {
+    [METRIC_DATAGRAMS_RECEIVED] = {"datagrams_received",
+                                   "datagrams received by the io backend"},
+    [METRIC_DATAGRAMS_UNKNOWN]  = {"datagrams_unknown",
+                                   "datagrams from no known interface"},
+    [METRIC_FRAMES_RECEIVED]    = {"frames_received",
+                                   "frames received over stream connections"},
+    [METRIC_DECISIONS]          = {"decisions",
+                                   "updates run through the decision process"},
+    [METRIC_ROUTES_ADDED]       = {"routes_added",
+                                   "routes inserted into the routing table"},
+    [METRIC_ROUTES_REMOVED]     = {"routes_removed",
+                                   "routes withdrawn, aged out or flushed"},
+    [METRIC_MESSAGES_SENT]      = {"messages_sent",
+                                   "messages handed to the io backend or "
+                                   "a stream connection"},
+    [METRIC_SEND_RETRIES]       = {"send_retries",
+                                   "sends tried again after a failure"},
+    [METRIC_SEND_FAILURES]      = {"send_failures",
+                                   "messages dropped after all retries"},
+    [METRIC_IMPORT_REJECTED]    = {"import_rejected",
+                                   "announcements denied by the import policy"},
+    [METRIC_EXPORT_REJECTED]    = {"export_rejected",
+                                   "announcements denied by the export policy"},
+    [METRIC_FIB_OPS]            = {"fib_ops",
+                                   "route changes sent to the fib backend"},
+    [METRIC_FIB_BATCHES]        = {"fib_batches",
+                                   "batches sent to the fib backend"},
+    [METRIC_FIB_ERRORS]         = {"fib_errors",
+                                   "route changes the fib backend rejected"},
+    [METRIC_PATHS_REFUSED]      = {"paths_refused",
+                                   "new paths refused by a prefix limit or "
+                                   "the memory budget"},
+    [METRIC_NEIGHBORS_DROPPED]  = {"neighbors_dropped",
+                                   "neighbors brought down by a prefix limit"},
+};
+
+static const struct metric_info histogram_info[METRIC_HISTOGRAMS] = {
+    [METRIC_DECISION_NS] = {"decision_duration",
+                            "time spent in decision() per update"},
+    [METRIC_SEND_NS]     = {"send_duration",
+                            "time spent in one batched send"},
+    [METRIC_TRACE_PROPAGATION_NS] = {"trace_propagation",
+                                     "time from origin to this node of "
+                                     "traced updates"},
+    [METRIC_TRACE_HOP_NS]         = {"trace_hop",
+                                     "time over the last hop of traced "
+                                     "updates"},
+    [METRIC_TRACE_LOCAL_NS]       = {"trace_local",
+                                     "time from receipt to forwarding of "
+                                     "traced updates"},
+    [METRIC_FIB_BATCH_NS]         = {"fib_batch_duration",
+                                     "time from sending a fib batch to its "
+                                     "last acknowledgement"},
+};
+
+// claims the next free shard for the calling thread.
+struct metrics_shard*
+metrics_register()
+{
+	size_t index = __atomic_fetch_add(&metrics_threads, 1, __ATOMIC_RELAXED);
+	if (index >= METRICS_MAX_THREADS - 1) {
+		index = METRICS_MAX_THREADS - 1;
+		__atomic_store_n(&metrics_shards[index].shared, 1, __ATOMIC_RELAXED);
+	}
+	return &metrics_shards[index];
+}
+
+u_int64_t
+metrics_bucket_upper(size_t bucket)
+{
+	if (bucket < METRICS_SUB_BUCKETS) {
+		return bucket;
+	}
+	int       exp   = bucket / METRICS_SUB_BUCKETS + METRICS_SUB_BITS - 1;
+	u_int64_t width = (u_int64_t)1 << (exp - METRICS_SUB_BITS);
+	u_int64_t lower = (METRICS_SUB_BUCKETS + bucket % METRICS_SUB_BUCKETS) *
+	                  width;
+	return lower + width - 1;
+}
+
+static u_int64_t
+load(const u_int64_t* slot)
+{
+	return __atomic_load_n(slot, __ATOMIC_RELAXED);
+}
+
+// counters are read without stopping the writers, so a snapshot can be torn
+// between fields but every field is a value that was actually counted.
+void
+metrics_collect(struct metrics_snapshot* snapshot)
+{
+	size_t threads = __atomic_load_n(&metrics_threads, __ATOMIC_RELAXED);
+	if (threads > METRICS_MAX_THREADS) {
+		threads = METRICS_MAX_THREADS;
+	}
+
+	memset(snapshot, 0, sizeof(*snapshot));
+	snapshot->threads = threads;
+	for (size_t i = 0; i < threads; i++) {
+		struct metrics_shard* shard = &metrics_shards[i];
+
+		for (int c = 0; c < METRIC_COUNTERS; c++) {
+			snapshot->counters[c] += load(&shard->counters[c]);
+		}
+		for (int h = 0; h < METRIC_HISTOGRAMS; h++) {
+			struct metrics_histogram* from = &shard->histograms[h];
+			struct metrics_histogram* to   = &snapshot->histograms[h];
+
+			for (size_t b = 0; b < METRICS_BUCKETS; b++) {
+				u_int64_t n = load(&from->buckets[b]);
+				to->buckets[b] += n;
+				snapshot->counts[h] += n;
+			}
+			to->sum += load(&from->sum);
+			if (load(&from->max) > to->max) {
+				to->max = load(&from->max);
+			}
+		}
+	}
+}
+
+// returns the upper bound of the bucket holding the p-th value, never more
+// than the largest value recorded.
+u_int64_t
+metrics_percentile(const struct metrics_snapshot* snapshot,
+                   enum metric_histogram          histogram,
+                   double                         p)
+{
+	const struct metrics_histogram* h     = &snapshot->histograms[histogram];
+	u_int64_t                       count = snapshot->counts[histogram];
+	if (!count) {
+		return 0;
+	}
+
+	u_int64_t rank = p * (count - 1) + 1;
+	u_int64_t seen = 0;
+	for (size_t b = 0; b < METRICS_BUCKETS; b++) {
+		seen += h->buckets[b];
+		if (seen >= rank) {
+			u_int64_t upper = metrics_bucket_upper(b);
+			return upper < h->max ? upper : h->max;
+		}
+	}
+	return h->max;
+}
+
+void
+metrics_log(const struct metrics_snapshot* snapshot)
+{
+	LOG_INFO("start logging metrics");
+	LOG_INFO("\tthreads: %zu", snapshot->threads);
+	for (int c = 0; c < METRIC_COUNTERS; c++) {
+		LOG_INFO("\t%s: %lu", counter_info[c].name, snapshot->counters[c]);
+	}
+	for (int h = 0; h < METRIC_HISTOGRAMS; h++) {
+		u_int64_t count = snapshot->counts[h];
+		LOG_INFO("\t%s: count %lu, mean %lu ns, p50 %lu ns, p90 %lu ns, "
+		         "p99 %lu ns, max %lu ns",
+		         histogram_info[h].name,
+		         count,
+		         count ? snapshot->histograms[h].sum / count : 0,
+		         metrics_percentile(snapshot, h, 0.50),
+		         metrics_percentile(snapshot, h, 0.90),
+		         metrics_percentile(snapshot, h, 0.99),
+		         snapshot->histograms[h].max);
+	}
+	LOG_INFO("logging metrics finished");
+}
+
+// histograms are exposed with one bucket per power of two from 1us up to
+// 2^METRICS_MAX_EXP ns. these bounds line up with the internal buckets, so
+// the cumulative counts are exact.
+#define PROMETHEUS_MIN_EXP 10
+
+static void
+write_prometheus_histogram(FILE*                          out,
+                           const struct metrics_snapshot* snapshot,
+                           enum metric_histogram          histogram)
+{
+	const struct metrics_histogram* h    = &snapshot->histograms[histogram];
+	const char*                     name = histogram_info[histogram].name;
+
+	fprintf(out,
+	        "# HELP bgp_%s_seconds %s\n",
+	        name,
+	        histogram_info[histogram].help);
+	fprintf(out, "# TYPE bgp_%s_seconds histogram\n", name);
+
+	u_int64_t seen = 0;
+	size_t    b    = 0;
+	for (int exp = PROMETHEUS_MIN_EXP; exp <= METRICS_MAX_EXP; exp++) {
+		u_int64_t bound = (u_int64_t)1 << exp;
+		while (b < METRICS_BUCKETS - 1 && metrics_bucket_upper(b) < bound) {
+			seen += h->buckets[b++];
+		}
+		fprintf(out,
+		        "bgp_%s_seconds_bucket{le=\"%.9g\"} %lu\n",
+		        name,
+		        bound / 1e9,
+		        seen);
+	}
+	fprintf(out,
+	        "bgp_%s_seconds_bucket{le=\"+Inf\"} %lu\n",
+	        name,
+	        snapshot->counts[histogram]);
+	fprintf(out, "bgp_%s_seconds_sum %.9f\n", name, h->sum / 1e9);
+	fprintf(out,
+	        "bgp_%s_seconds_count %lu\n",
+	        name,
+	        snapshot->counts[histogram]);
+}
+
+int
+metrics_write_prometheus(FILE* out, const struct metrics_snapshot* snapshot)
+{
+	for (int c = 0; c < METRIC_COUNTERS; c++) {
+		const char* name = counter_info[c].name;
+		fprintf(out, "# HELP bgp_%s_total %s\n", name, counter_info[c].help);
+		fprintf(out, "# TYPE bgp_%s_total counter\n", name);
+		fprintf(out, "bgp_%s_total %lu\n", name, snapshot->counters[c]);
+	}
+
+	fprintf(out, "# HELP bgp_routes routes in the routing table\n");
+	fprintf(out, "# TYPE bgp_routes gauge\n");
+	fprintf(out,
+	        "bgp_routes %lu\n",
+	        snapshot->counters[METRIC_ROUTES_ADDED] -
+	            snapshot->counters[METRIC_ROUTES_REMOVED]);
+
+	for (int h = 0; h < METRIC_HISTOGRAMS; h++) {
+		write_prometheus_histogram(out, snapshot, h);
+	}
+	return mem_write_prometheus(out);
+}
+
+int
+metrics_listen(const char* path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		LOG_ERROR("metrics socket path too long: %s", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		LOG_ERROR("failed to create metrics socket. errno: %d", errno);
+		return -1;
+	}
+	// a socket file left over by an earlier run would fail the bind.
+	unlink(path);
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+	    listen(fd, 8) < 0) {
+		LOG_ERROR("failed to listen on %s. errno: %d", path, errno);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// answers one scrape. the request is read and ignored, the reply is an
+// HTTP/1.0 response so that both `curl --unix-socket` and a scraping proxy
+// can talk to it.
+int
+metrics_serve(int listen_fd)
+{
+	int fd = accept(listen_fd, NULL, NULL);
+	if (fd < 0) {
+		LOG_WARN("failed to accept metrics connection. errno: %d", errno);
+		return -1;
+	}
+
+	struct timeval timeout = {.tv_sec = 1};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	char request[1024];
+	read(fd, request, sizeof(request));
+
+	FILE* out = fdopen(fd, "w");
+	if (!out) {
+		LOG_WARN("failed to open metrics connection. errno: %d", errno);
+		close(fd);
+		return -1;
+	}
+
+	struct metrics_snapshot snapshot;
+	metrics_collect(&snapshot);
+	fprintf(out,
+	        "HTTP/1.0 200 OK\r\n"
+	        "Content-Type: text/plain; version=0.0.4\r\n"
+	        "\r\n");
+	int ret = metrics_write_prometheus(out, &snapshot);
+	if (fclose(out) || ret) {
+		LOG_WARN("failed to write metrics. errno: %d", errno);
+		return -1;
+	}
+	return 0;
+}
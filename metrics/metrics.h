@@ -0,0 +1,166 @@
+#ifndef BGP_METRICS_H
+#define BGP_METRICS_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
+// every thread counts into a shard of its own, aligned to a cache line, so
+// the hot paths never share a line with another writer. a shard has a single
+// writer and plain relaxed stores are enough. readers sum all shards on
+// demand. threads beyond METRICS_MAX_THREADS share the last shard, which is
+// then updated atomically.
+#define METRICS_MAX_THREADS 16
+#define METRICS_CACHE_LINE  64
+
+// histograms are log-linear like HDR histograms: every power of two is split
+// in METRICS_SUB_BUCKETS linear buckets, which bounds the relative error of a
+// recorded value to 1 / METRICS_SUB_BUCKETS. values up to 2^METRICS_MAX_EXP
+// are kept apart, larger ones land in the last bucket.
+#define METRICS_SUB_BITS    3
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+#define METRICS_MAX_EXP     39
+#define METRICS_BUCKETS                                                        \
+	((METRICS_MAX_EXP - METRICS_SUB_BITS + 2) * METRICS_SUB_BUCKETS)
+
+enum metric_counter {
+	METRIC_DATAGRAMS_RECEIVED = 0,
+	METRIC_DATAGRAMS_UNKNOWN,
+	METRIC_FRAMES_RECEIVED,
+	METRIC_DECISIONS,
+	METRIC_ROUTES_ADDED,
+	METRIC_ROUTES_REMOVED,
+	METRIC_MESSAGES_SENT,
+	METRIC_SEND_RETRIES,
+	METRIC_SEND_FAILURES,
+	METRIC_IMPORT_REJECTED,
+	METRIC_EXPORT_REJECTED,
+	METRIC_FIB_OPS,
+	METRIC_FIB_BATCHES,
+	METRIC_FIB_ERRORS,
+	METRIC_PATHS_REFUSED,
+	METRIC_NEIGHBORS_DROPPED,
+	METRIC_COUNTERS,
+};
+
+enum metric_histogram {
+	METRIC_DECISION_NS = 0,
+	METRIC_SEND_NS,
+	METRIC_TRACE_PROPAGATION_NS,
+	METRIC_TRACE_HOP_NS,
+	METRIC_TRACE_LOCAL_NS,
+	METRIC_FIB_BATCH_NS,
+	METRIC_HISTOGRAMS,
+};
+
+struct metrics_histogram {
+	u_int64_t buckets[METRICS_BUCKETS];
+	u_int64_t sum;
+	u_int64_t max;
+};
+
+struct metrics_shard {
+	u_int64_t                counters[METRIC_COUNTERS];
+	struct metrics_histogram histograms[METRIC_HISTOGRAMS];
+	int                      shared;
+} __attribute__((aligned(METRICS_CACHE_LINE)));
+
+// the sum over all shards at the time of metrics_collect().
+struct metrics_snapshot {
+	u_int64_t                counters[METRIC_COUNTERS];
+	struct metrics_histogram histograms[METRIC_HISTOGRAMS];
+	u_int64_t                counts[METRIC_HISTOGRAMS];
+	size_t                   threads;
+};
+
+extern __thread struct metrics_shard* metrics_local;
+
+struct metrics_shard* metrics_register();
+
+static inline struct metrics_shard*
+metrics_shard()
+{
+	if (__builtin_expect(!metrics_local, 0)) {
+		metrics_local = metrics_register();
+	}
+	return metrics_local;
+}
+
+static inline void
+metrics_bump(struct metrics_shard* shard, u_int64_t* slot, u_int64_t n)
+{
+	if (__builtin_expect(shard->shared, 0)) {
+		__atomic_fetch_add(slot, n, __ATOMIC_RELAXED);
+	} else {
+		__atomic_store_n(slot,
+		                 __atomic_load_n(slot, __ATOMIC_RELAXED) + n,
+		                 __ATOMIC_RELAXED);
+	}
+}
+
+static inline void
+metrics_add(enum metric_counter counter, u_int64_t n)
+{
+	struct metrics_shard* shard = metrics_shard();
+	metrics_bump(shard, &shard->counters[counter], n);
+}
+
+static inline void
+metrics_inc(enum metric_counter counter)
+{
+	metrics_add(counter, 1);
+}
+
+static inline size_t
+metrics_bucket(u_int64_t value)
+{
+	if (value < METRICS_SUB_BUCKETS) {
+		return value;
+	}
+	int exp = 63 - __builtin_clzll(value);
+	if (exp > METRICS_MAX_EXP) {
+		return METRICS_BUCKETS - 1;
+	}
+	return (exp - METRICS_SUB_BITS + 1) * METRICS_SUB_BUCKETS +
+	       ((value >> (exp - METRICS_SUB_BITS)) & (METRICS_SUB_BUCKETS - 1));
+}
+
+static inline void
+metrics_record(enum metric_histogram histogram, u_int64_t value)
+{
+	struct metrics_shard*     shard = metrics_shard();
+	struct metrics_histogram* h     = &shard->histograms[histogram];
+
+	metrics_bump(shard, &h->buckets[metrics_bucket(value)], 1);
+	metrics_bump(shard, &h->sum, value);
+	if (value > __atomic_load_n(&h->max, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+	}
+}
+
+static inline u_int64_t
+metrics_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+u_int64_t metrics_bucket_upper(size_t bucket);
+
+void metrics_collect(struct metrics_snapshot* snapshot);
+
+u_int64_t metrics_percentile(const struct metrics_snapshot* snapshot,
+                             enum metric_histogram          histogram,
+                             double                         p);
+
+void metrics_log(const struct metrics_snapshot* snapshot);
+
+int metrics_write_prometheus(FILE*                          out,
+                             const struct metrics_snapshot* snapshot);
+
+int metrics_listen(const char* path);
+
+int metrics_serve(int listen_fd);
+
+#endif  // BGP_METRICS_H
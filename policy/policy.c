@@ -0,0 +1,540 @@
+#include "policy.h"
+#include "../logger/logger.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POLICY_MAX_TOKENS 32
+
+struct range_vector {
+	struct prefix_range* data;
+	size_t               count;
+	size_t               capacity;
+};
+
+struct policy_parser {
+	struct policy* policy;
+	const char*    name;
+	size_t         line;
+
+	// the prefix list or section being read, if any.
+	struct range_vector    ranges;
+	char                   list_name[POLICY_NAME_SIZE];
+	struct policy_program* program;
+	size_t                 capacity;
+	int                    default_permit;
+	int                    in_list;
+};
+
+static int
+push_range(struct range_vector* v, u_int32_t first, u_int32_t last)
+{
+	if (v->count == v->capacity) {
+		size_t capacity = v->capacity ? v->capacity * 2 : 64;
+		struct prefix_range* new =
+		    reallocarray(v->data, capacity, sizeof(struct prefix_range));
+		if (!new) {
+			LOG_ERROR("failed to allocate prefix ranges.");
+			return -1;
+		}
+		v->data     = new;
+		v->capacity = capacity;
+	}
+	v->data[v->count++] = (struct prefix_range){.first = first, .last = last};
+	return 0;
+}
+
+static int
+cmp_range(const void* a, const void* b)
+{
+	u_int32_t x = ((const struct prefix_range*)a)->first;
+	u_int32_t y = ((const struct prefix_range*)b)->first;
+	return (x > y) - (x < y);
+}
+
+// merges the parsed prefixes into disjoint ranges, splits them at /16 block
+// boundaries and indexes the blocks.
+static int
+compile_prefix_set(struct prefix_set* set, struct range_vector* parsed)
+{
+	struct range_vector blocks = {0};
+
+	qsort(parsed->data, parsed->count, sizeof(struct prefix_range), cmp_range);
+	for (size_t i = 0; i < parsed->count;) {
+		u_int32_t first = parsed->data[i].first;
+		u_int32_t last  = parsed->data[i].last;
+		for (++i; i < parsed->count; i++) {
+			if (last != (u_int32_t)-1 && parsed->data[i].first > last + 1) {
+				break;
+			}
+			if (parsed->data[i].last > last) {
+				last = parsed->data[i].last;
+			}
+		}
+
+		for (u_int32_t block = first >> 16;; block++) {
+			u_int32_t block_first = block << 16;
+			u_int32_t block_last  = block_first | 0xffff;
+			if (push_range(&blocks,
+			               first > block_first ? first : block_first,
+			               last < block_last ? last : block_last)) {
+				free(blocks.data);
+				return -1;
+			}
+			if (block == last >> 16) {
+				break;
+			}
+		}
+	}
+
+	set->index = calloc(PREFIX_SET_BLOCKS + 1, sizeof(u_int32_t));
+	if (!set->index) {
+		LOG_ERROR("failed to allocate prefix set index.");
+		free(blocks.data);
+		return -1;
+	}
+	size_t next = 0;
+	for (u_int32_t block = 0; block <= PREFIX_SET_BLOCKS; block++) {
+		while (next < blocks.count && blocks.data[next].first >> 16 < block) {
+			++next;
+		}
+		set->index[block] = next;
+	}
+	set->ranges = blocks.data;
+	set->count  = blocks.count;
+	return 0;
+}
+
+int
+prefix_set_contains(const struct prefix_set* set, in_addr_t addr)
+{
+	u_int32_t host = ntohl(addr);
+	u_int32_t lo   = set->index[host >> 16];
+	u_int32_t hi   = set->index[(host >> 16) + 1];
+
+	while (lo < hi) {
+		u_int32_t mid = lo + (hi - lo) / 2;
+		if (host < set->ranges[mid].first) {
+			hi = mid;
+		} else if (host > set->ranges[mid].last) {
+			lo = mid + 1;
+		} else {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int
+parse_error(struct policy_parser* parser, const char* what, const char* token)
+{
+	LOG_ERROR("%s:%zu: %s%s%s",
+	          parser->name,
+	          parser->line,
+	          what,
+	          token ? ": " : "",
+	          token ? token : "");
+	return -1;
+}
+
+static int
+parse_u64(const char* token, u_int64_t* value)
+{
+	char* end;
+	if (!token || !*token) {
+		return -1;
+	}
+	errno  = 0;
+	*value = strtoull(token, &end, 10);
+	return (*end || errno) ? -1 : 0;
+}
+
+// A.B.C.D or A.B.C.D/LEN into a host order network and mask.
+static int
+parse_prefix(const char* token, u_int32_t* network, u_int32_t* mask)
+{
+	char      buffer[INET_ADDRSTRLEN + 4];
+	u_int64_t len = 32;
+
+	if (strlen(token) >= sizeof(buffer)) {
+		return -1;
+	}
+	strcpy(buffer, token);
+	char* slash = strchr(buffer, '/');
+	if (slash) {
+		*slash = '\0';
+		if (parse_u64(slash + 1, &len) || len > 32) {
+			return -1;
+		}
+	}
+
+	struct in_addr addr;
+	if (inet_pton(AF_INET, buffer, &addr) != 1) {
+		return -1;
+	}
+	*mask    = len ? (u_int32_t)-1 << (32 - len) : 0;
+	*network = ntohl(addr.s_addr) & *mask;
+	return 0;
+}
+
+static struct prefix_set*
+find_prefix_set(struct policy* policy, const char* name, u_int64_t* index)
+{
+	for (size_t i = 0; i < policy->set_count; i++) {
+		if (!strcmp(policy->sets[i].name, name)) {
+			*index = i;
+			return &policy->sets[i];
+		}
+	}
+	return NULL;
+}
+
+static int
+intern_ifname(struct policy* policy, const char* name, u_int64_t* index)
+{
+	for (size_t i = 0; i < policy->ifname_count; i++) {
+		if (!strcmp(policy->ifnames[i], name)) {
+			*index = i;
+			return 0;
+		}
+	}
+	char(*new)[IF_NAMESIZE] = reallocarray(
+	    policy->ifnames, policy->ifname_count + 1, sizeof(*policy->ifnames));
+	if (!new) {
+		LOG_ERROR("failed to allocate interface names.");
+		return -1;
+	}
+	policy->ifnames = new;
+	strncpy(new[policy->ifname_count], name, IF_NAMESIZE - 1);
+	new[policy->ifname_count][IF_NAMESIZE - 1] = '\0';
+	*index                                     = policy->ifname_count++;
+	return 0;
+}
+
+static int
+emit(struct policy_parser* parser, enum policy_op op, u_int64_t arg)
+{
+	struct policy_program* program = parser->program;
+	if (program->count == parser->capacity) {
+		size_t capacity = parser->capacity ? parser->capacity * 2 : 16;
+		struct policy_insn* new =
+		    reallocarray(program->insns, capacity, sizeof(struct policy_insn));
+		if (!new) {
+			LOG_ERROR("failed to allocate policy program.");
+			return -1;
+		}
+		program->insns   = new;
+		parser->capacity = capacity;
+	}
+	program->insns[program->count++] =
+	    (struct policy_insn){.op = op, .fail = 0, .arg = arg};
+	return 0;
+}
+
+static int
+parse_rule(struct policy_parser* parser, char** tokens, int count)
+{
+	struct policy_program* program    = parser->program;
+	size_t                 start      = program->count;
+	int                    set_weight = 0;
+	u_int64_t              weight     = 0;
+	int                    permit     = !strcmp(tokens[0], "permit");
+
+	for (int i = 1; i < count; i += 2) {
+		const char* key   = tokens[i];
+		const char* value = i + 1 < count ? tokens[i + 1] : NULL;
+		u_int64_t   arg;
+		int         ret;
+
+		if (!value) {
+			return parse_error(parser, "missing value", key);
+		}
+		if (!strcmp(key, "prefix-list")) {
+			if (!find_prefix_set(parser->policy, value, &arg)) {
+				return parse_error(parser, "unknown prefix-list", value);
+			}
+			ret = emit(parser, POLICY_MATCH_PREFIX_SET, arg);
+		} else if (!strcmp(key, "prefix")) {
+			u_int32_t network;
+			u_int32_t mask;
+			if (parse_prefix(value, &network, &mask)) {
+				return parse_error(parser, "invalid prefix", value);
+			}
+			ret = emit(parser,
+			           POLICY_MATCH_PREFIX,
+			           (u_int64_t)network << 32 | mask);
+		} else if (!strcmp(key, "aspath-contains")) {
+			if (parse_u64(value, &arg)) {
+				return parse_error(parser, "invalid host id", value);
+			}
+			ret = emit(parser, POLICY_MATCH_ASPATH, arg);
+		} else if (!strcmp(key, "weight-max") || !strcmp(key, "weight-min")) {
+			if (parse_u64(value, &arg) || arg > (u_int32_t)-1) {
+				return parse_error(parser, "invalid weight", value);
+			}
+			ret = emit(parser,
+			           key[7] == 'a' ? POLICY_MATCH_WEIGHT_MAX
+			                         : POLICY_MATCH_WEIGHT_MIN,
+			           arg);
+		} else if (!strcmp(key, "iface")) {
+			ret = intern_ifname(parser->policy, value, &arg) ||
+			      emit(parser, POLICY_MATCH_IFACE, arg);
+		} else if (!strcmp(key, "set-weight")) {
+			if (parse_u64(value, &weight) || weight > (u_int32_t)-1) {
+				return parse_error(parser, "invalid weight", value);
+			}
+			set_weight = 1;
+			ret        = 0;
+		} else {
+			return parse_error(parser, "unknown match", key);
+		}
+		if (ret) {
+			return -1;
+		}
+	}
+
+	if ((set_weight && emit(parser, POLICY_SET_WEIGHT, weight)) ||
+	    emit(parser, permit ? POLICY_PERMIT : POLICY_DENY, 0)) {
+		return -1;
+	}
+	for (size_t i = start; i < program->count; i++) {
+		program->insns[i].fail = program->count;
+	}
+	return 0;
+}
+
+static int
+begin_section(struct policy_parser* parser, struct policy_program* program)
+{
+	if (program->insns) {
+		return parse_error(parser, "section defined twice", NULL);
+	}
+	parser->program        = program;
+	parser->capacity       = 0;
+	parser->default_permit = 1;
+	return 0;
+}
+
+static int
+end_block(struct policy_parser* parser)
+{
+	if (parser->in_list) {
+		struct policy* policy = parser->policy;
+		struct prefix_set* new =
+		    reallocarray(policy->sets, policy->set_count + 1, sizeof(*new));
+		if (!new) {
+			LOG_ERROR("failed to allocate prefix sets.");
+			return -1;
+		}
+		policy->sets           = new;
+		struct prefix_set* set = &new[policy->set_count];
+		memset(set, 0, sizeof(*set));
+		strcpy(set->name, parser->list_name);
+		if (compile_prefix_set(set, &parser->ranges)) {
+			return -1;
+		}
+		++policy->set_count;
+		parser->ranges.count = 0;
+		parser->in_list      = 0;
+		return 0;
+	}
+	if (parser->program) {
+		int ret = emit(parser,
+		               parser->default_permit ? POLICY_PERMIT : POLICY_DENY,
+		               0);
+		parser->program = NULL;
+		return ret;
+	}
+	return parse_error(parser, "end outside of a block", NULL);
+}
+
+static int
+parse_line(struct policy_parser* parser, char** tokens, int count)
+{
+	const char* keyword = tokens[0];
+
+	if (!strcmp(keyword, "end")) {
+		return end_block(parser);
+	}
+	if (parser->in_list) {
+		u_int32_t network;
+		u_int32_t mask;
+		if (count != 1 || parse_prefix(keyword, &network, &mask)) {
+			return parse_error(parser, "invalid prefix", keyword);
+		}
+		return push_range(&parser->ranges, network, network | ~mask);
+	}
+	if (parser->program) {
+		if (!strcmp(keyword, "permit") || !strcmp(keyword, "deny")) {
+			return parse_rule(parser, tokens, count);
+		}
+		if (!strcmp(keyword, "default") && count == 2 &&
+		    (!strcmp(tokens[1], "permit") || !strcmp(tokens[1], "deny"))) {
+			parser->default_permit = !strcmp(tokens[1], "permit");
+			return 0;
+		}
+		return parse_error(parser, "unknown rule", keyword);
+	}
+
+	if (!strcmp(keyword, "prefix-list") && count == 2) {
+		u_int64_t index;
+		if (strlen(tokens[1]) >= POLICY_NAME_SIZE) {
+			return parse_error(parser, "name too long", tokens[1]);
+		}
+		if (find_prefix_set(parser->policy, tokens[1], &index)) {
+			return parse_error(parser, "prefix-list defined twice", tokens[1]);
+		}
+		strcpy(parser->list_name, tokens[1]);
+		parser->in_list = 1;
+		return 0;
+	}
+	if (!strcmp(keyword, "import") && count == 1) {
+		return begin_section(parser, &parser->policy->import);
+	}
+	if (!strcmp(keyword, "export") && count == 1) {
+		return begin_section(parser, &parser->policy->export);
+	}
+	return parse_error(parser, "unknown block", keyword);
+}
+
+struct policy*
+policy_parse(FILE* file, const char* name)
+{
+	struct policy_parser parser = {.name = name};
+
+	parser.policy = calloc(1, sizeof(struct policy));
+	if (!parser.policy) {
+		LOG_ERROR("failed to allocate policy.");
+		return NULL;
+	}
+
+	char*   line     = NULL;
+	size_t  capacity = 0;
+	ssize_t n;
+	int     ret = 0;
+	while (!ret && (n = getline(&line, &capacity, file)) >= 0) {
+		++parser.line;
+		char* comment = strchr(line, '#');
+		if (comment) {
+			*comment = '\0';
+		}
+
+		char* tokens[POLICY_MAX_TOKENS];
+		int   count = 0;
+		char* save  = NULL;
+		for (char* token = strtok_r(line, " \t\r\n", &save); token;
+		     token       = strtok_r(NULL, " \t\r\n", &save)) {
+			if (count == POLICY_MAX_TOKENS) {
+				ret = parse_error(&parser, "too many words", NULL);
+				break;
+			}
+			tokens[count++] = token;
+		}
+		if (!ret && count) {
+			ret = parse_line(&parser, tokens, count);
+		}
+	}
+	if (!ret && (parser.in_list || parser.program)) {
+		ret = parse_error(&parser, "missing end", NULL);
+	}
+
+	free(line);
+	free(parser.ranges.data);
+	if (ret) {
+		policy_free(parser.policy);
+		return NULL;
+	}
+	return parser.policy;
+}
+
+struct policy*
+policy_load(const char* path)
+{
+	FILE* file = fopen(path, "r");
+	if (!file) {
+		LOG_ERROR("failed to open policy %s. errno: %d", path, errno);
+		return NULL;
+	}
+	struct policy* policy = policy_parse(file, path);
+	fclose(file);
+	return policy;
+}
+
+void
+policy_free(struct policy* policy)
+{
+	if (!policy) {
+		return;
+	}
+	for (size_t i = 0; i < policy->set_count; i++) {
+		free(policy->sets[i].index);
+		free(policy->sets[i].ranges);
+	}
+	free(policy->sets);
+	free(policy->ifnames);
+	free(policy->import.insns);
+	free(policy->export.insns);
+	free(policy);
+}
+
+static int
+path_contains(const struct policy_input* input, u_int64_t host_id)
+{
+	for (u_int32_t i = 0; i < input->path_len; i++) {
+		if (input->path[i] == host_id) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// an empty program permits everything.
+int
+policy_eval(const struct policy*         policy,
+            const struct policy_program* program,
+            const struct policy_input*   input,
+            u_int32_t*                   weight)
+{
+	u_int32_t current = input->weight;
+	size_t    pc      = 0;
+
+	while (pc < program->count) {
+		const struct policy_insn* insn  = &program->insns[pc];
+		int                       match = 1;
+
+		switch (insn->op) {
+		case POLICY_MATCH_PREFIX_SET:
+			match = prefix_set_contains(&policy->sets[insn->arg], input->addr);
+			break;
+		case POLICY_MATCH_PREFIX:
+			match = (ntohl(input->addr) & (u_int32_t)insn->arg) ==
+			        insn->arg >> 32;
+			break;
+		case POLICY_MATCH_ASPATH:
+			match = path_contains(input, insn->arg);
+			break;
+		case POLICY_MATCH_WEIGHT_MAX:
+			match = current <= insn->arg;
+			break;
+		case POLICY_MATCH_WEIGHT_MIN:
+			match = current >= insn->arg;
+			break;
+		case POLICY_MATCH_IFACE:
+			match = !strncmp(
+			    input->ifname, policy->ifnames[insn->arg], IF_NAMESIZE);
+			break;
+		case POLICY_SET_WEIGHT:
+			current = insn->arg;
+			break;
+		case POLICY_PERMIT:
+			*weight = current;
+			return 1;
+		case POLICY_DENY:
+			return 0;
+		}
+		pc = match ? pc + 1 : insn->fail;
+	}
+	*weight = current;
+	return 1;
+}
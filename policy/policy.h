@@ -0,0 +1,117 @@
+#ifndef BGP_POLICY_H
+#define BGP_POLICY_H
+
+#include <net/if.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+// import and export policies are read from a file like:
+//
+//   # comment
+//   prefix-list customers
+//       10.1.0.0/16
+//       192.0.2.7
+//   end
+//
+//   import
+//       deny aspath-contains 65001
+//       permit prefix-list customers set-weight 2
+//       deny weight-min 16
+//       default permit
+//   end
+//
+//   export
+//       deny iface eth1 prefix 10.9.0.0/16
+//   end
+//
+// a rule is permit or deny followed by match terms, all of which have to hold,
+// and an optional set-weight. match terms are prefix-list NAME, prefix A/LEN,
+// aspath-contains ID, weight-max N, weight-min N and iface NAME. the first
+// matching rule decides, default applies when none matches and permits unless
+// said otherwise.
+//
+// every section is compiled into a flat program. each match is a single
+// instruction that jumps to the next rule when it fails, so evaluating an
+// update is a loop over an array with no allocation.
+
+#define POLICY_NAME_SIZE 64
+
+// a prefix list compiled for /32 lookups: the prefixes are merged into
+// disjoint address ranges, clipped to /16 blocks and sorted. index[b] is the
+// first range inside block b, so a lookup is one table access followed by a
+// binary search over the few ranges of a single block.
+#define PREFIX_SET_BLOCKS (1 << 16)
+
+struct prefix_range {
+	u_int32_t first;  // host order
+	u_int32_t last;
+};
+
+struct prefix_set {
+	char                 name[POLICY_NAME_SIZE];
+	u_int32_t*           index;  // PREFIX_SET_BLOCKS + 1 entries
+	struct prefix_range* ranges;
+	size_t               count;
+};
+
+enum policy_op {
+	POLICY_MATCH_PREFIX_SET = 0,  // arg: set
+	POLICY_MATCH_PREFIX,          // arg: network << 32 | mask, host order
+	POLICY_MATCH_ASPATH,          // arg: host id
+	POLICY_MATCH_WEIGHT_MAX,      // arg: weight
+	POLICY_MATCH_WEIGHT_MIN,      // arg: weight
+	POLICY_MATCH_IFACE,           // arg: interface name
+	POLICY_SET_WEIGHT,            // arg: weight
+	POLICY_PERMIT,
+	POLICY_DENY,
+};
+
+struct policy_insn {
+	enum policy_op op;
+	u_int32_t      fail;  // next instruction when a match fails
+	u_int64_t      arg;
+};
+
+struct policy_program {
+	struct policy_insn* insns;
+	size_t              count;
+};
+
+struct policy {
+	struct prefix_set* sets;
+	size_t             set_count;
+
+	char (*ifnames)[IF_NAMESIZE];
+	size_t ifname_count;
+
+	struct policy_program import;
+	struct policy_program export;
+};
+
+// what a program looks at. ifname is the receiving interface on import and
+// the sending one on export.
+struct policy_input {
+	in_addr_t        addr;
+	u_int32_t        weight;
+	const u_int64_t* path;
+	u_int32_t        path_len;
+	const char*      ifname;
+};
+
+struct policy* policy_load(const char* path);
+
+struct policy* policy_parse(FILE* file, const char* name);
+
+void policy_free(struct policy* policy);
+
+int prefix_set_contains(const struct prefix_set* set, in_addr_t addr);
+
+// returns 1 and the weight the update continues with when the program
+// permits it, 0 when it denies it.
+int policy_eval(const struct policy*         policy,
+                const struct policy_program* program,
+                const struct policy_input*   input,
+                u_int32_t*                   weight);
+
+#endif  // BGP_POLICY_H
@@ -0,0 +1,324 @@
+#include "nexthop.h"
+#include "../iface/iface.h"
+#include "../logger/logger.h"
+#include "../mem/mem_account.h"
+#include "../mem/mem_utils.h"
+#include "../vector/vector.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int
+cmp_nexthop(const void* a, const void* b)
+{
+	const struct nexthop* x = a;
+	const struct nexthop* y = b;
+
+	int xi = iface_of(x->if_addr)->index;
+	int yi = iface_of(y->if_addr)->index;
+	if (xi != yi) {
+		return (xi > yi) - (xi < yi);
+	}
+	return (x->gateway > y->gateway) - (x->gateway < y->gateway);
+}
+
+// fnv-1a over the words of the sorted hops.
+static u_int32_t
+hash_hops(const struct nexthop* hops, u_int32_t count)
+{
+	u_int32_t hash = 2166136261u;
+	for (u_int32_t i = 0; i < count; i++) {
+		hash = (hash ^ hops[i].gateway) * 16777619u;
+		hash = (hash ^ (u_int32_t)iface_of(hops[i].if_addr)->index) *
+		       16777619u;
+	}
+	return hash;
+}
+
+static int
+same_hops(const struct nexthop_group* group,
+          const struct nexthop*       hops,
+          u_int32_t                   count)
+{
+	if (group->count != count) {
+		return 0;
+	}
+	for (u_int32_t i = 0; i < count; i++) {
+		if (group->hops[i].gateway != hops[i].gateway ||
+		    group->hops[i].if_addr != hops[i].if_addr) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static struct nexthop_group_list*
+bucket_of(struct nexthop_table* table, u_int32_t hash)
+{
+	return &table->buckets[hash & (table->bucket_count - 1)];
+}
+
+static size_t
+group_size(u_int32_t count)
+{
+	return sizeof(struct nexthop_group) + count * sizeof(struct nexthop);
+}
+
+static void
+free_group(struct nexthop_group* group)
+{
+	struct nexthop_handle* handle;
+	while ((handle = LIST_FIRST(&group->handles))) {
+		LIST_REMOVE(handle, entries);
+		mem_uncharge(MEM_NEXTHOPS, sizeof(struct nexthop_handle));
+		free(handle);
+	}
+	mem_uncharge(MEM_NEXTHOPS, group_size(group->alloc_count));
+	free(group);
+}
+
+int
+nexthop_table_init(struct nexthop_table* table)
+{
+	table->bucket_count = NEXTHOP_HASH_INIT;
+	table->buckets =
+	    calloc(table->bucket_count, sizeof(struct nexthop_group_list));
+	if (!table->buckets) {
+		LOG_ERROR("failed to allocate next hop groups.");
+		return -1;
+	}
+	mem_charge(MEM_NEXTHOPS,
+	           table->bucket_count * sizeof(struct nexthop_group_list));
+	for (size_t i = 0; i < table->bucket_count; i++) {
+		LIST_INIT(&table->buckets[i]);
+	}
+	table->count   = 0;
+	table->next_id = 1;
+	return 0;
+}
+
+// groups still referenced are freed as well.
+void
+nexthop_table_free(struct nexthop_table* table)
+{
+	struct nexthop_group* current;
+	for (size_t i = 0; i < table->bucket_count; i++) {
+		while ((current = LIST_FIRST(&table->buckets[i]))) {
+			LIST_REMOVE(current, entries);
+			free_group(current);
+		}
+	}
+	if (table->buckets) {
+		mem_uncharge(MEM_NEXTHOPS,
+		             table->bucket_count * sizeof(struct nexthop_group_list));
+	}
+	free(table->buckets);
+	table->buckets      = NULL;
+	table->bucket_count = 0;
+	table->count        = 0;
+}
+
+static void
+grow(struct nexthop_table* table)
+{
+	size_t                     new_count = table->bucket_count * 2;
+	struct nexthop_group_list* new_buckets =
+	    calloc(new_count, sizeof(struct nexthop_group_list));
+	if (!new_buckets) {
+		// lookups only get slower.
+		return;
+	}
+	for (size_t i = 0; i < new_count; i++) {
+		LIST_INIT(&new_buckets[i]);
+	}
+
+	struct nexthop_group* current;
+	for (size_t i = 0; i < table->bucket_count; i++) {
+		while ((current = LIST_FIRST(&table->buckets[i]))) {
+			LIST_REMOVE(current, entries);
+			LIST_INSERT_HEAD(&new_buckets[current->hash & (new_count - 1)],
+			                 current,
+			                 entries);
+		}
+	}
+	mem_recharge(MEM_NEXTHOPS,
+	             table->bucket_count * sizeof(struct nexthop_group_list),
+	             new_count * sizeof(struct nexthop_group_list));
+	free(table->buckets);
+	table->buckets      = new_buckets;
+	table->bucket_count = new_count;
+}
+
+static struct nexthop_group*
+find_group(struct nexthop_table* table,
+           struct nexthop*       hops,
+           u_int32_t             count,
+           u_int32_t             hash)
+{
+	struct nexthop_group* current;
+	LIST_FOREACH (current, bucket_of(table, hash), entries) {
+		if (current->hash == hash && same_hops(current, hops, count)) {
+			return current;
+		}
+	}
+	return NULL;
+}
+
+// returns a handle of the group of the hops with a reference taken. the
+// group is created if no prefix uses the same set yet. hops is sorted in
+// place.
+struct nexthop_handle*
+nexthop_group_get(struct nexthop_table* table,
+                  struct nexthop*       hops,
+                  u_int32_t             count)
+{
+	qsort(hops, count, sizeof(struct nexthop), cmp_nexthop);
+	u_int32_t hash = hash_hops(hops, count);
+
+	struct nexthop_group* current = find_group(table, hops, count, hash);
+	if (current) {
+		struct nexthop_handle* handle = LIST_FIRST(&current->handles);
+		++handle->refs;
+		return handle;
+	}
+
+	current                       = malloc(group_size(count));
+	struct nexthop_handle* handle = malloc(sizeof(struct nexthop_handle));
+	if (!current || !handle) {
+		LOG_ERROR("failed to allocate next hop group.");
+		free(current);
+		free(handle);
+		return NULL;
+	}
+	mem_charge(MEM_NEXTHOPS, group_size(count));
+	mem_charge(MEM_NEXTHOPS, sizeof(struct nexthop_handle));
+	current->id          = table->next_id++;
+	current->hash        = hash;
+	current->count       = count;
+	current->alloc_count = count;
+	memcpy(current->hops, hops, count * sizeof(struct nexthop));
+	LIST_INIT(&current->handles);
+	handle->group = current;
+	handle->refs  = 1;
+	LIST_INSERT_HEAD(&current->handles, handle, entries);
+
+	if (table->count >= table->bucket_count * 2) {
+		grow(table);
+	}
+	LIST_INSERT_HEAD(bucket_of(table, hash), current, entries);
+	++table->count;
+	return handle;
+}
+
+// the group goes with its last handle.
+void
+nexthop_group_put(struct nexthop_table* table, struct nexthop_handle* handle)
+{
+	if (!handle || --handle->refs) {
+		return;
+	}
+	struct nexthop_group* group = handle->group;
+	LIST_REMOVE(handle, entries);
+	mem_uncharge(MEM_NEXTHOPS, sizeof(struct nexthop_handle));
+	free(handle);
+	if (LIST_EMPTY(&group->handles)) {
+		LIST_REMOVE(group, entries);
+		--table->count;
+		free_group(group);
+	}
+}
+
+// whether group holds exactly the hops. hops is sorted in place.
+int
+nexthop_group_same(const struct nexthop_group* group,
+                   struct nexthop*             hops,
+                   u_int32_t                   count)
+{
+	if (!group || group->count != count) {
+		return 0;
+	}
+	qsort(hops, count, sizeof(struct nexthop), cmp_nexthop);
+	return same_hops(group, hops, count);
+}
+
+INITIALIZE_VECTOR(group_vector, struct nexthop_group*)
+
+static void
+free_group_vector(group_vector* v)
+{
+	clean_group_vector(v);
+}
+
+// drops the interface from every group in place, which moves every prefix
+// using such a group to its remaining hops without visiting the prefix. a
+// group that ends up with the set of another one is merged into it: its
+// handles are moved over, so each set still has a single group. returns the
+// number of groups changed.
+size_t
+nexthop_table_remove_if(struct nexthop_table* table, struct ifaddrs* if_addr)
+{
+	CLEANUP(free_group_vector) group_vector changed = make_group_vector();
+	struct nexthop_group*                   current;
+
+	for (size_t i = 0; i < table->bucket_count; i++) {
+		LIST_FOREACH (current, &table->buckets[i], entries) {
+			u_int32_t kept = 0;
+			for (u_int32_t j = 0; j < current->count; j++) {
+				if (current->hops[j].if_addr != if_addr) {
+					current->hops[kept++] = current->hops[j];
+				}
+			}
+			if (kept != current->count) {
+				current->count = kept;
+				group_vector_push(&changed, current);
+			}
+		}
+	}
+
+	// taken out before any is put back, so a changed group is only ever
+	// matched against sets that are final.
+	for (size_t i = 0; i < changed.length; i++) {
+		LIST_REMOVE(changed.data[i], entries);
+		--table->count;
+	}
+
+	for (size_t i = 0; i < changed.length; i++) {
+		current       = changed.data[i];
+		current->hash = hash_hops(current->hops, current->count);
+
+		struct nexthop_group* existed =
+		    find_group(table, current->hops, current->count, current->hash);
+		if (!existed) {
+			LIST_INSERT_HEAD(bucket_of(table, current->hash), current, entries);
+			++table->count;
+			continue;
+		}
+
+		struct nexthop_handle* handle;
+		while ((handle = LIST_FIRST(&current->handles))) {
+			LIST_REMOVE(handle, entries);
+			handle->group = existed;
+			LIST_INSERT_HEAD(&existed->handles, handle, entries);
+		}
+		free_group(current);
+	}
+	return changed.length;
+}
+
+// spreads the 5-tuple of a flow over 32 bits, so consecutive ports and
+// addresses pick different hops.
+u_int32_t
+nexthop_flow_hash(in_addr_t saddr,
+                  in_addr_t daddr,
+                  u_int16_t sport,
+                  u_int16_t dport,
+                  u_int8_t  protocol)
+{
+	u_int64_t hash = ((u_int64_t)saddr << 32 | daddr) * 0x9e3779b97f4a7c15ull;
+	hash ^= ((u_int64_t)sport << 24 | (u_int64_t)dport << 8 | protocol) *
+	        0xc2b2ae3d27d4eb4full;
+	hash ^= hash >> 29;
+	hash *= 0xbf58476d1ce4e5b9ull;
+	hash ^= hash >> 32;
+	return (u_int32_t)hash;
+}
@@ -0,0 +1,95 @@
+#ifndef BGP_NEXTHOP_H
+#define BGP_NEXTHOP_H
+
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <sys/queue.h>
+#include <sys/types.h>
+
+#define NEXTHOP_HASH_INIT 64
+#define NEXTHOP_GROUP_MAX 16  // paths of one prefix used for multipath
+
+struct nexthop {
+	in_addr_t       gateway;
+	struct ifaddrs* if_addr;
+};
+
+struct nexthop_group;
+
+// prefixes reach their group through a handle, so swapping the group behind
+// a handle moves all of its prefixes at once. refs counts the prefixes.
+struct nexthop_handle {
+	struct nexthop_group* group;
+	u_int32_t             refs;
+	LIST_ENTRY(nexthop_handle) entries;  // handles of the group
+};
+
+LIST_HEAD(nexthop_handle_list, nexthop_handle);
+
+// the set of next hops traffic to a prefix is spread over. prefixes with the
+// same set share one group, so a change to the group applies to all of them
+// at once. a group starts with one handle and takes over the handles of the
+// groups merged into it. hops are kept sorted by interface index and
+// gateway.
+struct nexthop_group {
+	u_int32_t                  id;
+	u_int32_t                  hash;
+	u_int32_t                  count;
+	u_int32_t                  alloc_count;  // hops allocated and accounted for
+	struct nexthop_handle_list handles;
+	LIST_ENTRY(nexthop_group) entries;
+	struct nexthop hops[];
+};
+
+LIST_HEAD(nexthop_group_list, nexthop_group);
+
+struct nexthop_table {
+	struct nexthop_group_list* buckets;
+	size_t                     bucket_count;
+	size_t                     count;
+	u_int32_t                  next_id;
+};
+
+int nexthop_table_init(struct nexthop_table* table);
+
+void nexthop_table_free(struct nexthop_table* table);
+
+struct nexthop_handle* nexthop_group_get(struct nexthop_table* table,
+                                         struct nexthop*       hops,
+                                         u_int32_t             count);
+
+void nexthop_group_put(struct nexthop_table*  table,
+                       struct nexthop_handle* handle);
+
+int nexthop_group_same(const struct nexthop_group* group,
+                       struct nexthop*             hops,
+                       u_int32_t                   count);
+
+size_t nexthop_table_remove_if(struct nexthop_table* table,
+                               struct ifaddrs*       if_addr);
+
+u_int32_t nexthop_flow_hash(in_addr_t saddr,
+                            in_addr_t daddr,
+                            u_int16_t sport,
+                            u_int16_t dport,
+                            u_int8_t  protocol);
+
+static inline struct nexthop_group*
+nexthop_handle_group(const struct nexthop_handle* handle)
+{
+	return handle ? handle->group : NULL;
+}
+
+// picks the hop of a flow. the same flow hash always lands on the same hop
+// as long as the group does not change.
+static inline const struct nexthop*
+nexthop_select(const struct nexthop_group* group, u_int32_t flow_hash)
+{
+	if (!group || !group->count) {
+		return NULL;
+	}
+	return &group->hops[((u_int64_t)flow_hash * group->count) >> 32];
+}
+
+#endif  // BGP_NEXTHOP_H
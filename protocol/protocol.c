@@ -0,0 +1,1554 @@
+#include "protocol.h"
+#include "../logger/logger.h"
+#include "trace.h"
+#include "../mem/mem_account.h"
+#include "../mem/mem_utils.h"
+#include "../vector/vector.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int stream_enabled = 0;
+
+struct speaker  default_speaker = {.damp_enabled = 1};
+struct speaker* speaker         = &default_speaker;
+
+void expire_route(struct timer* timer, void* arg);
+
+void announce_best(struct ifaddrs* all_ifs, in_addr_t base);
+
+static struct neighbor* find_neighbor(struct ifaddrs* ifap);
+
+static const char* limit_actions[] = {
+    [LIMIT_WARN]   = "warn",
+    [LIMIT_REJECT] = "reject",
+    [LIMIT_DROP]   = "drop",
+};
+
+struct update_message*
+make_message()
+{
+	struct update_message* p = calloc(1, sizeof(struct update_message));
+	p->size                  = sizeof(*p);
+	return p;
+}
+
+void
+free_message(struct update_message* ptr)
+{
+	free(ptr);
+}
+
+int
+routing_entry_eq(struct routing_entry* a, struct routing_entry* b)
+{
+	return (a->base == b->base) && (a->mask == b->mask) &&
+	       (a->gateway == b->gateway) && (a->if_addr == b->if_addr) &&
+	       (a->weight == b->weight);
+}
+
+int
+copy_routing_entry(struct routing_entry* src, struct routing_entry* dest)
+{
+	if (!src || !dest) {
+		LOG_ERROR("null pointer when copying routing entry");
+		return -1;
+	}
+	dest->weight  = src->weight;
+	dest->mask    = src->mask;
+	dest->base    = src->base;
+	dest->gateway = src->gateway;
+	dest->if_addr = src->if_addr;
+	return 0;
+}
+
+void
+refresh_route(struct routing_entry* route)
+{
+	if (speaker->route_max_age) {
+		timer_arm(&speaker->timers, &route->expire, speaker->route_max_age);
+	}
+}
+
+// the path is only a candidate until install_best() picks it.
+void
+link_route(struct rib_prefix* prefix, struct routing_entry* route)
+{
+	rib_add_path(&speaker->rib, prefix, route);
+	LIST_INSERT_HEAD(&iface_of(route->if_addr)->routes, route, if_entries);
+	++iface_of(route->if_addr)->route_count;
+}
+
+void
+unlink_route(struct routing_entry* route)
+{
+	struct rib_prefix* prefix = route->prefix;
+	if (prefix->best == route) {
+		LIST_REMOVE(route, entries);
+		prefix->best = NULL;
+		metrics_inc(METRIC_ROUTES_REMOVED);
+	}
+	rib_remove_path(&speaker->rib, route);
+	LIST_REMOVE(route, if_entries);
+	--iface_of(route->if_addr)->route_count;
+	timer_cancel(&speaker->timers, &route->expire);
+}
+
+void
+free_route(struct routing_entry* route)
+{
+	if (route->path) {
+		mem_uncharge(MEM_ATTRIBUTES, route->path_len * sizeof(u_int64_t));
+	}
+	mem_uncharge(MEM_ROUTES, sizeof(struct routing_entry));
+	free(route->path);
+	free(route);
+}
+
+// only queues the change. the fib stage programs it later without the
+// routing lock, and skips it if the hops end up where they were.
+static void
+queue_fib(struct rib_prefix* prefix)
+{
+	struct nexthop_group* group = nexthop_handle_group(prefix->handle);
+	struct fib_hop        hops[NEXTHOP_GROUP_MAX];
+	u_int32_t             count   = group ? group->count : 0;
+	u_int8_t              dst_len = 32;
+
+	for (u_int32_t i = 0; i < count; i++) {
+		hops[i].gateway = group->hops[i].gateway;
+		hops[i].ifindex = iface_of(group->hops[i].if_addr)->index;
+	}
+	if (prefix->best) {
+		dst_len = __builtin_popcount(prefix->best->mask);
+	}
+	fib_update(speaker->fib, prefix->base, dst_len, hops, count);
+}
+
+static void
+export_prefix(struct rib_prefix* prefix)
+{
+	struct routing_entry* best  = prefix->best;
+	struct nexthop_group* group = nexthop_handle_group(prefix->handle);
+	struct shm_rib_hop    hops[NEXTHOP_GROUP_MAX];
+	u_int32_t             count = group ? group->count : 0;
+
+	for (u_int32_t i = 0; i < count; i++) {
+		hops[i].gateway = group->hops[i].gateway;
+		hops[i].ifindex = iface_of(group->hops[i].if_addr)->index;
+	}
+	if (!best) {
+		shm_export_update(speaker->shm, prefix->base, 32, 0, 0, hops, 0);
+		return;
+	}
+	shm_export_update(speaker->shm,
+	                  prefix->base,
+	                  __builtin_popcount(best->mask),
+	                  best->weight,
+	                  best->path_len,
+	                  hops,
+	                  count);
+}
+
+// every path with the weight of the best one is used for multipath. the
+// prefix keeps its handle when its group already holds the set of hops, e.g.
+// after the group dropped an interface that went down.
+static void
+install_group(struct rib_prefix* prefix)
+{
+	struct routing_entry* best = prefix->best;
+	struct nexthop        hops[NEXTHOP_GROUP_MAX];
+	u_int32_t             count = 0;
+	struct routing_entry* current;
+
+	if (best) {
+		hops[count++] = (struct nexthop){best->gateway, best->if_addr};
+		LIST_FOREACH (current, &prefix->paths, paths) {
+			if (count == NEXTHOP_GROUP_MAX) {
+				break;
+			}
+			if (current != best && current->weight == best->weight) {
+				hops[count++] =
+				    (struct nexthop){current->gateway, current->if_addr};
+			}
+		}
+	}
+
+	struct nexthop_group* group = nexthop_handle_group(prefix->handle);
+	if (!count || !nexthop_group_same(group, hops, count)) {
+		struct nexthop_handle* handle =
+		    count ? nexthop_group_get(&speaker->nexthops, hops, count) : NULL;
+		nexthop_group_put(&speaker->nexthops, prefix->handle);
+		prefix->handle = handle;
+	}
+
+	if (speaker->fib) {
+		queue_fib(prefix);
+	}
+	if (speaker->shm) {
+		export_prefix(prefix);
+	}
+}
+
+// moves the best candidate of the prefix into the routing table and updates
+// its next hops. returns 1 when another path became best.
+int
+install_best(struct rib_prefix* prefix)
+{
+	struct routing_entry* best    = rib_select(prefix);
+	int                   changed = best != prefix->best;
+	if (changed) {
+		if (prefix->best) {
+			LIST_REMOVE(prefix->best, entries);
+			metrics_inc(METRIC_ROUTES_REMOVED);
+		}
+		if (best) {
+			LIST_INSERT_HEAD(&speaker->routing_table, best, entries);
+			metrics_inc(METRIC_ROUTES_ADDED);
+		}
+		prefix->best = best;
+	}
+	install_group(prefix);
+	return changed;
+}
+
+// unlinks and frees the path, then selects the next best one of its prefix.
+// a prefix without paths left is dropped.
+enum withdraw_status
+remove_path(struct routing_entry* route)
+{
+	struct rib_prefix* prefix  = route->prefix;
+	int                is_best = prefix->best == route;
+
+	unlink_route(route);
+	free_route(route);
+	install_best(prefix);
+	if (!is_best) {
+		return SNO;
+	}
+	if (prefix->best) {
+		return SFAILOVER;
+	}
+	rib_remove(&speaker->rib, prefix);
+	return SWITHDREW;
+}
+
+void
+log_routing_table()
+{
+	struct routing_entry* current;
+
+	union seg4_addr {
+		struct {
+			u_int8_t seg1;
+			u_int8_t seg2;
+			u_int8_t seg3;
+			u_int8_t seg4;
+		} addr;
+		in_addr_t raw;
+	};
+
+	LOG_INFO("start logging routing table");
+	LIST_FOREACH (current, &speaker->routing_table, entries) {
+		union seg4_addr base = {.raw = current->base};
+		LOG_INFO("\tbase:%d:%d:%d:%d",
+		         base.addr.seg1,
+		         base.addr.seg2,
+		         base.addr.seg3,
+		         base.addr.seg4);
+		union seg4_addr gateway = {.raw = current->gateway};
+		LOG_INFO("\tgateway:%d:%d:%d:%d",
+		         gateway.addr.seg1,
+		         gateway.addr.seg2,
+		         gateway.addr.seg3,
+		         gateway.addr.seg4);
+		LOG_INFO("\tweight: %d", current->weight);
+		LOG_INFO("\tif_name: %s", current->if_addr->ifa_name);
+		LOG_INFO("\tpaths: %zu", current->prefix->path_count);
+		struct nexthop_group* group =
+		    nexthop_handle_group(current->prefix->handle);
+		LOG_INFO("\tnext hops: %u", group ? group->count : 0);
+	}
+	LOG_INFO("logging routing table finished");
+}
+
+static void
+drop_path(struct routing_entry* route)
+{
+	LIST_REMOVE(route, if_entries);
+	--iface_of(route->if_addr)->route_count;
+	timer_cancel(&speaker->timers, &route->expire);
+	free_route(route);
+}
+
+void
+free_routing_table()
+{
+	rib_free(&speaker->rib, drop_path);
+	LIST_INIT(&speaker->routing_table);
+}
+
+// TODO(134ARG): optimize
+// whatever follows the ASPATH, like a trace, moves along behind the new entry.
+struct update_message*
+add_aspath(struct update_message* m_ptr, u_int64_t new_host_id)
+{
+	size_t original_len = m_ptr->path_len;
+	size_t original_size =
+	    sizeof(struct update_message) + original_len * sizeof(u_int64_t);
+	size_t extension =
+	    m_ptr->size > original_size ? m_ptr->size - original_size : 0;
+	size_t new_size = sizeof(struct update_message) +
+	                  (original_len + 1) * sizeof(u_int64_t) + extension;
+	struct update_message* new_p = malloc(new_size);
+	memcpy(new_p, m_ptr, original_size);
+	memcpy(&(new_p->ASPATH)[original_len], &new_host_id, sizeof(u_int64_t));
+	memcpy(&(new_p->ASPATH)[original_len + 1],
+	       (char*)m_ptr + original_size,
+	       extension);
+
+	++(new_p->path_len);
+	new_p->size = new_size;
+
+	LOG_INFO("ASPATH added.");
+
+	return new_p;
+}
+
+int
+route_aggregate(struct routing_entry* new, struct routing_entry* old)
+{
+	// TODO(134ARG): to be implemented
+	return 1;
+}
+
+int
+route_disaggregate(struct routing_entry* new, struct routing_entry* old)
+{
+	// TODO(134ARG): to be implemented
+	return 1;
+}
+
+static int
+same_path(struct routing_entry* a, struct routing_entry* b)
+{
+	return a->path_len == b->path_len &&
+	       !memcmp(a->path, b->path, a->path_len * sizeof(u_int64_t));
+}
+
+// stores a copy of the path new borrows from its update.
+static int
+set_path(struct routing_entry* route, struct routing_entry* new)
+{
+	u_int64_t* path = NULL;
+	if (new->path_len) {
+		path = malloc(new->path_len * sizeof(u_int64_t));
+		if (!path) {
+			LOG_ERROR("failed to allocate ASPATH.");
+			return -1;
+		}
+		memcpy(path, new->path, new->path_len * sizeof(u_int64_t));
+		mem_charge(MEM_ATTRIBUTES, new->path_len * sizeof(u_int64_t));
+	}
+	if (route->path) {
+		mem_uncharge(MEM_ATTRIBUTES, route->path_len * sizeof(u_int64_t));
+	}
+	free(route->path);
+	route->path     = path;
+	route->path_len = new->path_len;
+	return 0;
+}
+
+static struct prefix_limit*
+neighbor_limit(struct ifaddrs* ifap)
+{
+	struct prefix_limit* fallback = NULL;
+	for (size_t i = 0; i < speaker->neighbor_limit_count; i++) {
+		struct prefix_limit* limit = &speaker->neighbor_limits[i];
+		if (!strcmp(limit->ifname, ifap->ifa_name)) {
+			return limit;
+		}
+		if (!limit->ifname[0]) {
+			fallback = limit;
+		}
+	}
+	return fallback;
+}
+
+static enum add_status
+apply_limit(struct prefix_limit* limit,
+            size_t               count,
+            int*                 warned,
+            const char*          scope,
+            struct ifaddrs*      ifap)
+{
+	if (!limit || !limit->max || count < limit->max) {
+		*warned = 0;
+		return SNEW;
+	}
+	if (limit->action == LIMIT_DROP) {
+		LOG_WARN("[%s] %s prefix limit of %zu reached. dropping neighbor.",
+		         ifap->ifa_name,
+		         scope,
+		         limit->max);
+		return SDROP;
+	}
+	if (!*warned) {
+		LOG_WARN("[%s] %s prefix limit of %zu reached.%s",
+		         ifap->ifa_name,
+		         scope,
+		         limit->max,
+		         limit->action == LIMIT_REJECT ? " new paths are refused."
+		                                       : "");
+		*warned = 1;
+	}
+	return limit->action == LIMIT_REJECT ? SREFUSED : SNEW;
+}
+
+// only paths from a neighbor that has none for the prefix yet are checked,
+// replacing a path costs nothing.
+static enum add_status
+admit_path(struct ifaddrs* ifap, int new_prefix)
+{
+	struct neighbor* neighbor = find_neighbor(ifap);
+	int              warned   = 0;
+	enum add_status  ret      = SNEW;
+
+	if (new_prefix) {
+		ret = apply_limit(&speaker->global_limit,
+		                  speaker->rib.prefix_count,
+		                  &speaker->global_warned,
+		                  "global",
+		                  ifap);
+	}
+	if (ret == SNEW) {
+		ret = apply_limit(neighbor_limit(ifap),
+		                  iface_of(ifap)->route_count,
+		                  neighbor ? &neighbor->warned : &warned,
+		                  "neighbor",
+		                  ifap);
+	}
+	if (ret == SNEW && mem_pressure()) {
+		ret = SREFUSED;
+	}
+	if (ret != SNEW) {
+		metrics_inc(METRIC_PATHS_REFUSED);
+	}
+	return ret;
+}
+
+// the neighbor behind new->if_addr holds at most one path per prefix, a new
+// announcement replaces it. only the candidates of the one prefix are
+// compared afterwards.
+enum add_status
+add_new_route(struct routing_entry* new)
+{
+	struct rib_prefix*    prefix  = rib_find(&speaker->rib, new->base);
+	struct routing_entry* current = NULL;
+	if (prefix) {
+		current = rib_path_from(prefix, new->if_addr);
+	}
+	if (!current) {
+		enum add_status ret = admit_path(new->if_addr, !prefix);
+		if (ret != SNEW) {
+			return ret;
+		}
+	}
+	if (!prefix && !(prefix = rib_insert(&speaker->rib, new->base))) {
+		return SEXISTED;
+	}
+
+	if (current) {
+		refresh_route(current);
+		if (routing_entry_eq(new, current) && same_path(new, current)) {
+			return SEXISTED;
+		}
+		if (set_path(current, new)) {
+			return SEXISTED;
+		}
+		copy_routing_entry(new, current);
+	} else {
+		current = calloc(1, sizeof(struct routing_entry));
+		if (!current || set_path(current, new)) {
+			LOG_ERROR("failed to allocate route.");
+			free(current);
+			if (!prefix->path_count) {
+				rib_remove(&speaker->rib, prefix);
+			}
+			return SEXISTED;
+		}
+		mem_charge(MEM_ROUTES, sizeof(struct routing_entry));
+		copy_routing_entry(new, current);
+		timer_init(&current->expire, expire_route, current);
+		refresh_route(current);
+		link_route(prefix, current);
+	}
+
+	int switched = install_best(prefix);
+	if (prefix->best == current) {
+		return SNEW;
+	}
+	return switched ? SSWITCHED : SEXISTED;
+}
+
+// only the path learned from the neighbor behind withdraw->if_addr goes away.
+int
+withdraw_route(struct routing_entry* withdraw)
+{
+	struct rib_prefix* prefix = rib_find(&speaker->rib, withdraw->base);
+	if (!prefix) {
+		return SNO;
+	}
+	struct routing_entry* route = rib_path_from(prefix, withdraw->if_addr);
+	if (!route) {
+		return SNO;
+	}
+	return remove_path(route);
+}
+
+int
+get_addr_str(struct sockaddr* ifa_addr, char* str)
+{
+	return getnameinfo(ifa_addr,
+	                   (ifa_addr->sa_family == AF_INET)
+	                       ? sizeof(struct sockaddr_in)
+	                       : sizeof(struct sockaddr_in6),
+	                   str,
+	                   NI_MAXHOST,
+	                   NULL,
+	                   0,
+	                   NI_NUMERICHOST);
+}
+
+unsigned int
+len_ifs(struct ifaddrs* ifs)
+{
+	unsigned int length = 0;
+	while (ifs) {
+		++length;
+		ifs = ifs->ifa_next;
+	}
+	return length;
+}
+
+struct stream_peer_list stream_peers;
+pthread_mutex_t         stream_peers_lock = PTHREAD_MUTEX_INITIALIZER;
+int                     stream_wakeup_fd  = -1;
+
+void
+stream_wakeup()
+{
+	u_int64_t one = 1;
+	if (stream_wakeup_fd >= 0 &&
+	    write(stream_wakeup_fd, &one, sizeof(one)) < 0) {
+		LOG_WARN("failed to wake up stream loop. errno: %d", errno);
+	}
+}
+
+// a segment can hold several neighbors, so peers are told apart by the
+// interface and the address of the neighbor. caller must hold
+// stream_peers_lock.
+struct stream_peer*
+find_stream_peer(struct ifaddrs* ifap, in_addr_t addr)
+{
+	struct stream_peer* current;
+	LIST_FOREACH (current, &stream_peers, entries) {
+		if (current->owner == ifap && current->addr == addr &&
+		    current->state != SCLOSED) {
+			return current;
+		}
+	}
+	return NULL;
+}
+
+int
+stream_established(struct ifaddrs* ifap, in_addr_t addr)
+{
+	pthread_mutex_lock(&stream_peers_lock);
+	struct stream_peer* peer = find_stream_peer(ifap, addr);
+	int established = peer && peer->state == SESTABLISHED;
+	pthread_mutex_unlock(&stream_peers_lock);
+	return established;
+}
+
+// queues the message on every established stream peer of the interface.
+// returns the number of peers the message was queued on.
+int
+stream_send_from_if(struct ifaddrs* ifap, char* msg, int len)
+{
+	int sent = 0;
+
+	pthread_mutex_lock(&stream_peers_lock);
+	struct stream_peer* current;
+	LIST_FOREACH (current, &stream_peers, entries) {
+		if (current->owner == ifap && current->state == SESTABLISHED &&
+		    !stream_peer_send(current, msg, len)) {
+			++sent;
+		}
+	}
+	pthread_mutex_unlock(&stream_peers_lock);
+
+	if (sent) {
+		LOG_INFO("[%s] message queued on %d streams", ifap->ifa_name, sent);
+		stream_wakeup();
+	}
+	return sent;
+}
+
+int
+resolve_if_dest(struct ifaddrs* ifap, struct sockaddr_in* dest_addr)
+{
+	struct sockaddr_in* if_addr = NULL;
+
+	if (ifap->ifa_flags & IFF_BROADCAST) {
+		if_addr = (struct sockaddr_in*)ifap->ifa_broadaddr;
+	} else if (ifap->ifa_flags & IFF_POINTOPOINT ||
+	           ifap->ifa_flags & IFF_LOOPBACK) {
+		if_addr = (struct sockaddr_in*)ifap->ifa_dstaddr;
+	} else {
+		LOG_INFO("[%s] skipping current interface for unsupported flag",
+		         ifap->ifa_name);
+		return -1;
+	}
+
+	memset(dest_addr, 0, sizeof(*dest_addr));
+	dest_addr->sin_family      = AF_INET;
+	dest_addr->sin_port        = htons(BROADCAST_PORT);
+	dest_addr->sin_addr.s_addr = if_addr->sin_addr.s_addr;
+	return 0;
+}
+
+// sends every request from the interface stored in its owner. the message is
+// queued on the established stream peers of the interface and still
+// broadcast for the neighbors without one, which are handed to the io backend
+// as one batch. receivers drop the datagram copy from a neighbor they share a
+// stream with. returns the number of failed sends.
+int
+send_from_ifs(struct io_send_req* reqs, int count)
+{
+	int failed = 0;
+	int batch  = 0;
+
+	for (int i = 0; i < count; i++) {
+		struct io_send_req req  = reqs[i];
+		struct ifaddrs*    ifap = req.owner;
+
+		int streamed = 0;
+		if (stream_enabled) {
+			streamed = stream_send_from_if(ifap, (char*)req.msg, req.len);
+			metrics_add(METRIC_MESSAGES_SENT, streamed);
+		}
+		if (req.len > MAX_MESSAGE_SIZE) {
+			if (streamed) {
+				continue;
+			}
+			LOG_WARN("[%s] message of %d bytes exceeds datagram limit. SKIP",
+			         ifap->ifa_name,
+			         req.len);
+			++failed;
+			metrics_inc(METRIC_SEND_FAILURES);
+			continue;
+		}
+		if (resolve_if_dest(ifap, &req.dest)) {
+			continue;
+		}
+		req.retries   = 0;
+		reqs[batch++] = req;
+	}
+
+	if (batch) {
+		u_int64_t start = metrics_now();
+		speaker->io_backend->send_batch(speaker->io_backend, reqs, batch);
+		metrics_record(METRIC_SEND_NS, metrics_now() - start);
+	}
+
+	for (int i = 0; i < batch; i++) {
+		struct ifaddrs* ifap = reqs[i].owner;
+		metrics_add(METRIC_SEND_RETRIES, reqs[i].retries);
+		if (reqs[i].result < 0) {
+			metrics_inc(METRIC_SEND_FAILURES);
+			LOG_WARN("[%s] message send failed. all retry failed. SKIP",
+			         ifap->ifa_name);
+			++failed;
+		} else {
+			metrics_inc(METRIC_MESSAGES_SENT);
+			LOG_INFO("[%s] message sent", ifap->ifa_name);
+		}
+	}
+	return failed;
+}
+
+int
+broadcast_message_from_if(struct ifaddrs* ifap, char* msg, int len)
+{
+	struct io_send_req req = {
+	    .msg   = msg,
+	    .len   = len,
+	    .owner = ifap,
+	};
+	return send_from_ifs(&req, 1) ? -1 : 0;
+}
+
+int
+recv_message(char* buffer, int len, struct sockaddr_in* sender_return)
+{
+	struct io_datagram dgram;
+
+	int n = speaker->io_backend->recv(speaker->io_backend, &dgram);
+	if (n < 0) {
+		return -1;
+	}
+	if (n > len) {
+		n = len;
+	}
+	memcpy(buffer, dgram.data, n);
+	if (sender_return) {
+		*sender_return = dgram.sender;
+	}
+	speaker->io_backend->release(speaker->io_backend, &dgram);
+
+	return n;
+}
+
+// runs the export policy for sending an announcement from ifap. returns 0
+// when it must not go out there, otherwise 1 and the weight to send.
+static int
+export_update(struct update_message* m_ptr,
+              struct ifaddrs*        ifap,
+              u_int32_t*             weight)
+{
+	*weight = m_ptr->weight;
+	if (!speaker->policy || m_ptr->type != MADD) {
+		return 1;
+	}
+
+	struct policy_input input = {
+	    .addr     = m_ptr->addr,
+	    .weight   = m_ptr->weight,
+	    .path     = m_ptr->ASPATH,
+	    .path_len = m_ptr->path_len,
+	    .ifname   = ifap->ifa_name,
+	};
+	if (policy_eval(
+	        speaker->policy, &speaker->policy->export, &input, weight)) {
+		return 1;
+	}
+	LOG_INFO("[%s] update denied by export policy.", ifap->ifa_name);
+	metrics_inc(METRIC_EXPORT_REJECTED);
+	return 0;
+}
+
+int
+broadcast_update(struct ifaddrs* all_ifs, struct update_message* m_ptr)
+{
+	struct ifaddrs* current = all_ifs;
+	unsigned int    count   = len_ifs(all_ifs);
+	unsigned int    n       = 0;
+
+	CLEANUP_FREE struct io_send_req* reqs =
+	    calloc(count, sizeof(struct io_send_req));
+	if (!reqs) {
+		LOG_ERROR("failed to allocate send requests.");
+		return -1;
+	}
+	// copies are only made for interfaces the export policy changes the
+	// weight for.
+	CLEANUP_FREE char* copies = NULL;
+
+	LOG_INFO("start broadcast.");
+	for (; current; current = current->ifa_next) {
+		struct update_message* msg = m_ptr;
+		u_int32_t              weight;
+
+		if (!export_update(m_ptr, current, &weight)) {
+			continue;
+		}
+		if (weight != m_ptr->weight) {
+			if (!copies && !(copies = malloc((size_t)count * m_ptr->size))) {
+				LOG_ERROR("failed to allocate update copies.");
+				return -1;
+			}
+			msg = (struct update_message*)(copies + (size_t)n * m_ptr->size);
+			memcpy(msg, m_ptr, m_ptr->size);
+			msg->weight = weight;
+		}
+		reqs[n].msg   = (char*)msg;
+		reqs[n].len   = msg->size;
+		reqs[n].owner = current;
+		++n;
+	}
+	if (send_from_ifs(reqs, n)) {
+		LOG_WARN("sending update failed on some interfaces.");
+	} else {
+		LOG_INFO("sending update success.");
+	}
+	return 0;
+}
+
+int
+send_self_message(struct ifaddrs* all_ifs, int type)
+{
+	struct ifaddrs*                     current = all_ifs;
+	unsigned int                        count   = len_ifs(all_ifs);
+	CLEANUP_FREE struct update_message* m_ptr   = make_message();
+
+	m_ptr->type                = type;
+	m_ptr->weight              = 1;
+	struct update_message* new = add_aspath(m_ptr, speaker->host_id);
+	free(m_ptr);
+	m_ptr = new;
+	if (speaker->trace_enabled && type != MKEEPALIVE) {
+		new = trace_originate(m_ptr);
+		if (new) {
+			free(m_ptr);
+			m_ptr = new;
+		}
+	}
+
+	// every interface announces its own address, so each one gets a copy.
+	CLEANUP_FREE char* msgs = malloc((size_t)count * m_ptr->size);
+	CLEANUP_FREE struct io_send_req* reqs =
+	    calloc(count, sizeof(struct io_send_req));
+	if (!msgs || !reqs) {
+		LOG_ERROR("failed to allocate self update.");
+		return -1;
+	}
+
+	unsigned int n = 0;
+	for (; current; current = current->ifa_next) {
+		struct update_message* msg =
+		    (struct update_message*)(msgs + (size_t)n * m_ptr->size);
+		memcpy(msg, m_ptr, m_ptr->size);
+		msg->addr = ((struct sockaddr_in*)current->ifa_addr)->sin_addr.s_addr;
+		msg->gateway = 0;  // receivers use the sender address
+		if (!export_update(msg, current, &msg->weight)) {
+			continue;
+		}
+
+		reqs[n].msg   = (char*)msg;
+		reqs[n].len   = msg->size;
+		reqs[n].owner = current;
+		++n;
+	}
+
+	if (send_from_ifs(reqs, n)) {
+		LOG_WARN("sending update failed on some interfaces.");
+	} else {
+		LOG_INFO("sending update success.");
+	}
+	return 0;
+}
+
+int
+self_update(struct ifaddrs* all_ifs)
+{
+	return send_self_message(all_ifs, MADD);
+}
+
+// withdraws every given base from all peers with a single batched send.
+int
+broadcast_withdrawals(struct ifaddrs* all_ifs, in_addr_t* bases, size_t count)
+{
+	unsigned int if_count = len_ifs(all_ifs);
+	size_t       size     = sizeof(struct update_message) + sizeof(u_int64_t);
+
+	if (!count || !if_count) {
+		return 0;
+	}
+
+	CLEANUP_FREE char* msgs = calloc(count, size);
+	CLEANUP_FREE struct io_send_req* reqs =
+	    calloc(count * if_count, sizeof(struct io_send_req));
+	if (!msgs || !reqs) {
+		LOG_ERROR("failed to allocate withdrawals.");
+		return -1;
+	}
+
+	size_t n = 0;
+	for (size_t i = 0; i < count; i++) {
+		struct update_message* msg = (struct update_message*)(msgs + i * size);
+		msg->size                  = size;
+		msg->type                  = MWITHDRAW;
+		msg->addr                  = bases[i];
+		msg->path_len              = 1;
+		msg->ASPATH[0]             = speaker->host_id;
+
+		struct ifaddrs* current = all_ifs;
+		while (current) {
+			reqs[n].msg   = (char*)msg;
+			reqs[n].len   = size;
+			reqs[n].owner = current;
+			++n;
+			current = current->ifa_next;
+		}
+	}
+
+	LOG_INFO("start broadcast of %zu withdrawals.", count);
+	if (send_from_ifs(reqs, n)) {
+		LOG_WARN("sending withdrawals failed on some interfaces.");
+	}
+	return 0;
+}
+
+// the routing lock is held by the timer loop while callbacks run.
+void
+expire_route(struct timer* timer, void* arg)
+{
+	struct routing_entry* route = arg;
+	in_addr_t             base  = route->base;
+
+	LOG_INFO("[%s] route aged out.", route->if_addr->ifa_name);
+	int ret = remove_path(route);
+	if (ret == SWITHDREW) {
+		broadcast_withdrawals(speaker->filtered_ifap, &base, 1);
+	} else if (ret == SFAILOVER) {
+		announce_best(speaker->filtered_ifap, base);
+	}
+}
+
+INITIALIZE_VECTOR(addr_vector, in_addr_t)
+
+void
+free_addr_vector(addr_vector* v)
+{
+	clean_addr_vector(v);
+}
+
+// only the routes learned through the interface are visited. prefixes that
+// still have a path through another neighbor fail over to it. the next hop
+// groups drop the interface first, which moves multipath prefixes to their
+// remaining hops in one step and leaves them with their handle afterwards.
+int
+withdraw_routes_from_if(struct ifaddrs* all_ifs, struct ifaddrs* ifap)
+{
+	struct routing_entry* current;
+	size_t                removed = 0;
+	size_t                groups =
+	    nexthop_table_remove_if(&speaker->nexthops, ifap);
+
+	CLEANUP(free_addr_vector) addr_vector bases    = make_addr_vector();
+	CLEANUP(free_addr_vector) addr_vector failover = make_addr_vector();
+
+	while ((current = LIST_FIRST(&iface_of(ifap)->routes))) {
+		in_addr_t base = current->base;
+		int       ret  = remove_path(current);
+		if (ret == SWITHDREW) {
+			addr_vector_push(&bases, base);
+		} else if (ret == SFAILOVER) {
+			addr_vector_push(&failover, base);
+		}
+		++removed;
+	}
+
+	LOG_INFO("[%s] %zu routes removed, %zu withdrawn, %zu failed over, %zu "
+	         "next hop groups updated.",
+	         ifap->ifa_name,
+	         removed,
+	         bases.length,
+	         failover.length,
+	         groups);
+	broadcast_withdrawals(all_ifs, bases.data, bases.length);
+	for (size_t i = 0; i < failover.length; i++) {
+		announce_best(all_ifs, failover.data[i]);
+	}
+	return removed;
+}
+
+// the best path of base.
+struct routing_entry*
+find_route(in_addr_t base)
+{
+	struct rib_prefix* prefix = rib_find(&speaker->rib, base);
+	return prefix ? prefix->best : NULL;
+}
+
+// returns 1 when the update of a flapping prefix must not be propagated.
+// fan_out is the number of messages the update would have produced.
+int
+dampen_update(struct update_message* m_ptr,
+              enum damp_event        event,
+              unsigned int           fan_out)
+{
+	if (!speaker->damp_enabled) {
+		return 0;
+	}
+	if (!damp_update(&speaker->dampening,
+	                 m_ptr->addr,
+	                 event,
+	                 speaker->timers.now)) {
+		return 0;
+	}
+	speaker->dampening.stats.saved_messages += fan_out;
+	speaker->dampening.stats.saved_bytes += (u_int64_t)fan_out * m_ptr->size;
+	return 1;
+}
+
+// the update that advertises the stored path of route, as if it had just been
+// received and passed on.
+struct update_message*
+make_route_message(struct routing_entry* route)
+{
+	u_int32_t size =
+	    sizeof(struct update_message) + route->path_len * sizeof(u_int64_t);
+	CLEANUP_FREE struct update_message* m_ptr = malloc(size);
+	if (!m_ptr) {
+		LOG_ERROR("failed to allocate message.");
+		return NULL;
+	}
+	m_ptr->size     = size;
+	m_ptr->path_len = route->path_len;
+	m_ptr->type     = MADD;
+	m_ptr->addr     = route->base;
+	m_ptr->gateway  = 0;
+	m_ptr->weight   = route->weight + 1;
+	memcpy(m_ptr->ASPATH, route->path, route->path_len * sizeof(u_int64_t));
+	return add_aspath(m_ptr, speaker->host_id);
+}
+
+// advertises whichever path of base is best now, without waiting for the
+// neighbors to announce it again.
+void
+announce_best(struct ifaddrs* all_ifs, in_addr_t base)
+{
+	struct routing_entry* route = find_route(base);
+	if (!route) {
+		return;
+	}
+	CLEANUP_FREE struct update_message* m_ptr = make_route_message(route);
+	if (!m_ptr) {
+		return;
+	}
+	if (dampen_update(m_ptr, DAMP_ANNOUNCE, 2 * len_ifs(all_ifs))) {
+		LOG_INFO("best path changed. prefix dampened, skip broadcast.");
+		return;
+	}
+	LOG_INFO("best path changed. start broadcast to peers");
+	broadcast_update(all_ifs, m_ptr);
+}
+
+void
+collect_reused(in_addr_t base, void* arg)
+{
+	addr_vector_push((addr_vector*)arg, base);
+}
+
+// released prefixes are advertised in their current state, which may differ
+// from what peers saw before suppression started. withdrawals are never held
+// back, peers already dropped the prefixes that have no route left.
+void
+process_reuse(struct timer* timer, void* arg)
+{
+	CLEANUP(free_addr_vector) addr_vector reused = make_addr_vector();
+
+	damp_process_reuse(
+	    &speaker->dampening, speaker->timers.now, collect_reused, &reused);
+
+	for (size_t i = 0; i < reused.length; i++) {
+		struct routing_entry* route = find_route(reused.data[i]);
+		if (!route) {
+			continue;
+		}
+
+		LOG_INFO("dampened route reused. start broadcast to peers");
+		CLEANUP_FREE struct update_message* m_ptr = make_route_message(route);
+		if (!m_ptr) {
+			continue;
+		}
+		broadcast_update(speaker->filtered_ifap, m_ptr);
+	}
+
+	timer_arm(&speaker->timers, timer, speaker->dampening.config.granularity);
+}
+
+u_int64_t
+refresh_interval()
+{
+	u_int64_t interval = speaker->route_max_age / REFRESHES_PER_AGE;
+	return interval ? interval : 1;
+}
+
+// peers age out every path they do not hear about again within
+// route_max_age, so the best paths and the own addresses are announced again
+// before that. an unchanged path only restarts its age on the peers and is
+// not passed on any further.
+void
+refresh_routes(struct timer* timer, void* arg)
+{
+	struct routing_entry* current;
+	size_t                count = 0;
+
+	LIST_FOREACH (current, &speaker->routing_table, entries) {
+		if (speaker->damp_enabled &&
+		    damp_is_suppressed(&speaker->dampening, current->base)) {
+			continue;
+		}
+		CLEANUP_FREE struct update_message* m_ptr =
+		    make_route_message(current);
+		if (!m_ptr) {
+			continue;
+		}
+		broadcast_update(speaker->filtered_ifap, m_ptr);
+		++count;
+	}
+	self_update(speaker->filtered_ifap);
+	LOG_INFO("%zu best paths refreshed.", count);
+
+	timer_arm(&speaker->timers, timer, refresh_interval());
+}
+
+void
+log_dampening_stats()
+{
+	struct damp_stats* stats = &speaker->dampening.stats;
+
+	LOG_INFO("start logging dampening");
+	LOG_INFO("\tenabled: %d", speaker->damp_enabled);
+	LOG_INFO("\ttracked prefixes: %lu", stats->entries);
+	LOG_INFO("\tsuppressed prefixes: %lu", stats->suppressed);
+	LOG_INFO("\tsuppressions: %lu", stats->suppressions);
+	LOG_INFO("\treuses: %lu", stats->reuses);
+	LOG_INFO("\tsuppressed updates: %lu", stats->suppressed_updates);
+	LOG_INFO("\tmessages saved: %lu", stats->saved_messages);
+	LOG_INFO("\tbytes saved: %lu", stats->saved_bytes);
+	LOG_INFO("logging dampening finished");
+}
+
+void
+hold_expired(struct timer* timer, void* arg)
+{
+	struct neighbor* neighbor = arg;
+
+	LOG_WARN("[%s] hold timer expired. neighbor down.",
+	         neighbor->if_addr->ifa_name);
+	neighbor->up = 0;
+	withdraw_routes_from_if(speaker->filtered_ifap, neighbor->if_addr);
+}
+
+void
+restart_neighbor(struct timer* timer, void* arg)
+{
+	struct neighbor* neighbor = arg;
+
+	LOG_INFO("[%s] dropped neighbor accepted again.",
+	         neighbor->if_addr->ifa_name);
+	neighbor->dropped = 0;
+}
+
+// the neighbor gets no notice. everything it sends is ignored until the
+// restart timer runs, its paths come back with its next announcements.
+static void
+drop_neighbor(struct ifaddrs* all_ifs, struct neighbor* neighbor)
+{
+	neighbor->up      = 0;
+	neighbor->dropped = 1;
+	neighbor->warned  = 0;
+	timer_cancel(&speaker->timers, &neighbor->hold);
+	timer_arm(&speaker->timers, &neighbor->restart, DROP_TIME);
+	metrics_inc(METRIC_NEIGHBORS_DROPPED);
+	withdraw_routes_from_if(all_ifs, neighbor->if_addr);
+}
+
+static struct neighbor*
+find_neighbor(struct ifaddrs* ifap)
+{
+	struct neighbor* current;
+	LIST_FOREACH (current, &speaker->neighbors, entries) {
+		if (current->if_addr == ifap) {
+			return current;
+		}
+	}
+	return NULL;
+}
+
+// a dropped neighbor is returned as it is.
+struct neighbor*
+neighbor_alive(struct ifaddrs* recv_if)
+{
+	struct neighbor* current = find_neighbor(recv_if);
+	if (!current) {
+		current = calloc(1, sizeof(struct neighbor));
+		if (!current) {
+			LOG_ERROR("failed to allocate neighbor.");
+			return NULL;
+		}
+		current->if_addr = recv_if;
+		timer_init(&current->hold, hold_expired, current);
+		timer_init(&current->restart, restart_neighbor, current);
+		LIST_INSERT_HEAD(&speaker->neighbors, current, entries);
+	}
+	if (current->dropped) {
+		return current;
+	}
+	if (!current->up) {
+		LOG_INFO("[%s] neighbor up.", recv_if->ifa_name);
+		current->up = 1;
+	}
+	timer_arm(&speaker->timers, &current->hold, HOLD_TIME);
+	return current;
+}
+
+void
+free_neighbors()
+{
+	struct neighbor* current;
+	struct neighbor* temp;
+	LIST_FOREACH_SAFE (current, &speaker->neighbors, entries, temp) {
+		timer_cancel(&speaker->timers, &current->hold);
+		timer_cancel(&speaker->timers, &current->restart);
+		free(current);
+	}
+	LIST_INIT(&speaker->neighbors);
+}
+
+void
+log_limits()
+{
+	struct prefix_limit* limit = &speaker->global_limit;
+
+	LOG_INFO("start logging limits");
+	LOG_INFO("	prefixes: %zu, limit: %zu, %s",
+	         speaker->rib.prefix_count,
+	         limit->max,
+	         limit->max ? limit_actions[limit->action] : "none");
+	struct iface* iface;
+	LIST_FOREACH (iface, &speaker->ifaces, entries) {
+		struct neighbor* neighbor = find_neighbor(&iface->ifa);
+		limit                     = neighbor_limit(&iface->ifa);
+		LOG_INFO("	[%s] paths: %zu, limit: %zu, %s%s",
+		         iface->name,
+		         iface->route_count,
+		         limit ? limit->max : 0,
+		         limit && limit->max ? limit_actions[limit->action] : "none",
+		         neighbor && neighbor->dropped ? ", dropped" : "");
+	}
+	LOG_INFO("logging limits finished");
+}
+
+// [ifname=]max[:warn|reject|drop], the action defaults to warn.
+int
+parse_prefix_limit(const char* arg, struct prefix_limit* limit)
+{
+	memset(limit, 0, sizeof(*limit));
+	const char* value = strchr(arg, '=');
+	if (value) {
+		if (value - arg >= IF_NAMESIZE) {
+			LOG_ERROR("interface name too long in prefix limit: %s", arg);
+			return -1;
+		}
+		memcpy(limit->ifname, arg, value - arg);
+		++value;
+	} else {
+		value = arg;
+	}
+
+	char* end;
+	limit->max = strtoull(value, &end, 10);
+	if (end == value) {
+		LOG_ERROR("invalid prefix limit: %s", arg);
+		return -1;
+	}
+	if (!*end) {
+		return 0;
+	}
+	for (int action = 0; action <= LIMIT_DROP; action++) {
+		if (*end == ':' && !strcmp(end + 1, limit_actions[action])) {
+			limit->action = action;
+			return 0;
+		}
+	}
+	LOG_ERROR("invalid prefix limit action: %s", arg);
+	return -1;
+}
+
+void
+send_keepalive(struct timer* timer, void* arg)
+{
+	send_self_message(speaker->filtered_ifap, MKEEPALIVE);
+	timer_arm(&speaker->timers, timer, KEEPALIVE_INTERVAL);
+}
+
+void
+iface_down(struct iface* iface)
+{
+	if (!iface->up) {
+		return;
+	}
+	LOG_WARN("[%s] interface down.", iface->name);
+	iface->up     = 0;
+	speaker->filtered_ifap = link_ifaces(&speaker->ifaces);
+	withdraw_routes_from_if(speaker->filtered_ifap, &iface->ifa);
+}
+
+void
+iface_up(struct iface* iface)
+{
+	if (iface->up) {
+		return;
+	}
+	LOG_INFO("[%s] interface up.", iface->name);
+	iface->up     = 1;
+	speaker->filtered_ifap = link_ifaces(&speaker->ifaces);
+	self_update(speaker->filtered_ifap);
+}
+
+// the route leads through the neighbor that sent the update. only the
+// neighbor's own address is reached on the link without a gateway.
+struct routing_entry
+make_routing_from_update(struct update_message* m_ptr,
+                         struct ifaddrs*        if_addr,
+                         in_addr_t              sender)
+{
+	return (struct routing_entry){
+	    .weight   = m_ptr->weight,
+	    .base     = m_ptr->addr,
+	    .mask     = (in_addr_t)-1,
+	    .gateway  = m_ptr->addr == sender ? 0 : sender,
+	    .if_addr  = if_addr,
+	    .path     = m_ptr->ASPATH,
+	    .path_len = m_ptr->path_len,
+	};
+}
+
+int
+check_if_valid_ASPATH(struct update_message* m_ptr)
+{
+	for (size_t i = 0; i < m_ptr->path_len; i++) {
+		if (m_ptr->ASPATH[i] == speaker->host_id) {
+			LOG_INFO("host id found in ASPATH. self: %lu, found: %lu",
+			         speaker->host_id,
+			         m_ptr->ASPATH[i]);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int
+decide(struct ifaddrs* all_ifs,
+       struct ifaddrs* recv_if,
+       in_addr_t       sender,
+       char*           buffer,
+       int             len)
+{
+	struct update_message* m_ptr = (struct update_message*)buffer;
+	if (len < 0 || (size_t)len < sizeof(struct update_message) ||
+	    m_ptr->size > (u_int32_t)len) {
+		LOG_ERROR("incompelete message. parsing abort.");
+		return -1;
+	}
+	// everything below reads the ASPATH, it has to fit in the message.
+	if (m_ptr->size < sizeof(struct update_message) +
+	                      (u_int64_t)m_ptr->path_len * sizeof(u_int64_t)) {
+		LOG_ERROR("ASPATH of %u entries exceeds message of %u bytes. abort.",
+		          m_ptr->path_len,
+		          m_ptr->size);
+		return -1;
+	}
+
+	if (!check_if_valid_ASPATH(m_ptr)) {
+		LOG_INFO(
+		    "[%s] circle detected. invalid ASPATH. skip current update message.",
+		    recv_if->ifa_name);
+		return 0;
+	}
+
+	struct neighbor* neighbor = neighbor_alive(recv_if);
+	if (neighbor && neighbor->dropped) {
+		LOG_DEBUG("[%s] neighbor dropped. update ignored.", recv_if->ifa_name);
+		return 0;
+	}
+	if (m_ptr->type == MKEEPALIVE) {
+		LOG_DEBUG("[%s] KEEPALIVE received.", recv_if->ifa_name);
+		return 0;
+	}
+
+	// the clock is only read for traced updates.
+	u_int64_t received = 0;
+	if (update_trace(m_ptr)) {
+		received = trace_now();
+		trace_received(m_ptr, received);
+	}
+
+	// withdrawals pass unfiltered, they can only remove what was imported. a
+	// denied announcement withdraws the path the neighbor had announced
+	// before, the policy no longer accepts what it offers for the prefix.
+	if (m_ptr->type == MADD && speaker->policy) {
+		struct policy_input input = {
+		    .addr     = m_ptr->addr,
+		    .weight   = m_ptr->weight,
+		    .path     = m_ptr->ASPATH,
+		    .path_len = m_ptr->path_len,
+		    .ifname   = recv_if->ifa_name,
+		};
+		if (!policy_eval(speaker->policy,
+		                 &speaker->policy->import,
+		                 &input,
+		                 &m_ptr->weight)) {
+			LOG_INFO("[%s] update denied by import policy.",
+			         recv_if->ifa_name);
+			metrics_inc(METRIC_IMPORT_REJECTED);
+			struct routing_entry denied = {.base    = m_ptr->addr,
+			                               .if_addr = recv_if};
+			int                  ret    = withdraw_route(&denied);
+			if (ret == SWITHDREW) {
+				LOG_INFO("[%s] earlier path withdrawn.", recv_if->ifa_name);
+				broadcast_withdrawals(all_ifs, &m_ptr->addr, 1);
+			} else if (ret == SFAILOVER) {
+				LOG_INFO("[%s] earlier path failed over.", recv_if->ifa_name);
+				announce_best(all_ifs, m_ptr->addr);
+			}
+			return 0;
+		}
+	}
+
+	struct routing_entry new_route =
+	    make_routing_from_update(m_ptr, recv_if, sender);
+
+	if (m_ptr->type == MWITHDRAW) {
+		LOG_INFO("WITHDRAW update.");
+		int ret = withdraw_route(&new_route);
+		if (ret == SNO) {
+			LOG_INFO("No new update.");
+		} else if (ret == SFAILOVER) {
+			LOG_INFO("WITHDRAW finished. failed over to another path.");
+			announce_best(all_ifs, m_ptr->addr);
+		} else {
+			// penalized for the announcements that follow, never held back.
+			dampen_update(m_ptr, DAMP_WITHDRAW, len_ifs(all_ifs));
+			LOG_INFO("WITHDRAW finished. start broadcast to peers");
+			CLEANUP_FREE struct update_message* traced =
+			    received ? trace_forward(m_ptr, received) : NULL;
+			broadcast_update(all_ifs, traced ? traced : m_ptr);
+		}
+
+	} else if (m_ptr->type == MADD) {
+		LOG_INFO("ADD update received.");
+		enum add_status ret = add_new_route(&new_route);
+		if (ret == SEXISTED) {
+			LOG_INFO("No new update.");
+		} else if (ret == SREFUSED) {
+			LOG_INFO("ADD refused. limit or memory budget reached.");
+		} else if (ret == SDROP) {
+			if (neighbor) {
+				drop_neighbor(all_ifs, neighbor);
+			}
+		} else if (ret == SSWITCHED) {
+			LOG_INFO("ADD finished. another path took over.");
+			announce_best(all_ifs, m_ptr->addr);
+		} else if (dampen_update(m_ptr, DAMP_ANNOUNCE, 2 * len_ifs(all_ifs))) {
+			LOG_INFO("ADD finished. prefix dampened, skip broadcast.");
+		} else {
+			LOG_INFO("ADD finished. start broadcast to peers");
+			m_ptr = add_aspath(m_ptr, speaker->host_id);
+			++(m_ptr->weight);
+			struct update_message* traced =
+			    received ? trace_forward(m_ptr, received) : NULL;
+			if (traced) {
+				free(m_ptr);
+				m_ptr = traced;
+			}
+			broadcast_update(all_ifs, m_ptr);
+			LOG_INFO("start new self broadcasting");
+			self_update(all_ifs);
+			free(m_ptr);
+		}
+	}
+
+	return 0;
+}
+
+int
+decision(struct ifaddrs* all_ifs,
+         struct ifaddrs* recv_if,
+         in_addr_t       sender,
+         char*           buffer,
+         int             len)
+{
+	u_int64_t start = metrics_now();
+	int       ret   = decide(all_ifs, recv_if, sender, buffer, len);
+	metrics_record(METRIC_DECISION_NS, metrics_now() - start);
+	metrics_inc(METRIC_DECISIONS);
+	return ret;
+}
+
+struct ifaddrs*
+find_recv_if(struct ifaddrs* all_ifs, struct sockaddr_in* addr)
+{
+	char addr_str[NI_MAXHOST];
+	if (get_addr_str((struct sockaddr*)addr, addr_str)) {
+		LOG_DEBUG("finding for address: %s", addr_str);
+	}
+	LOG_DEBUG("finding interface");
+
+	struct ifaddrs* current = all_ifs;
+
+	in_addr_t addr_in = addr->sin_addr.s_addr;
+
+	while (current) {
+		in_addr_t mask =
+		    ((struct sockaddr_in*)current->ifa_netmask)->sin_addr.s_addr;
+		in_addr_t addr_if =
+		    ((struct sockaddr_in*)current->ifa_addr)->sin_addr.s_addr;
+
+		if ((addr_in & mask) == (addr_if & mask)) {
+			LOG_DEBUG("interface found: %s", current->ifa_name);
+			return current;
+		}
+		current = current->ifa_next;
+	}
+	LOG_DEBUG("interface not found. skip.");
+	return NULL;
+}
+
+// everything but the interfaces, which the caller fills in afterwards.
+int
+protocol_init(u_int64_t now)
+{
+	LIST_INIT(&speaker->routing_table);
+	if (rib_init(&speaker->rib) || nexthop_table_init(&speaker->nexthops)) {
+		return -1;
+	}
+	LIST_INIT(&speaker->ifaces);
+	LIST_INIT(&speaker->neighbors);
+	timer_wheel_init(&speaker->timers, now);
+
+	timer_init(&speaker->keepalive_timer, send_keepalive, NULL);
+	timer_arm(&speaker->timers, &speaker->keepalive_timer, KEEPALIVE_INTERVAL);
+
+	if (speaker->route_max_age) {
+		timer_init(&speaker->refresh_timer, refresh_routes, NULL);
+		timer_arm(
+		    &speaker->timers, &speaker->refresh_timer, refresh_interval());
+	}
+
+	if (speaker->damp_enabled) {
+		struct damp_config config;
+		damp_default_config(&config, TIMER_TICK_MS);
+		if (damp_init(&speaker->dampening, &config, now)) {
+			return -1;
+		}
+		timer_init(&speaker->reuse_timer, process_reuse, NULL);
+		timer_arm(&speaker->timers, &speaker->reuse_timer, config.granularity);
+	}
+	return 0;
+}
+
+void
+protocol_free()
+{
+	free_routing_table();
+	nexthop_table_free(&speaker->nexthops);
+	free_neighbors();
+	timer_cancel(&speaker->timers, &speaker->keepalive_timer);
+	if (speaker->route_max_age) {
+		timer_cancel(&speaker->timers, &speaker->refresh_timer);
+	}
+	if (speaker->damp_enabled) {
+		timer_cancel(&speaker->timers, &speaker->reuse_timer);
+		damp_free(&speaker->dampening);
+	}
+}
@@ -0,0 +1,236 @@
+#ifndef BGP_PROTOCOL_H
+#define BGP_PROTOCOL_H
+
+#include "../damp/damp.h"
+#include "../fib/fib.h"
+#include "../iface/iface.h"
+#include "../io/io_backend.h"
+#include "../metrics/metrics.h"
+#include "../policy/policy.h"
+#include "../shm/shm_export.h"
+#include "../timer/timer_wheel.h"
+#include "../transport/stream.h"
+#include "rib.h"
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/queue.h>
+#include <sys/types.h>
+
+#define BROADCAST_PORT 5151
+
+#define TIMER_TICK_MS      100
+#define KEEPALIVE_INTERVAL 30  // ticks
+#define HOLD_TIME          90  // ticks
+#define DROP_TIME          600  // ticks a neighbor stays down after a limit
+#define REFRESHES_PER_AGE  3  // best path refreshes within route_max_age
+
+#ifndef LIST_FOREACH_SAFE
+#define LIST_FOREACH_SAFE(var, head, field, tvar)                              \
+	for ((var) = LIST_FIRST((head));                                           \
+	     (var) && ((tvar) = LIST_NEXT((var), field), 1);                       \
+	     (var) = (tvar))
+#endif
+
+struct update_message {
+	u_int32_t size;
+	u_int32_t path_len;
+	enum {
+		MADD = 0,
+		MWITHDRAW,
+		MKEEPALIVE,
+	} type;
+	in_addr_t addr;
+	in_addr_t gateway;
+	u_int32_t weight;
+	u_int64_t ASPATH[];
+};
+
+// a neighbor is whoever sends on the other end of an interface. it is kept up
+// by any valid message and goes down when nothing arrives for HOLD_TIME. a
+// neighbor dropped for its prefix limit is ignored for DROP_TIME.
+struct neighbor {
+	struct ifaddrs* if_addr;
+	int             up;
+	int             dropped;
+	int             warned;  // over its limit, logged once per crossing
+	struct timer    hold;
+	struct timer    restart;
+	LIST_ENTRY(neighbor) entries;
+};
+
+LIST_HEAD(neighbor_list, neighbor);
+
+LIST_HEAD(stream_peer_list, stream_peer);
+
+#define PREFIX_LIMITS_MAX 16
+
+// what happens to a new path beyond a prefix limit. LIMIT_WARN accepts it,
+// LIMIT_REJECT leaves it out and LIMIT_DROP brings the neighbor down, which
+// withdraws all its paths.
+enum limit_action {
+	LIMIT_WARN = 0,
+	LIMIT_REJECT,
+	LIMIT_DROP,
+};
+
+// max 0 is no limit.
+struct prefix_limit {
+	char              ifname[IF_NAMESIZE];  // empty for every neighbor
+	size_t            max;
+	enum limit_action action;
+};
+
+// SSWITCHED: the update made its path worse and another one took over.
+// SREFUSED: a limit or the memory budget left the new path out.
+// SDROP: a limit asks for the neighbor to be dropped.
+enum add_status {
+	SNEW = 0,
+	SEXISTED,
+	SSWITCHED,
+	SREFUSED,
+	SDROP,
+};
+
+// SFAILOVER: the best path went away and another one took over.
+enum withdraw_status {
+	SWITHDREW = 0,
+	SNO,
+	SFAILOVER,
+};
+
+// everything one protocol instance owns. the daemon runs a single one, the
+// simulator switches speaker between many of them.
+struct speaker {
+	u_int64_t host_id;
+
+	// every interface seen so far. filtered_ifap chains the ones that are up.
+	struct iface_list ifaces;
+	struct ifaddrs*   filtered_ifap;
+
+	struct io_backend* io_backend;
+
+	// ticks a learned route lives without being announced again. 0 keeps
+	// routes until they are withdrawn or their neighbor goes down.
+	u_int64_t route_max_age;
+
+	struct timer_wheel timers;
+	struct timer       keepalive_timer;
+	struct timer       reuse_timer;
+	struct timer       refresh_timer;  // armed with route_max_age only
+
+	int               damp_enabled;
+	struct damp_table dampening;
+
+	// import and export filters. NULL accepts and exports everything.
+	struct policy* policy;
+
+	// originated updates carry a trace when set. trace_clock supplies its
+	// timestamps and falls back to CLOCK_REALTIME when NULL.
+	int trace_enabled;
+	u_int64_t (*trace_clock)();
+
+	// every path learned from every neighbor. routing_table only holds the
+	// best path of each prefix.
+	struct rib           rib;
+	struct routing_list  routing_table;
+	struct nexthop_table nexthops;
+	struct neighbor_list neighbors;
+
+	// paths one neighbor may hold in the adj-rib-in. a limit for the
+	// interface of the neighbor wins over the one with an empty name.
+	struct prefix_limit neighbor_limits[PREFIX_LIMITS_MAX];
+	size_t              neighbor_limit_count;
+
+	// prefixes in the whole rib.
+	struct prefix_limit global_limit;
+	int                 global_warned;
+
+	// receives the next hops of every prefix whose best paths changed. NULL
+	// leaves the kernel alone.
+	struct fib* fib;
+
+	// mirrors the best route of every prefix for readers on this host. NULL
+	// exports nothing.
+	struct shm_export* shm;
+};
+
+// the instance all protocol functions act on. the daemon threads share it
+// and serialize access through the routing lock, apart from the stream
+// peers, which have their own lock.
+extern struct speaker* speaker;
+
+extern int                     stream_enabled;
+extern struct stream_peer_list stream_peers;
+extern pthread_mutex_t         stream_peers_lock;
+extern int                     stream_wakeup_fd;
+
+// host_id, io_backend and the configuration fields must be set before.
+int protocol_init(u_int64_t now);
+
+void protocol_free();
+
+struct update_message* make_message();
+
+void free_message(struct update_message* ptr);
+
+struct update_message* add_aspath(struct update_message* m_ptr,
+                                  u_int64_t              new_host_id);
+
+enum add_status add_new_route(struct routing_entry* new);
+
+int withdraw_route(struct routing_entry* withdraw);
+
+struct routing_entry* find_route(in_addr_t base);
+
+void log_routing_table();
+
+void free_routing_table();
+
+int get_addr_str(struct sockaddr* ifa_addr, char* str);
+
+unsigned int len_ifs(struct ifaddrs* ifs);
+
+struct ifaddrs* find_recv_if(struct ifaddrs* all_ifs, struct sockaddr_in* addr);
+
+void stream_wakeup();
+
+struct stream_peer* find_stream_peer(struct ifaddrs* ifap, in_addr_t addr);
+
+int stream_established(struct ifaddrs* ifap, in_addr_t addr);
+
+int send_from_ifs(struct io_send_req* reqs, int count);
+
+int broadcast_message_from_if(struct ifaddrs* ifap, char* msg, int len);
+
+int broadcast_update(struct ifaddrs* all_ifs, struct update_message* m_ptr);
+
+int self_update(struct ifaddrs* all_ifs);
+
+int broadcast_withdrawals(struct ifaddrs* all_ifs,
+                          in_addr_t*      bases,
+                          size_t          count);
+
+int withdraw_routes_from_if(struct ifaddrs* all_ifs, struct ifaddrs* ifap);
+
+void log_dampening_stats();
+
+void log_limits();
+
+int parse_prefix_limit(const char* arg, struct prefix_limit* limit);
+
+void free_neighbors();
+
+void iface_down(struct iface* iface);
+
+void iface_up(struct iface* iface);
+
+// sender is the address of the neighbor the update came from, the gateway of
+// the routes it announces.
+int decision(struct ifaddrs* all_ifs,
+             struct ifaddrs* recv_if,
+             in_addr_t       sender,
+             char*           buffer,
+             int             len);
+
+#endif  // BGP_PROTOCOL_H
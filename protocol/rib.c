@@ -0,0 +1,197 @@
+#include "rib.h"
+#include "../hash/hash.h"
+#include "../iface/iface.h"
+#include "../logger/logger.h"
+#include "../mem/mem_account.h"
+#include <stdlib.h>
+
+int
+rib_init(struct rib* rib)
+{
+	rib->bucket_count = RIB_HASH_INIT;
+	rib->buckets = calloc(rib->bucket_count, sizeof(struct rib_prefix_list));
+	if (!rib->buckets) {
+		LOG_ERROR("failed to allocate rib.");
+		return -1;
+	}
+	mem_charge(MEM_PREFIXES,
+	           rib->bucket_count * sizeof(struct rib_prefix_list));
+	for (size_t i = 0; i < rib->bucket_count; i++) {
+		LIST_INIT(&rib->buckets[i]);
+	}
+	rib->prefix_count = 0;
+	rib->path_count   = 0;
+	return 0;
+}
+
+// every path is unlinked from its prefix and handed to free_path.
+void
+rib_free(struct rib* rib, rib_path_handler free_path)
+{
+	struct rib_prefix*    prefix;
+	struct routing_entry* route;
+
+	for (size_t i = 0; i < rib->bucket_count; i++) {
+		while ((prefix = LIST_FIRST(&rib->buckets[i]))) {
+			while ((route = LIST_FIRST(&prefix->paths))) {
+				LIST_REMOVE(route, paths);
+				free_path(route);
+			}
+			LIST_REMOVE(prefix, hash_entries);
+			mem_uncharge(MEM_PREFIXES, sizeof(struct rib_prefix));
+			free(prefix);
+		}
+	}
+	if (rib->buckets) {
+		mem_uncharge(MEM_PREFIXES,
+		             rib->bucket_count * sizeof(struct rib_prefix_list));
+	}
+	free(rib->buckets);
+	rib->buckets      = NULL;
+	rib->bucket_count = 0;
+	rib->prefix_count = 0;
+	rib->path_count   = 0;
+}
+
+struct rib_prefix*
+rib_find(struct rib* rib, in_addr_t base)
+{
+	struct rib_prefix* current;
+	LIST_FOREACH (current,
+	              &rib->buckets[hash_addr(base, rib->bucket_count)],
+	              hash_entries) {
+		if (current->base == base) {
+			return current;
+		}
+	}
+	return NULL;
+}
+
+static void
+grow(struct rib* rib)
+{
+	size_t                  new_count = rib->bucket_count * 2;
+	struct rib_prefix_list* new_buckets =
+	    calloc(new_count, sizeof(struct rib_prefix_list));
+	if (!new_buckets) {
+		// lookups only get slower.
+		return;
+	}
+	for (size_t i = 0; i < new_count; i++) {
+		LIST_INIT(&new_buckets[i]);
+	}
+
+	struct rib_prefix* current;
+	for (size_t i = 0; i < rib->bucket_count; i++) {
+		while ((current = LIST_FIRST(&rib->buckets[i]))) {
+			LIST_REMOVE(current, hash_entries);
+			LIST_INSERT_HEAD(&new_buckets[hash_addr(current->base, new_count)],
+			                 current,
+			                 hash_entries);
+		}
+	}
+	mem_recharge(MEM_PREFIXES,
+	             rib->bucket_count * sizeof(struct rib_prefix_list),
+	             new_count * sizeof(struct rib_prefix_list));
+	free(rib->buckets);
+	rib->buckets      = new_buckets;
+	rib->bucket_count = new_count;
+}
+
+// returns the prefix of base, created without paths if it is new.
+struct rib_prefix*
+rib_insert(struct rib* rib, in_addr_t base)
+{
+	struct rib_prefix* prefix = rib_find(rib, base);
+	if (prefix) {
+		return prefix;
+	}
+
+	prefix = calloc(1, sizeof(struct rib_prefix));
+	if (!prefix) {
+		LOG_ERROR("failed to allocate prefix.");
+		return NULL;
+	}
+	mem_charge(MEM_PREFIXES, sizeof(struct rib_prefix));
+	prefix->base = base;
+	LIST_INIT(&prefix->paths);
+
+	if (rib->prefix_count >= rib->bucket_count * 2) {
+		grow(rib);
+	}
+	LIST_INSERT_HEAD(&rib->buckets[hash_addr(base, rib->bucket_count)],
+	                 prefix,
+	                 hash_entries);
+	++rib->prefix_count;
+	return prefix;
+}
+
+// the prefix must not have paths left.
+void
+rib_remove(struct rib* rib, struct rib_prefix* prefix)
+{
+	LIST_REMOVE(prefix, hash_entries);
+	--rib->prefix_count;
+	mem_uncharge(MEM_PREFIXES, sizeof(struct rib_prefix));
+	free(prefix);
+}
+
+struct routing_entry*
+rib_path_from(struct rib_prefix* prefix, struct ifaddrs* if_addr)
+{
+	struct routing_entry* current;
+	LIST_FOREACH (current, &prefix->paths, paths) {
+		if (current->if_addr == if_addr) {
+			return current;
+		}
+	}
+	return NULL;
+}
+
+void
+rib_add_path(struct rib*           rib,
+             struct rib_prefix*    prefix,
+             struct routing_entry* route)
+{
+	route->prefix = prefix;
+	LIST_INSERT_HEAD(&prefix->paths, route, paths);
+	++prefix->path_count;
+	++rib->path_count;
+}
+
+void
+rib_remove_path(struct rib* rib, struct routing_entry* route)
+{
+	LIST_REMOVE(route, paths);
+	--route->prefix->path_count;
+	--rib->path_count;
+	route->prefix = NULL;
+}
+
+// lower weight first, then the shorter ASPATH. the interface index breaks
+// ties so that every run picks the same path.
+int
+route_preferred(const struct routing_entry* a, const struct routing_entry* b)
+{
+	if (a->weight != b->weight) {
+		return a->weight < b->weight;
+	}
+	if (a->path_len != b->path_len) {
+		return a->path_len < b->path_len;
+	}
+	return iface_of(a->if_addr)->index < iface_of(b->if_addr)->index;
+}
+
+// only the candidates of the one prefix are looked at.
+struct routing_entry*
+rib_select(struct rib_prefix* prefix)
+{
+	struct routing_entry* best = NULL;
+	struct routing_entry* current;
+	LIST_FOREACH (current, &prefix->paths, paths) {
+		if (!best || route_preferred(current, best)) {
+			best = current;
+		}
+	}
+	return best;
+}
@@ -0,0 +1,88 @@
+#ifndef BGP_RIB_H
+#define BGP_RIB_H
+
+#include "../timer/timer_wheel.h"
+#include "nexthop.h"
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <sys/queue.h>
+#include <sys/types.h>
+
+#define RIB_HASH_INIT 64
+
+struct rib_prefix;
+
+// a path to base learned from the neighbor behind if_addr. the routes list of
+// every interface holds the paths learned through it, which makes up the
+// adj-rib-in of that neighbor. the best path of each prefix is also linked
+// into the routing table of the speaker.
+struct routing_entry {
+	u_int32_t       weight;
+	in_addr_t       mask;
+	in_addr_t       base;
+	in_addr_t       gateway;
+	struct ifaddrs* if_addr;
+	struct timer    expire;
+
+	// the ASPATH the path was announced with, so that it can be advertised
+	// again when it becomes the best path. owned by the entry once it is in
+	// the rib, borrowed from the update before.
+	u_int64_t* path;
+	u_int32_t  path_len;
+
+	struct rib_prefix* prefix;
+	LIST_ENTRY(routing_entry) entries;     // routing table, best paths only
+	LIST_ENTRY(routing_entry) if_entries;  // routes of the interface
+	LIST_ENTRY(routing_entry) paths;       // candidates of the prefix
+};
+
+LIST_HEAD(routing_list, routing_entry);
+
+// the group behind handle holds the next hops of every path as good as best.
+struct rib_prefix {
+	in_addr_t              base;
+	struct routing_entry*  best;
+	struct nexthop_handle* handle;
+	size_t                 path_count;
+	LIST_HEAD(, routing_entry) paths;
+	LIST_ENTRY(rib_prefix) hash_entries;
+};
+
+LIST_HEAD(rib_prefix_list, rib_prefix);
+
+// every prefix with at least one path, hashed by base.
+struct rib {
+	struct rib_prefix_list* buckets;
+	size_t                  bucket_count;
+	size_t                  prefix_count;
+	size_t                  path_count;
+};
+
+typedef void (*rib_path_handler)(struct routing_entry* route);
+
+int rib_init(struct rib* rib);
+
+void rib_free(struct rib* rib, rib_path_handler free_path);
+
+struct rib_prefix* rib_find(struct rib* rib, in_addr_t base);
+
+struct rib_prefix* rib_insert(struct rib* rib, in_addr_t base);
+
+void rib_remove(struct rib* rib, struct rib_prefix* prefix);
+
+struct routing_entry* rib_path_from(struct rib_prefix* prefix,
+                                    struct ifaddrs*    if_addr);
+
+void rib_add_path(struct rib*           rib,
+                  struct rib_prefix*    prefix,
+                  struct routing_entry* route);
+
+void rib_remove_path(struct rib* rib, struct routing_entry* route);
+
+int route_preferred(const struct routing_entry* a,
+                    const struct routing_entry* b);
+
+struct routing_entry* rib_select(struct rib_prefix* prefix);
+
+#endif  // BGP_RIB_H
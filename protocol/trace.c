@@ -0,0 +1,129 @@
+#include "trace.h"
+#include "../logger/logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+u_int64_t
+trace_now()
+{
+	if (speaker->trace_clock) {
+		return speaker->trace_clock();
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static u_int64_t
+path_end(struct update_message* m_ptr)
+{
+	return sizeof(struct update_message) +
+	       (u_int64_t)m_ptr->path_len * sizeof(u_int64_t);
+}
+
+// returns the trace of the update, or NULL when it has none or it does not
+// fit in the message.
+struct update_trace*
+update_trace(struct update_message* m_ptr)
+{
+	u_int64_t offset = path_end(m_ptr);
+	if (offset + sizeof(struct update_trace) > m_ptr->size) {
+		return NULL;
+	}
+
+	struct update_trace* trace =
+	    (struct update_trace*)((char*)m_ptr + offset);
+	if (trace->magic != UPDATE_TRACE_MAGIC ||
+	    offset + sizeof(struct update_trace) +
+	            (u_int64_t)trace->hop_count * sizeof(struct update_trace_hop) >
+	        m_ptr->size) {
+		return NULL;
+	}
+	return trace;
+}
+
+// returns a copy of the update with an empty trace stamped now.
+struct update_message*
+trace_originate(struct update_message* m_ptr)
+{
+	u_int64_t              offset = path_end(m_ptr);
+	struct update_message* new =
+	    malloc(offset + sizeof(struct update_trace));
+	if (!new) {
+		LOG_ERROR("failed to allocate traced update.");
+		return NULL;
+	}
+	memcpy(new, m_ptr, offset);
+	new->size = offset + sizeof(struct update_trace);
+
+	struct update_trace* trace = (struct update_trace*)((char*)new + offset);
+	trace->magic               = UPDATE_TRACE_MAGIC;
+	trace->hop_count           = 0;
+	trace->origin              = trace_now();
+	return new;
+}
+
+// records how long the update took from its origin and over the last hop.
+// the last hop includes the wire, the receive queue and the wait for the
+// routing lock on this node.
+void
+trace_received(struct update_message* m_ptr, u_int64_t received)
+{
+	struct update_trace* trace = update_trace(m_ptr);
+	if (!trace) {
+		return;
+	}
+
+	u_int64_t last = trace->origin;
+	if (trace->hop_count) {
+		last = trace->hops[trace->hop_count - 1].sent;
+	}
+	// clocks of different nodes may disagree. skip what went backwards.
+	if (received >= trace->origin) {
+		metrics_record(METRIC_TRACE_PROPAGATION_NS, received - trace->origin);
+	}
+	if (received >= last) {
+		metrics_record(METRIC_TRACE_HOP_NS, received - last);
+	}
+	LOG_DEBUG("traced update. hops: %u, since origin: %ld ns, last hop: %ld ns",
+	          trace->hop_count,
+	          (int64_t)(received - trace->origin),
+	          (int64_t)(received - last));
+}
+
+// returns a copy of the update with this node appended to its trace, or NULL
+// when the update has no trace. a trace that would push the update over
+// MAX_MESSAGE_SIZE is forwarded without the new hop.
+struct update_message*
+trace_forward(struct update_message* m_ptr, u_int64_t received)
+{
+	struct update_trace* trace = update_trace(m_ptr);
+	if (!trace) {
+		return NULL;
+	}
+
+	u_int32_t size = m_ptr->size;
+	if (size + sizeof(struct update_trace_hop) <= MAX_MESSAGE_SIZE) {
+		size += sizeof(struct update_trace_hop);
+	}
+	struct update_message* new = malloc(size);
+	if (!new) {
+		LOG_ERROR("failed to allocate traced update.");
+		return NULL;
+	}
+	memcpy(new, m_ptr, m_ptr->size);
+	if (size == m_ptr->size) {
+		return new;
+	}
+
+	trace = update_trace(new);
+	struct update_trace_hop* hop = &trace->hops[trace->hop_count];
+	hop->host_id                 = speaker->host_id;
+	hop->received                = received;
+	hop->sent                    = trace_now();
+	++trace->hop_count;
+	new->size = size;
+	metrics_record(METRIC_TRACE_LOCAL_NS, hop->sent - received);
+	return new;
+}
@@ -0,0 +1,38 @@
+#ifndef BGP_TRACE_H
+#define BGP_TRACE_H
+
+#include "protocol.h"
+#include <sys/types.h>
+
+// an update may carry a trace after its ASPATH, inside size. receivers that
+// do not know it only read path_len entries and ignore the rest. the
+// originator stamps origin, every node forwarding the update appends a hop.
+// timestamps are nanoseconds of speaker->trace_clock, which has to be
+// synchronized between nodes for propagation times to make sense.
+#define UPDATE_TRACE_MAGIC 0x54524345  // "TRCE"
+
+struct update_trace_hop {
+	u_int64_t host_id;
+	u_int64_t received;  // the update entered decision()
+	u_int64_t sent;      // the forwarded copy was handed to the senders
+};
+
+struct update_trace {
+	u_int32_t               magic;
+	u_int32_t               hop_count;
+	u_int64_t               origin;
+	struct update_trace_hop hops[];
+};
+
+u_int64_t trace_now();
+
+struct update_trace* update_trace(struct update_message* m_ptr);
+
+struct update_message* trace_originate(struct update_message* m_ptr);
+
+void trace_received(struct update_message* m_ptr, u_int64_t received);
+
+struct update_message* trace_forward(struct update_message* m_ptr,
+                                     u_int64_t              received);
+
+#endif  // BGP_TRACE_H
@@ -0,0 +1,267 @@
+// feeds a journal recorded with `test-client -r` back through decision(). the
+// interfaces come from the journal and the null io backend swallows every
+// send. timers follow the recorded timestamps instead of the wall clock, so
+// a replay takes the same decisions whether it runs at recorded pace or as
+// fast as possible. prints one line of key=value pairs.
+//
+// usage: journal-replay [-p] [-P policy] journal
+
+#include "../journal/journal.h"
+#include "../logger/logger.h"
+#include "../protocol/protocol.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+struct replay_stats {
+	u_int64_t  records;
+	u_int64_t  ifaces;
+	u_int64_t  updates;
+	u_int64_t  skipped;
+	u_int64_t* latencies;  // ns per update
+	size_t     capacity;
+	int        truncated;
+};
+
+static u_int64_t
+now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+sleep_until(u_int64_t deadline)
+{
+	struct timespec ts = {
+	    .tv_sec  = deadline / 1000000000,
+	    .tv_nsec = deadline % 1000000000,
+	};
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR) {
+	}
+}
+
+// keeps the journal order, so broadcasts walk the interfaces like they did in
+// the recording daemon.
+static void
+replay_iface(struct journal_entry* entry)
+{
+	struct iface* iface = find_iface(&speaker->ifaces, entry->index);
+	if (iface) {
+		iface_set_addr(iface, entry->addr, entry->netmask, entry->broadaddr);
+		return;
+	}
+
+	iface = make_iface(entry->name,
+	                   entry->index,
+	                   entry->flags,
+	                   entry->addr,
+	                   entry->netmask,
+	                   entry->broadaddr);
+	if (!iface) {
+		return;
+	}
+	struct iface* last = LIST_FIRST(&speaker->ifaces);
+	if (!last) {
+		LIST_INSERT_HEAD(&speaker->ifaces, iface, entries);
+	} else {
+		while (LIST_NEXT(last, entries)) {
+			last = LIST_NEXT(last, entries);
+		}
+		LIST_INSERT_AFTER(last, iface, entries);
+	}
+	speaker->filtered_ifap = link_ifaces(&speaker->ifaces);
+}
+
+static int
+push_latency(struct replay_stats* stats, u_int64_t latency)
+{
+	if (stats->updates == stats->capacity) {
+		size_t     capacity = stats->capacity ? stats->capacity * 2 : 4096;
+		u_int64_t* new =
+		    reallocarray(stats->latencies, capacity, sizeof(u_int64_t));
+		if (!new) {
+			LOG_ERROR("failed to allocate latencies.");
+			return -1;
+		}
+		stats->latencies = new;
+		stats->capacity  = capacity;
+	}
+	stats->latencies[stats->updates++] = latency;
+	return 0;
+}
+
+static int
+replay(struct journal_reader* reader, int paced, struct replay_stats* stats)
+{
+	u_int64_t            tick_ns = reader->header.tick_ms * 1000000ull;
+	u_int64_t            start   = now_ns();
+	struct journal_entry entry;
+	int                  ret;
+
+	while ((ret = journal_next(reader, &entry)) > 0) {
+		++stats->records;
+		if (entry.type == JOURNAL_IFACE) {
+			++stats->ifaces;
+			replay_iface(&entry);
+			continue;
+		}
+
+		if (paced) {
+			sleep_until(start + entry.time);
+		}
+		timer_wheel_advance(&speaker->timers, entry.time / tick_ns);
+
+		struct iface* recv_if = find_iface(&speaker->ifaces, entry.index);
+		if (!recv_if || !recv_if->up) {
+			++stats->skipped;
+			continue;
+		}
+		u_int64_t begin = now_ns();
+		decision(speaker->filtered_ifap,
+		         &recv_if->ifa,
+		         entry.sender,
+		         entry.data,
+		         entry.len);
+		if (push_latency(stats, now_ns() - begin)) {
+			return -1;
+		}
+	}
+	stats->truncated = ret < 0;
+	return 0;
+}
+
+static int
+cmp_latency(const void* a, const void* b)
+{
+	u_int64_t x = *(const u_int64_t*)a;
+	u_int64_t y = *(const u_int64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static u_int64_t
+percentile(struct replay_stats* stats, double p)
+{
+	if (!stats->updates) {
+		return 0;
+	}
+	return stats->latencies[(size_t)(p * (stats->updates - 1))];
+}
+
+static size_t
+count_routes()
+{
+	size_t                routes = 0;
+	struct routing_entry* current;
+	LIST_FOREACH (current, &speaker->routing_table, entries) {
+		++routes;
+	}
+	return routes;
+}
+
+static long
+peak_rss_kb()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+static void
+print_usage(const char* name)
+{
+	printf("usage: %s [-p] [-P policy] journal\n", name);
+	printf("\t-p\treplay at recorded pace instead of as fast as possible\n");
+	printf("\t-P\tapply import and export policies from a file\n");
+}
+
+int
+main(int argc, char** argv)
+{
+	int paced = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "pP:h")) != -1) {
+		if (opt == 'p') {
+			paced = 1;
+		} else if (opt == 'P') {
+			policy_free(speaker->policy);
+			speaker->policy = policy_load(optarg);
+			if (!speaker->policy) {
+				return 1;
+			}
+		} else {
+			print_usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc - 1) {
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	set_log_level(LERROR);
+	struct journal_reader* reader = journal_open(argv[optind]);
+	if (!reader) {
+		return 1;
+	}
+	if (reader->header.tick_ms != TIMER_TICK_MS) {
+		LOG_WARN("journal ticks are %u ms, this build ticks every %d ms.",
+		         reader->header.tick_ms,
+		         TIMER_TICK_MS);
+	}
+
+	speaker->host_id       = reader->header.host_id;
+	speaker->route_max_age = reader->header.route_max_age;
+	speaker->damp_enabled  = reader->header.damp_enabled;
+	speaker->io_backend    = make_null_backend();
+	if (!speaker->io_backend || protocol_init(0)) {
+		journal_reader_close(reader);
+		return 1;
+	}
+
+	struct replay_stats stats = {0};
+	u_int64_t           start = now_ns();
+	int                 ret   = replay(reader, paced, &stats);
+	u_int64_t           wall  = now_ns() - start;
+
+	u_int64_t total = 0;
+	for (size_t i = 0; i < stats.updates; i++) {
+		total += stats.latencies[i];
+	}
+	qsort(stats.latencies, stats.updates, sizeof(u_int64_t), cmp_latency);
+
+	struct null_backend_stats* sent = speaker->io_backend->priv;
+	printf("journal=%s mode=%s records=%lu ifaces=%lu updates=%lu "
+	       "skipped=%lu truncated=%d seconds=%.3f updates_per_sec=%.0f "
+	       "p50_ns=%lu p99_ns=%lu routes=%zu messages_sent=%lu "
+	       "wall_seconds=%.3f peak_rss_kb=%ld\n",
+	       argv[optind],
+	       paced ? "paced" : "fast",
+	       stats.records,
+	       stats.ifaces,
+	       stats.updates,
+	       stats.skipped,
+	       stats.truncated,
+	       total / 1e9,
+	       total ? stats.updates / (total / 1e9) : 0,
+	       percentile(&stats, 0.50),
+	       percentile(&stats, 0.99),
+	       count_routes(),
+	       sent->messages,
+	       wall / 1e9,
+	       peak_rss_kb());
+
+	protocol_free();
+	policy_free(speaker->policy);
+	free_ifaces(&speaker->ifaces);
+	close_io_backend(speaker->io_backend);
+	journal_reader_close(reader);
+	free(stats.latencies);
+	return ret ? 1 : 0;
+}
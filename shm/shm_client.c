@@ -0,0 +1,228 @@
+#include "shm_client.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// a writer holds the seqlock for a single route, or for a rebuild of the
+// table. readers spin for a while and then give up their time slice.
+#define SHM_RIB_SPINS       1024
+#define SHM_RIB_READ_ROUNDS (1 << 20)
+
+// the header is complete once the magic is there.
+static int
+valid_layout(const struct shm_rib_header* header, size_t size)
+{
+	if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHM_RIB_MAGIC ||
+	    header->version != SHM_RIB_VERSION ||
+	    header->key_size != sizeof(struct shm_rib_key) ||
+	    header->entry_size != sizeof(struct shm_rib_entry)) {
+		return 0;
+	}
+	size_t capacity = header->capacity;
+	return capacity && !(capacity & (capacity - 1)) &&
+	       header->keys_offset >= sizeof(struct shm_rib_header) &&
+	       header->keys_offset + capacity * sizeof(struct shm_rib_key) <=
+	           header->routes_offset &&
+	       header->routes_offset + capacity * sizeof(struct shm_rib_entry) <=
+	           size;
+}
+
+struct shm_rib_reader*
+shm_rib_open(const char* name)
+{
+	int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+	if ((size_t)st.st_size < SHM_RIB_HEADER_SIZE) {
+		close(fd);
+		errno = EPROTO;
+		return NULL;
+	}
+	void* region = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (region == MAP_FAILED) {
+		return NULL;
+	}
+
+	const struct shm_rib_header* header = region;
+	if (!valid_layout(header, st.st_size)) {
+		munmap(region, st.st_size);
+		errno = EPROTO;
+		return NULL;
+	}
+
+	struct shm_rib_reader* reader = calloc(1, sizeof(struct shm_rib_reader));
+	if (!reader) {
+		munmap(region, st.st_size);
+		return NULL;
+	}
+	reader->size     = st.st_size;
+	reader->header   = header;
+	reader->keys     = (const void*)((const char*)region + header->keys_offset);
+	reader->routes = (const void*)((const char*)region + header->routes_offset);
+	reader->capacity = header->capacity;
+	return reader;
+}
+
+void
+shm_rib_close(struct shm_rib_reader* reader)
+{
+	if (!reader) {
+		return;
+	}
+	munmap((void*)reader->header, reader->size);
+	free(reader);
+}
+
+static int
+read_begin(const struct shm_rib_header* header, u_int64_t* seq)
+{
+	for (u_int32_t round = 0; round < SHM_RIB_READ_ROUNDS; round++) {
+		if (__atomic_load_n(&header->closed, __ATOMIC_ACQUIRE)) {
+			errno = ESHUTDOWN;
+			return -1;
+		}
+		*seq = __atomic_load_n(&header->seq, __ATOMIC_ACQUIRE);
+		if (!(*seq & 1)) {
+			return 0;
+		}
+		if (round >= SHM_RIB_SPINS) {
+			sched_yield();
+		}
+	}
+	errno = EAGAIN;
+	return -1;
+}
+
+// whatever was copied since read_begin() is only valid when this fails.
+static int
+read_retry(const struct shm_rib_header* header, u_int64_t seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&header->seq, __ATOMIC_RELAXED) != seq;
+}
+
+// the same probe sequence as the writer's. returns the index of base/len or
+// -1. a torn read may lead it astray, but never beyond the table, and the
+// seqlock throws its result away.
+static long
+probe(struct shm_rib_reader* reader, in_addr_t base, u_int8_t len)
+{
+	u_int32_t capacity = reader->capacity;
+	size_t    i        = hash_addr(base, capacity);
+
+	for (u_int32_t n = 0; n < capacity; n++, i = (i + 1) & (capacity - 1)) {
+		struct shm_rib_key key = reader->keys[i];
+		if (key.state == SHM_RIB_FREE) {
+			return -1;
+		}
+		if (key.state == SHM_RIB_USED && key.base == base) {
+			return key.len == len ? (long)i : -1;
+		}
+	}
+	return -1;
+}
+
+static in_addr_t
+netmask(u_int8_t len)
+{
+	return htonl(len ? ~0u << (32 - len) : 0);
+}
+
+int
+shm_rib_lookup(struct shm_rib_reader* reader,
+               in_addr_t              addr,
+               struct shm_rib_entry*  entry)
+{
+	u_int64_t seq;
+	int       found;
+
+	do {
+		if (read_begin(reader->header, &seq)) {
+			return -1;
+		}
+		found          = 0;
+		u_int64_t lens = reader->header->lens;
+		while (lens && !found) {
+			u_int8_t len = 63 - __builtin_clzll(lens);
+			lens &= ~(1ull << len);
+			if (len > 32) {
+				continue;
+			}
+			long i = probe(reader, addr & netmask(len), len);
+			if (i >= 0) {
+				memcpy(entry, &reader->routes[i], sizeof(struct shm_rib_entry));
+				found = 1;
+			}
+		}
+	} while (read_retry(reader->header, seq));
+	return found;
+}
+
+int
+shm_rib_find(struct shm_rib_reader* reader,
+             in_addr_t              base,
+             u_int8_t               len,
+             struct shm_rib_entry*  entry)
+{
+	u_int64_t seq;
+	int       found;
+
+	do {
+		if (read_begin(reader->header, &seq)) {
+			return -1;
+		}
+		long i = probe(reader, base, len);
+		found  = i >= 0;
+		if (found) {
+			memcpy(entry, &reader->routes[i], sizeof(struct shm_rib_entry));
+		}
+	} while (read_retry(reader->header, seq));
+	return found;
+}
+
+ssize_t
+shm_rib_dump(struct shm_rib_reader* reader,
+             struct shm_rib_entry*  entries,
+             size_t                 max)
+{
+	u_int64_t seq;
+	size_t    count;
+
+	do {
+		if (read_begin(reader->header, &seq)) {
+			return -1;
+		}
+		count = 0;
+		for (u_int32_t i = 0; i < reader->capacity; i++) {
+			if (reader->keys[i].state != SHM_RIB_USED) {
+				continue;
+			}
+			if (count < max) {
+				memcpy(&entries[count],
+				       &reader->routes[i],
+				       sizeof(struct shm_rib_entry));
+			}
+			++count;
+		}
+	} while (read_retry(reader->header, seq));
+	return count;
+}
+
+u_int64_t
+shm_rib_changes(struct shm_rib_reader* reader)
+{
+	return __atomic_load_n(&reader->header->changes, __ATOMIC_RELAXED);
+}
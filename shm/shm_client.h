@@ -0,0 +1,49 @@
+#ifndef BGP_SHM_CLIENT_H
+#define BGP_SHM_CLIENT_H
+
+#include "shm_rib.h"
+#include <sys/types.h>
+
+// reads the routes a daemon started with -e exports. the region is mapped
+// read-only once, lookups neither enter the kernel nor take a lock. they copy
+// the route out and retry while the daemon changed the table under them.
+//
+// functions that fail return -1 and set errno: ESHUTDOWN when the daemon went
+// away, after which the reader has to be opened again, and EAGAIN when the
+// daemon stopped in the middle of a change.
+struct shm_rib_reader {
+	size_t                       size;
+	const struct shm_rib_header* header;
+	const struct shm_rib_key*    keys;
+	const struct shm_rib_entry*  routes;
+	u_int32_t                    capacity;
+};
+
+// fails with ENOENT while no daemon exports under name and with EPROTO when
+// the region has another layout.
+struct shm_rib_reader* shm_rib_open(const char* name);
+
+void shm_rib_close(struct shm_rib_reader* reader);
+
+// finds the route with the longest prefix that covers addr. returns 1 and
+// fills entry when there is one, 0 otherwise.
+int shm_rib_lookup(struct shm_rib_reader* reader,
+                   in_addr_t              addr,
+                   struct shm_rib_entry*  entry);
+
+// finds the route of exactly base/len.
+int shm_rib_find(struct shm_rib_reader* reader,
+                 in_addr_t              base,
+                 u_int8_t               len,
+                 struct shm_rib_entry*  entry);
+
+// copies up to max routes of one consistent table into entries and returns
+// how many routes there are.
+ssize_t shm_rib_dump(struct shm_rib_reader* reader,
+                     struct shm_rib_entry*  entries,
+                     size_t                 max);
+
+// grows with every change of the table. polling it is cheaper than a dump.
+u_int64_t shm_rib_changes(struct shm_rib_reader* reader);
+
+#endif  // BGP_SHM_CLIENT_H
@@ -0,0 +1,307 @@
+#include "shm_export.h"
+#include "../logger/logger.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// readers that see an odd seq, or another seq after reading, retry. the
+// fence keeps the slot stores from overtaking the odd seq.
+static void
+write_begin(struct shm_rib_header* header)
+{
+	__atomic_store_n(&header->seq, header->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+write_end(struct shm_rib_header* header)
+{
+	__atomic_store_n(&header->changes, header->changes + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&header->seq, header->seq + 1, __ATOMIC_RELEASE);
+}
+
+// returns the index of base or -1. empty is set to the first index a new
+// route of base could take.
+static long
+find_key(struct shm_export* shm, in_addr_t base, long* empty)
+{
+	u_int32_t capacity = shm->header->capacity;
+	size_t    i        = hash_addr(base, capacity);
+
+	*empty = -1;
+	for (u_int32_t n = 0; n < capacity; n++, i = (i + 1) & (capacity - 1)) {
+		struct shm_rib_key* key = &shm->keys[i];
+		if (key->state == SHM_RIB_USED) {
+			if (key->base == base) {
+				return i;
+			}
+			continue;
+		}
+		if (*empty < 0) {
+			*empty = i;
+		}
+		if (key->state == SHM_RIB_FREE) {
+			break;
+		}
+	}
+	return -1;
+}
+
+static void
+count_len(struct shm_rib_header* header, u_int8_t len, int n)
+{
+	header->len_count[len] += n;
+	if (header->len_count[len]) {
+		header->lens |= 1ull << len;
+	} else {
+		header->lens &= ~(1ull << len);
+	}
+}
+
+static int
+same_route(const struct shm_rib_entry* route,
+           u_int8_t                    len,
+           u_int32_t                   weight,
+           u_int32_t                   path_len,
+           const struct shm_rib_hop*   hops,
+           u_int32_t                   count)
+{
+	return route->len == len && route->weight == weight &&
+	       route->path_len == path_len && route->hop_count == count &&
+	       !memcmp(route->hops, hops, count * sizeof(struct shm_rib_hop));
+}
+
+static void
+fill(struct shm_export*        shm,
+     long                      i,
+     in_addr_t                 base,
+     u_int8_t                  len,
+     u_int32_t                 weight,
+     u_int32_t                 path_len,
+     const struct shm_rib_hop* hops,
+     u_int32_t                 count)
+{
+	struct shm_rib_entry* route = &shm->routes[i];
+	route->base                 = base;
+	route->len                  = len;
+	route->hop_count            = count;
+	route->weight               = weight;
+	route->path_len             = path_len;
+	memcpy(route->hops, hops, count * sizeof(struct shm_rib_hop));
+	memset(route->hops + count,
+	       0,
+	       (SHM_RIB_HOPS_MAX - count) * sizeof(struct shm_rib_hop));
+	shm->keys[i] = (struct shm_rib_key){base, len, SHM_RIB_USED, 0};
+}
+
+// drops the tombstones. readers wait for the whole rebuild, which happens
+// once per capacity / 8 removals at most.
+static void
+rebuild(struct shm_export* shm)
+{
+	struct shm_rib_header* header   = shm->header;
+	u_int32_t              capacity = header->capacity;
+	struct shm_rib_entry*  routes =
+	    malloc(header->count * sizeof(struct shm_rib_entry));
+	if (header->count && !routes) {
+		LOG_ERROR("failed to allocate shared rib rebuild.");
+		return;
+	}
+
+	u_int32_t count = 0;
+	for (u_int32_t i = 0; i < capacity; i++) {
+		if (shm->keys[i].state == SHM_RIB_USED) {
+			routes[count++] = shm->routes[i];
+		}
+	}
+
+	write_begin(header);
+	memset(shm->keys, 0, capacity * sizeof(struct shm_rib_key));
+	for (u_int32_t n = 0; n < count; n++) {
+		size_t i = hash_addr(routes[n].base, capacity);
+		while (shm->keys[i].state != SHM_RIB_FREE) {
+			i = (i + 1) & (capacity - 1);
+		}
+		shm->routes[i]     = routes[n];
+		shm->keys[i].base  = routes[n].base;
+		shm->keys[i].len   = routes[n].len;
+		shm->keys[i].state = SHM_RIB_USED;
+	}
+	header->tombstones = 0;
+	write_end(header);
+	free(routes);
+}
+
+void
+shm_export_update(struct shm_export*        shm,
+                  in_addr_t                 base,
+                  u_int8_t                  len,
+                  u_int32_t                 weight,
+                  u_int32_t                 path_len,
+                  const struct shm_rib_hop* hops,
+                  u_int32_t                 count)
+{
+	struct shm_rib_header* header = shm->header;
+	long                   empty;
+	long                   i = find_key(shm, base, &empty);
+
+	if (count > SHM_RIB_HOPS_MAX) {
+		count = SHM_RIB_HOPS_MAX;
+	}
+
+	if (!count) {
+		if (i < 0) {
+			return;
+		}
+		write_begin(header);
+		count_len(header, shm->keys[i].len, -1);
+		shm->keys[i].state = SHM_RIB_DELETED;
+		--header->count;
+		++header->tombstones;
+		write_end(header);
+		return;
+	}
+
+	if (i >= 0) {
+		if (same_route(&shm->routes[i], len, weight, path_len, hops, count)) {
+			return;
+		}
+		write_begin(header);
+		count_len(header, shm->keys[i].len, -1);
+		fill(shm, i, base, len, weight, path_len, hops, count);
+		count_len(header, len, 1);
+		write_end(header);
+		return;
+	}
+
+	if (header->count >= shm->max_routes) {
+		if (!header->overflow++) {
+			LOG_WARN("shared rib %s is full, routes are left out.",
+			         shm->name);
+		}
+		return;
+	}
+	if (header->count + header->tombstones >= header->capacity / 4 * 3) {
+		rebuild(shm);
+		find_key(shm, base, &empty);
+	}
+
+	write_begin(header);
+	if (shm->keys[empty].state == SHM_RIB_DELETED) {
+		--header->tombstones;
+	}
+	fill(shm, empty, base, len, weight, path_len, hops, count);
+	count_len(header, len, 1);
+	++header->count;
+	write_end(header);
+}
+
+// readers of a region left behind by a daemon that did not shut down would
+// never learn that it is gone.
+static void
+close_stale(const char* name)
+{
+	int fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+	if (fd < 0) {
+		return;
+	}
+	struct shm_rib_header* header = mmap(NULL,
+	                                     sizeof(struct shm_rib_header),
+	                                     PROT_READ | PROT_WRITE,
+	                                     MAP_SHARED,
+	                                     fd,
+	                                     0);
+	close(fd);
+	if (header != MAP_FAILED) {
+		if (header->magic == SHM_RIB_MAGIC) {
+			__atomic_store_n(&header->closed, 1, __ATOMIC_RELEASE);
+		}
+		munmap(header, sizeof(struct shm_rib_header));
+	}
+	shm_unlink(name);
+}
+
+// a fresh object is zeroed, every slot starts out free.
+static void*
+map_region(const char* name, size_t size)
+{
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		LOG_ERROR("failed to create shared rib %s. errno: %d", name, errno);
+		return NULL;
+	}
+	if (ftruncate(fd, size) < 0) {
+		LOG_ERROR("failed to size shared rib %s. errno: %d", name, errno);
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+	void* region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (region == MAP_FAILED) {
+		LOG_ERROR("failed to map shared rib %s. errno: %d", name, errno);
+		shm_unlink(name);
+		return NULL;
+	}
+	return region;
+}
+
+struct shm_export*
+shm_export_create(const char* name, u_int32_t capacity, u_int64_t host_id)
+{
+	u_int32_t slots = SHM_EXPORT_MIN;
+	while (slots < capacity) {
+		slots <<= 1;
+	}
+
+	struct shm_export* shm = calloc(1, sizeof(struct shm_export));
+	if (!shm || !(shm->name = strdup(name))) {
+		LOG_ERROR("failed to allocate shared rib.");
+		free(shm);
+		return NULL;
+	}
+	size_t keys_size = (size_t)slots * sizeof(struct shm_rib_key);
+	shm->size        = SHM_RIB_HEADER_SIZE + keys_size +
+	            (size_t)slots * sizeof(struct shm_rib_entry);
+	shm->max_routes = slots / 8 * 5;
+
+	close_stale(name);
+	void* region = map_region(name, shm->size);
+	if (!region) {
+		free(shm->name);
+		free(shm);
+		return NULL;
+	}
+
+	// the magic goes last, readers that see it see the rest of the header.
+	struct shm_rib_header* header = region;
+	header->version               = SHM_RIB_VERSION;
+	header->key_size              = sizeof(struct shm_rib_key);
+	header->entry_size            = sizeof(struct shm_rib_entry);
+	header->capacity              = slots;
+	header->keys_offset           = SHM_RIB_HEADER_SIZE;
+	header->routes_offset         = SHM_RIB_HEADER_SIZE + keys_size;
+	header->host_id               = host_id;
+	header->writer_pid            = getpid();
+	shm->header                   = header;
+	shm->keys   = (void*)((char*)region + header->keys_offset);
+	shm->routes = (void*)((char*)region + header->routes_offset);
+	__atomic_store_n(&header->magic, SHM_RIB_MAGIC, __ATOMIC_RELEASE);
+	return shm;
+}
+
+void
+shm_export_close(struct shm_export* shm)
+{
+	if (!shm) {
+		return;
+	}
+	__atomic_store_n(&shm->header->closed, 1, __ATOMIC_RELEASE);
+	munmap(shm->header, shm->size);
+	shm_unlink(shm->name);
+	free(shm->name);
+	free(shm);
+}
@@ -0,0 +1,41 @@
+#ifndef BGP_SHM_EXPORT_H
+#define BGP_SHM_EXPORT_H
+
+#include "shm_rib.h"
+
+// slots of the exported table. 5/8 of them can hold routes, the rest keeps
+// probe sequences short and leaves room for removed routes until the table
+// is rebuilt at 3/4.
+#define SHM_EXPORT_CAPACITY (1 << 17)
+#define SHM_EXPORT_MIN      64
+
+struct shm_export {
+	char*                  name;
+	size_t                 size;
+	struct shm_rib_header* header;
+	struct shm_rib_key*    keys;
+	struct shm_rib_entry*  routes;
+	u_int32_t              max_routes;
+};
+
+// creates the named POSIX shared memory object, replacing one a previous
+// daemon left behind. capacity is rounded up to a power of two.
+struct shm_export* shm_export_create(const char* name,
+                                     u_int32_t   capacity,
+                                     u_int64_t   host_id);
+
+// mirrors the best route of the prefix at base. a route without hops is
+// removed. unchanged routes leave the seqlock alone, so readers do not retry
+// for nothing.
+void shm_export_update(struct shm_export*        shm,
+                       in_addr_t                 base,
+                       u_int8_t                  len,
+                       u_int32_t                 weight,
+                       u_int32_t                 path_len,
+                       const struct shm_rib_hop* hops,
+                       u_int32_t                 count);
+
+// marks the region closed for its readers and removes its name.
+void shm_export_close(struct shm_export* shm);
+
+#endif  // BGP_SHM_EXPORT_H
@@ -0,0 +1,84 @@
+#ifndef BGP_SHM_RIB_H
+#define BGP_SHM_RIB_H
+
+#include "../hash/hash.h"
+#include <netinet/in.h>
+#include <sys/types.h>
+
+// the layout of the shared memory region the daemon mirrors its best routes
+// into. it is shared by the writer and the reader library and must not
+// depend on anything else of the daemon but the header only hash.
+//
+// the region starts with a header, capacity keys follow at keys_offset and
+// as many routes at routes_offset. the keys form an open addressing table
+// keyed by the prefix base, probed linearly from hash_addr() of the base.
+// the route of a key has the same index. probes only walk the small keys,
+// which stay in the cache, and touch a single route.
+//
+// a single writer changes the table inside a seqlock: seq is odd while a
+// change is under way and a reader retries whenever it saw an odd or changed
+// seq. addresses are in network order.
+#define SHM_RIB_MAGIC       0x42475052  // "BGPR"
+#define SHM_RIB_VERSION     1
+#define SHM_RIB_HOPS_MAX    16
+#define SHM_RIB_HEADER_SIZE 4096
+
+enum shm_rib_slot_state {
+	SHM_RIB_FREE = 0,
+	SHM_RIB_USED,
+	SHM_RIB_DELETED,  // keeps probe sequences running past removed routes
+};
+
+struct shm_rib_hop {
+	in_addr_t gateway;  // 0 for a route over the interface itself
+	int32_t   ifindex;
+};
+
+struct shm_rib_key {
+	in_addr_t base;
+	u_int8_t  len;
+	u_int8_t  state;
+	u_int16_t reserved;
+};
+
+// the best route of a prefix and every hop of its multipath group.
+struct shm_rib_entry {
+	in_addr_t          base;
+	u_int8_t           len;
+	u_int8_t           hop_count;
+	u_int16_t          reserved;
+	u_int32_t          weight;
+	u_int32_t          path_len;
+	struct shm_rib_hop hops[SHM_RIB_HOPS_MAX];
+};
+
+struct shm_rib_header {
+	u_int32_t magic;
+	u_int32_t version;
+	u_int32_t key_size;    // sizeof(struct shm_rib_key)
+	u_int32_t entry_size;  // sizeof(struct shm_rib_entry)
+	u_int32_t capacity;    // keys and routes, a power of two
+	u_int32_t keys_offset;
+	u_int64_t routes_offset;
+	u_int64_t host_id;
+	int32_t   writer_pid;
+
+	// set when the daemon shut down. the region is gone by then and readers
+	// have to map the new one of the next daemon.
+	u_int32_t closed;
+
+	// everything below is only consistent when read inside the seqlock.
+	u_int64_t seq;
+	u_int64_t changes;  // routes changed since the region was created
+
+	// bit n is set while routes of prefix length n exist. a lookup only
+	// probes those lengths.
+	u_int64_t lens;
+	u_int32_t len_count[33];
+
+	u_int32_t count;       // used keys
+	u_int32_t tombstones;  // deleted keys
+	u_int32_t overflow;    // routes left out because the table was full
+};
+
+#endif  // BGP_SHM_RIB_H
@@ -0,0 +1,582 @@
+// runs one protocol instance per node of a generated topology inside a single
+// process. links are in-memory queues with latency, jitter and loss, and all
+// nodes share a virtual clock, so a run is deterministic for a given seed.
+// the simulation ends once no announcement or withdrawal is in flight.
+
+#include "../logger/logger.h"
+#include "../protocol/protocol.h"
+#include "topology.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIM_TICK_US (TIMER_TICK_MS * 1000)
+
+struct sim_node {
+	struct speaker    speaker;
+	struct io_backend backend;
+	size_t            id;
+};
+
+// link i owns the /30 10.0.0.0 + 4 * i. ends[0] holds .1 and ends[1] .2.
+struct sim_link {
+	struct sim_node* nodes[2];
+	struct iface*    ends[2];
+};
+
+struct sim_event {
+	u_int64_t        time;  // virtual microseconds
+	u_int64_t        seq;   // keeps equal times in send order
+	struct sim_node* node;
+	struct iface*    recv_if;
+	in_addr_t        sender;
+	u_int32_t        len;
+	char*            msg;
+};
+
+struct sim_config {
+	const char* topology;
+	size_t      nodes;
+	size_t      arity;
+	size_t      degree;
+	u_int64_t   latency_us;
+	u_int64_t   jitter_us;
+	double      loss;
+	u_int64_t   max_us;
+	u_int64_t   max_messages;
+	unsigned    seed;
+	int         damp_enabled;
+	int         trace_enabled;
+	int         verbose;
+};
+
+struct sim_stats {
+	u_int64_t messages;
+	u_int64_t update_messages;
+	u_int64_t keepalive_messages;
+	u_int64_t lost;
+	u_int64_t bytes;
+	u_int64_t last_update_us;  // last time a node changed its table
+};
+
+static struct sim_config config = {
+    .topology     = "chain",
+    .nodes        = 16,
+    .arity        = 4,
+    .degree       = 4,
+    .latency_us   = 1000,
+    .max_us       = 600 * 1000000ull,
+    .max_messages = 10000000,
+    .seed         = 1,
+    .damp_enabled = 1,
+};
+
+static struct sim_stats stats;
+
+static struct sim_node* nodes      = NULL;
+static size_t           node_count = 0;
+static struct sim_link* links      = NULL;
+static size_t           link_count = 0;
+
+static u_int64_t now_us   = 0;
+static u_int64_t now_tick = 0;
+static u_int64_t next_seq = 0;
+
+// binary min-heap on (time, seq).
+static struct sim_event* events         = NULL;
+static size_t            event_count    = 0;
+static size_t            event_capacity = 0;
+
+static u_int64_t updates_in_flight = 0;
+
+// traces are stamped with the virtual clock, so they measure the simulated
+// links and not the simulator.
+static u_int64_t
+sim_clock()
+{
+	return now_us * 1000;
+}
+
+static int
+event_before(struct sim_event* a, struct sim_event* b)
+{
+	return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+static int
+push_event(struct sim_event event)
+{
+	if (event_count == event_capacity) {
+		size_t            capacity = event_capacity ? event_capacity * 2 : 1024;
+		struct sim_event* new = realloc(events, capacity * sizeof(*events));
+		if (!new) {
+			LOG_ERROR("failed to grow event queue.");
+			return -1;
+		}
+		events         = new;
+		event_capacity = capacity;
+	}
+
+	size_t i = event_count++;
+	while (i) {
+		size_t parent = (i - 1) / 2;
+		if (!event_before(&event, &events[parent])) {
+			break;
+		}
+		events[i] = events[parent];
+		i         = parent;
+	}
+	events[i] = event;
+	return 0;
+}
+
+static struct sim_event
+pop_event()
+{
+	struct sim_event top  = events[0];
+	struct sim_event last = events[--event_count];
+
+	size_t i = 0;
+	while (1) {
+		size_t child = 2 * i + 1;
+		if (child >= event_count) {
+			break;
+		}
+		if (child + 1 < event_count &&
+		    event_before(&events[child + 1], &events[child])) {
+			++child;
+		}
+		if (!event_before(&events[child], &last)) {
+			break;
+		}
+		events[i] = events[child];
+		i         = child;
+	}
+	if (event_count) {
+		events[i] = last;
+	}
+	return top;
+}
+
+static int
+sim_init(struct io_backend* self, u_int16_t port)
+{
+	return 0;
+}
+
+static int
+sim_recv(struct io_backend* self, struct io_datagram* dgram)
+{
+	return -1;
+}
+
+static void
+sim_release(struct io_backend* self, struct io_datagram* dgram)
+{
+}
+
+// every datagram is queued for the other end of the link it was sent on.
+static int
+sim_send_batch(struct io_backend* self, struct io_send_req* reqs, int count)
+{
+	for (int i = 0; i < count; i++) {
+		struct iface*    iface = iface_of(reqs[i].owner);
+		struct sim_link* link  = &links[iface->index];
+		int              peer  = link->ends[0] == iface;
+		int              type  = ((struct update_message*)reqs[i].msg)->type;
+
+		reqs[i].result = reqs[i].len;
+		++stats.messages;
+		stats.bytes += reqs[i].len;
+		if (type == MKEEPALIVE) {
+			++stats.keepalive_messages;
+		} else {
+			++stats.update_messages;
+			stats.last_update_us = now_us;
+		}
+
+		if (config.loss > 0 && (double)rand() / RAND_MAX < config.loss) {
+			++stats.lost;
+			continue;
+		}
+
+		struct sim_event event = {
+		    .time    = now_us + config.latency_us,
+		    .seq     = next_seq++,
+		    .node    = link->nodes[peer],
+		    .recv_if = link->ends[peer],
+		    .sender  = iface->addr.sin_addr.s_addr,
+		    .len     = reqs[i].len,
+		    .msg     = malloc(reqs[i].len),
+		};
+		if (config.jitter_us) {
+			event.time += rand() % (config.jitter_us + 1);
+		}
+		if (!event.msg) {
+			LOG_ERROR("failed to allocate message copy.");
+			reqs[i].result = -1;
+			continue;
+		}
+		memcpy(event.msg, reqs[i].msg, reqs[i].len);
+		if (push_event(event)) {
+			free(event.msg);
+			reqs[i].result = -1;
+			continue;
+		}
+		if (type != MKEEPALIVE) {
+			++updates_in_flight;
+		}
+	}
+	return 0;
+}
+
+static void
+sim_destroy(struct io_backend* self)
+{
+}
+
+static const struct io_backend sim_backend = {
+    .name       = "sim",
+    .init       = sim_init,
+    .recv       = sim_recv,
+    .release    = sim_release,
+    .send_batch = sim_send_batch,
+    .destroy    = sim_destroy,
+};
+
+static in_addr_t
+link_addr(size_t link, u_int32_t host)
+{
+	return htonl((10u << 24) + ((u_int32_t)link << 2) + host);
+}
+
+static void
+attach_link(size_t link, int end, struct sim_node* node)
+{
+	char name[IF_NAMESIZE];
+	snprintf(
+	    name, sizeof(name), "sim%u", len_ifs(node->speaker.filtered_ifap));
+
+	struct iface* iface = make_iface(name,
+	                                 link,
+	                                 IFF_UP | IFF_BROADCAST,
+	                                 link_addr(link, end + 1),
+	                                 htonl(0xfffffffc),
+	                                 link_addr(link, 3));
+	if (!iface) {
+		exit(1);
+	}
+	LIST_INSERT_HEAD(&node->speaker.ifaces, iface, entries);
+	node->speaker.filtered_ifap = link_ifaces(&node->speaker.ifaces);
+
+	links[link].nodes[end] = node;
+	links[link].ends[end]  = iface;
+}
+
+static int
+build(struct topology* topo)
+{
+	node_count = topo->nodes;
+	link_count = topo->links;
+	if (link_count >= (1u << 22)) {
+		LOG_ERROR("too many links for the 10.0.0.0/8 address plan.");
+		return -1;
+	}
+	nodes = calloc(node_count, sizeof(struct sim_node));
+	links = calloc(link_count ? link_count : 1, sizeof(struct sim_link));
+	if (!nodes || !links) {
+		LOG_ERROR("failed to allocate %zu nodes.", node_count);
+		return -1;
+	}
+
+	for (size_t i = 0; i < node_count; i++) {
+		struct sim_node* node = &nodes[i];
+		node->id              = i;
+		node->backend         = sim_backend;
+		node->backend.priv    = node;
+
+		speaker               = &node->speaker;
+		speaker->host_id      = i + 1;
+		speaker->io_backend   = &node->backend;
+		speaker->damp_enabled  = config.damp_enabled;
+		speaker->trace_enabled = config.trace_enabled;
+		speaker->trace_clock   = sim_clock;
+		if (protocol_init(0)) {
+			return -1;
+		}
+	}
+
+	for (size_t i = 0; i < link_count; i++) {
+		attach_link(i, 0, &nodes[topo->link[i].a]);
+		attach_link(i, 1, &nodes[topo->link[i].b]);
+	}
+	return 0;
+}
+
+// timers of every node fire at the tick boundaries passed before time.
+static void
+advance_timers(u_int64_t time)
+{
+	while ((now_tick + 1) * SIM_TICK_US <= time) {
+		++now_tick;
+		now_us = now_tick * SIM_TICK_US;
+		for (size_t i = 0; i < node_count; i++) {
+			speaker = &nodes[i].speaker;
+			timer_wheel_advance(&speaker->timers, now_tick);
+		}
+	}
+}
+
+static int
+run()
+{
+	for (size_t i = 0; i < node_count; i++) {
+		speaker = &nodes[i].speaker;
+		self_update(speaker->filtered_ifap);
+	}
+
+	while (updates_in_flight && event_count) {
+		struct sim_event event = pop_event();
+		if (event.time > config.max_us ||
+		    stats.messages > config.max_messages) {
+			free(event.msg);
+			return 0;
+		}
+
+		advance_timers(event.time);
+		now_us = event.time;
+
+		speaker  = &event.node->speaker;
+		int type = ((struct update_message*)event.msg)->type;
+		decision(speaker->filtered_ifap,
+		         &event.recv_if->ifa,
+		         event.sender,
+		         event.msg,
+		         event.len);
+		if (type != MKEEPALIVE) {
+			--updates_in_flight;
+		}
+		free(event.msg);
+	}
+	return !updates_in_flight;
+}
+
+// counts the routes of the node and the distinct addresses they cover. the
+// routing table only holds the best path of each address, alternates stay in
+// the rib. an interface only announces itself on its own link, so addresses
+// are not expected to reach every node.
+static void
+table_size(struct sim_node* node, char* seen, size_t* routes, size_t* covered)
+{
+	struct routing_entry* current;
+
+	*routes  = 0;
+	*covered = 0;
+	LIST_FOREACH (current, &node->speaker.routing_table, entries) {
+		size_t addr = ntohl(current->base) - (10u << 24);
+		++*routes;
+		if (addr < link_count * 4 && !seen[addr]) {
+			seen[addr] = 1;
+			++*covered;
+		}
+	}
+	LIST_FOREACH (current, &node->speaker.routing_table, entries) {
+		size_t addr = ntohl(current->base) - (10u << 24);
+		if (addr < link_count * 4) {
+			seen[addr] = 0;
+		}
+	}
+}
+
+static void
+report(int converged, double wall_seconds)
+{
+	char*     seen          = calloc(link_count * 4, 1);
+	size_t    routes_min    = (size_t)-1;
+	size_t    routes_max    = 0;
+	u_int64_t routes_total  = 0;
+	size_t    covered_min   = (size_t)-1;
+	u_int64_t covered_total = 0;
+
+	for (size_t i = 0; i < node_count; i++) {
+		size_t routes;
+		size_t covered;
+		table_size(&nodes[i], seen, &routes, &covered);
+
+		if (routes < routes_min) {
+			routes_min = routes;
+		}
+		if (routes > routes_max) {
+			routes_max = routes;
+		}
+		if (covered < covered_min) {
+			covered_min = covered;
+		}
+		routes_total += routes;
+		covered_total += covered;
+		if (config.verbose) {
+			printf("node=%zu routes=%zu prefixes=%zu\n", i, routes, covered);
+		}
+	}
+	free(seen);
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	printf("topology=%s nodes=%zu links=%zu latency_us=%lu jitter_us=%lu "
+	       "loss=%.4f converged=%d convergence_ms=%.3f virtual_ms=%.3f "
+	       "messages=%lu update_messages=%lu keepalive_messages=%lu lost=%lu "
+	       "bytes=%lu addresses=%zu routes_min=%zu routes_avg=%.1f "
+	       "routes_max=%zu prefixes_min=%zu prefixes_avg=%.1f "
+	       "wall_seconds=%.3f peak_rss_kb=%ld\n",
+	       config.topology,
+	       node_count,
+	       link_count,
+	       config.latency_us,
+	       config.jitter_us,
+	       config.loss,
+	       converged,
+	       stats.last_update_us / 1000.0,
+	       now_us / 1000.0,
+	       stats.messages,
+	       stats.update_messages,
+	       stats.keepalive_messages,
+	       stats.lost,
+	       stats.bytes,
+	       link_count * 2,
+	       node_count ? routes_min : 0,
+	       node_count ? (double)routes_total / node_count : 0,
+	       routes_max,
+	       node_count ? covered_min : 0,
+	       node_count ? (double)covered_total / node_count : 0,
+	       wall_seconds,
+	       usage.ru_maxrss);
+
+	if (config.trace_enabled) {
+		struct metrics_snapshot snapshot;
+		metrics_collect(&snapshot);
+		printf("traced=%lu propagation_p50_us=%.1f propagation_p99_us=%.1f "
+		       "propagation_max_us=%.1f hop_p50_us=%.1f hop_p99_us=%.1f\n",
+		       snapshot.counts[METRIC_TRACE_PROPAGATION_NS],
+		       metrics_percentile(
+		           &snapshot, METRIC_TRACE_PROPAGATION_NS, 0.50) /
+		           1000.0,
+		       metrics_percentile(
+		           &snapshot, METRIC_TRACE_PROPAGATION_NS, 0.99) /
+		           1000.0,
+		       snapshot.histograms[METRIC_TRACE_PROPAGATION_NS].max / 1000.0,
+		       metrics_percentile(&snapshot, METRIC_TRACE_HOP_NS, 0.50) /
+		           1000.0,
+		       metrics_percentile(&snapshot, METRIC_TRACE_HOP_NS, 0.99) /
+		           1000.0);
+	}
+}
+
+static void
+cleanup()
+{
+	while (event_count) {
+		free(pop_event().msg);
+	}
+	free(events);
+	for (size_t i = 0; i < node_count; i++) {
+		speaker = &nodes[i].speaker;
+		protocol_free();
+		free_ifaces(&speaker->ifaces);
+	}
+	free(nodes);
+	free(links);
+}
+
+static void
+print_usage(const char* name)
+{
+	printf("usage: %s [-t chain|ring|fattree|random] [-n nodes] [-k arity] "
+	       "[-d degree]\n"
+	       "       [-l ms] [-j ms] [-p loss] [-m seconds] [-c messages]\n"
+	       "       [-s seed] [-D] [-T] [-v]\n",
+	       name);
+	printf("\t-t\ttopology, chain by default\n");
+	printf("\t-n\tnodes of chain, ring and random graphs\n");
+	printf("\t-k\tarity of the fat tree\n");
+	printf("\t-d\tmean degree of the random graph\n");
+	printf("\t-l\tlink latency\n");
+	printf("\t-j\tuniform extra latency up to the given amount\n");
+	printf("\t-p\tprobability of losing a datagram\n");
+	printf("\t-m\tvirtual time limit\n");
+	printf("\t-c\tlimit of sent messages\n");
+	printf("\t-s\trandom seed\n");
+	printf("\t-D\tdisable route flap dampening\n");
+	printf("\t-T\ttrace updates and report propagation times\n");
+	printf("\t-v\tprint the table size of every node\n");
+}
+
+int
+main(int argc, char** argv)
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "t:n:k:d:l:j:p:m:c:s:DTvh")) != -1) {
+		if (opt == 't') {
+			config.topology = optarg;
+		} else if (opt == 'n') {
+			config.nodes = strtoul(optarg, NULL, 10);
+		} else if (opt == 'k') {
+			config.arity = strtoul(optarg, NULL, 10);
+		} else if (opt == 'd') {
+			config.degree = strtoul(optarg, NULL, 10);
+		} else if (opt == 'l') {
+			config.latency_us = strtod(optarg, NULL) * 1000;
+		} else if (opt == 'j') {
+			config.jitter_us = strtod(optarg, NULL) * 1000;
+		} else if (opt == 'p') {
+			config.loss = strtod(optarg, NULL);
+		} else if (opt == 'm') {
+			config.max_us = strtod(optarg, NULL) * 1000000;
+		} else if (opt == 'c') {
+			config.max_messages = strtoull(optarg, NULL, 10);
+		} else if (opt == 's') {
+			config.seed = strtoul(optarg, NULL, 10);
+		} else if (opt == 'D') {
+			config.damp_enabled = 0;
+		} else if (opt == 'T') {
+			config.trace_enabled = 1;
+		} else if (opt == 'v') {
+			config.verbose = 1;
+		} else {
+			print_usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	set_log_level(LERROR);
+	srand(config.seed);
+
+	struct topology topo;
+	if (make_topology(&topo,
+	                  config.topology,
+	                  config.nodes,
+	                  config.arity,
+	                  config.degree)) {
+		return 1;
+	}
+	if (build(&topo)) {
+		free_topology(&topo);
+		return 1;
+	}
+	free_topology(&topo);
+
+	struct timespec start;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int converged = run();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	report(converged,
+	       (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+	cleanup();
+	return converged ? 0 : 2;
+}
@@ -0,0 +1,185 @@
+#include "topology.h"
+#include "../logger/logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+static int
+alloc_links(struct topology* topo, size_t nodes, size_t links)
+{
+	topo->nodes = nodes;
+	topo->links = 0;
+	topo->link  = calloc(links ? links : 1, sizeof(struct topology_link));
+	if (!topo->link) {
+		LOG_ERROR("failed to allocate %zu links.", links);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+add_link(struct topology* topo, size_t a, size_t b)
+{
+	topo->link[topo->links].a = a;
+	topo->link[topo->links].b = b;
+	++topo->links;
+}
+
+int
+make_chain(struct topology* topo, size_t nodes)
+{
+	if (nodes < 2) {
+		LOG_ERROR("a chain needs at least 2 nodes.");
+		return -1;
+	}
+	if (alloc_links(topo, nodes, nodes - 1)) {
+		return -1;
+	}
+	for (size_t i = 0; i + 1 < nodes; i++) {
+		add_link(topo, i, i + 1);
+	}
+	return 0;
+}
+
+int
+make_ring(struct topology* topo, size_t nodes)
+{
+	if (nodes < 3) {
+		LOG_ERROR("a ring needs at least 3 nodes.");
+		return -1;
+	}
+	if (alloc_links(topo, nodes, nodes)) {
+		return -1;
+	}
+	for (size_t i = 0; i < nodes; i++) {
+		add_link(topo, i, (i + 1) % nodes);
+	}
+	return 0;
+}
+
+// the switches of a k-ary fat tree: (k/2)^2 core switches, then k pods of
+// k/2 aggregation followed by k/2 edge switches. hosts are left out.
+int
+make_fat_tree(struct topology* topo, size_t arity)
+{
+	if (arity < 2 || arity % 2) {
+		LOG_ERROR("fat tree arity must be even and at least 2.");
+		return -1;
+	}
+	size_t half  = arity / 2;
+	size_t cores = half * half;
+	if (alloc_links(topo, cores + arity * arity, arity * arity * arity / 2)) {
+		return -1;
+	}
+
+	for (size_t pod = 0; pod < arity; pod++) {
+		size_t agg  = cores + pod * arity;
+		size_t edge = agg + half;
+		for (size_t i = 0; i < half; i++) {
+			for (size_t j = 0; j < half; j++) {
+				add_link(topo, edge + i, agg + j);
+				add_link(topo, agg + i, i * half + j);
+			}
+		}
+	}
+	return 0;
+}
+
+static u_int64_t
+link_key(size_t a, size_t b)
+{
+	return a < b ? ((u_int64_t)a << 32) | b : ((u_int64_t)b << 32) | a;
+}
+
+// open addressing over link keys. 0 marks an empty slot, which no link can
+// produce since a and b always differ.
+static int
+insert_key(u_int64_t* set, size_t mask, u_int64_t key)
+{
+	size_t i = (key * 0x9e3779b97f4a7c15ull) >> 17 & mask;
+	while (set[i]) {
+		if (set[i] == key) {
+			return 0;
+		}
+		i = (i + 1) & mask;
+	}
+	set[i] = key;
+	return 1;
+}
+
+// a random spanning tree keeps the graph connected, the remaining links are
+// drawn uniformly until the mean degree is reached.
+int
+make_random_graph(struct topology* topo, size_t nodes, size_t degree)
+{
+	if (nodes < 2) {
+		LOG_ERROR("a random graph needs at least 2 nodes.");
+		return -1;
+	}
+	if (degree >= nodes) {
+		degree = nodes - 1;
+	}
+	size_t links = nodes * degree / 2;
+	if (links < nodes - 1) {
+		links = nodes - 1;
+	}
+	if (alloc_links(topo, nodes, links)) {
+		return -1;
+	}
+
+	size_t slots = 1;
+	while (slots < links * 2) {
+		slots <<= 1;
+	}
+	u_int64_t* set = calloc(slots, sizeof(u_int64_t));
+	if (!set) {
+		LOG_ERROR("failed to allocate link set.");
+		free_topology(topo);
+		return -1;
+	}
+
+	for (size_t i = 1; i < nodes; i++) {
+		size_t parent = rand() % i;
+		insert_key(set, slots - 1, link_key(parent, i));
+		add_link(topo, parent, i);
+	}
+	while (topo->links < links) {
+		size_t a = rand() % nodes;
+		size_t b = rand() % nodes;
+		if (a != b && insert_key(set, slots - 1, link_key(a, b))) {
+			add_link(topo, a, b);
+		}
+	}
+
+	free(set);
+	return 0;
+}
+
+int
+make_topology(struct topology* topo,
+              const char*      name,
+              size_t           nodes,
+              size_t           arity,
+              size_t           degree)
+{
+	memset(topo, 0, sizeof(*topo));
+	if (!strcmp(name, "chain")) {
+		return make_chain(topo, nodes);
+	} else if (!strcmp(name, "ring")) {
+		return make_ring(topo, nodes);
+	} else if (!strcmp(name, "fattree")) {
+		return make_fat_tree(topo, arity);
+	} else if (!strcmp(name, "random")) {
+		return make_random_graph(topo, nodes, degree);
+	}
+	LOG_ERROR("unknown topology: %s", name);
+	return -1;
+}
+
+void
+free_topology(struct topology* topo)
+{
+	free(topo->link);
+	topo->link  = NULL;
+	topo->links = 0;
+}
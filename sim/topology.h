@@ -0,0 +1,34 @@
+#ifndef BGP_SIM_TOPOLOGY_H
+#define BGP_SIM_TOPOLOGY_H
+
+#include <stddef.h>
+
+// every link is a point to point connection between two distinct nodes.
+struct topology_link {
+	size_t a;
+	size_t b;
+};
+
+struct topology {
+	size_t                nodes;
+	size_t                links;
+	struct topology_link* link;
+};
+
+int make_chain(struct topology* topo, size_t nodes);
+
+int make_ring(struct topology* topo, size_t nodes);
+
+int make_fat_tree(struct topology* topo, size_t arity);
+
+int make_random_graph(struct topology* topo, size_t nodes, size_t degree);
+
+int make_topology(struct topology* topo,
+                  const char*      name,
+                  size_t           nodes,
+                  size_t           arity,
+                  size_t           degree);
+
+void free_topology(struct topology* topo);
+
+#endif  // BGP_SIM_TOPOLOGY_H
@@ -0,0 +1,129 @@
+#include "timer_wheel.h"
+
+void
+timer_wheel_init(struct timer_wheel* wheel, u_int64_t now)
+{
+	wheel->now   = now;
+	wheel->count = 0;
+	for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+			LIST_INIT(&wheel->slots[level][slot]);
+		}
+	}
+}
+
+void
+timer_init(struct timer* timer, timer_callback callback, void* arg)
+{
+	timer->expires  = 0;
+	timer->callback = callback;
+	timer->arg      = arg;
+	timer->pending  = 0;
+}
+
+// a timer goes to the lowest level whose span still covers its distance from
+// now, so it is cascaded at most once per level before it fires.
+static void
+timer_place(struct timer_wheel* wheel, struct timer* timer)
+{
+	u_int64_t expires = timer->expires;
+	u_int64_t delta   = expires > wheel->now ? expires - wheel->now : 0;
+
+	if (delta >= TIMER_WHEEL_RANGE) {
+		expires = wheel->now + TIMER_WHEEL_RANGE - 1;
+		delta   = TIMER_WHEEL_RANGE - 1;
+	}
+
+	int level = 0;
+	while (level < TIMER_WHEEL_LEVELS - 1 &&
+	       delta >= ((u_int64_t)1 << (TIMER_WHEEL_BITS * (level + 1)))) {
+		++level;
+	}
+	int slot = (expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+	LIST_INSERT_HEAD(&wheel->slots[level][slot], timer, entries);
+}
+
+void
+timer_arm(struct timer_wheel* wheel, struct timer* timer, u_int64_t ticks)
+{
+	if (timer->pending) {
+		LIST_REMOVE(timer, entries);
+	} else {
+		++wheel->count;
+	}
+	// a timer armed from a callback must not land in the slot being run.
+	timer->expires = wheel->now + (ticks ? ticks : 1);
+	timer->pending = 1;
+	timer_place(wheel, timer);
+}
+
+void
+timer_cancel(struct timer_wheel* wheel, struct timer* timer)
+{
+	if (!timer->pending) {
+		return;
+	}
+	LIST_REMOVE(timer, entries);
+	timer->pending = 0;
+	--wheel->count;
+}
+
+int
+timer_pending(const struct timer* timer)
+{
+	return timer->pending;
+}
+
+static void
+cascade(struct timer_wheel* wheel, int level)
+{
+	int slot = (wheel->now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+	struct timer_list pending = wheel->slots[level][slot];
+	struct timer*     timer;
+
+	if (LIST_FIRST(&pending)) {
+		LIST_FIRST(&pending)->entries.le_prev = &LIST_FIRST(&pending);
+	}
+	LIST_INIT(&wheel->slots[level][slot]);
+
+	while ((timer = LIST_FIRST(&pending))) {
+		LIST_REMOVE(timer, entries);
+		timer_place(wheel, timer);
+	}
+
+	if (slot == 0 && level + 1 < TIMER_WHEEL_LEVELS) {
+		cascade(wheel, level + 1);
+	}
+}
+
+// runs every timer that expired up to now. callbacks may arm or cancel any
+// timer, including the one being run. returns the number of timers fired.
+size_t
+timer_wheel_advance(struct timer_wheel* wheel, u_int64_t now)
+{
+	size_t fired = 0;
+
+	while (wheel->now < now) {
+		if (!wheel->count) {
+			wheel->now = now;
+			break;
+		}
+
+		++wheel->now;
+		int slot = wheel->now & TIMER_WHEEL_MASK;
+		if (slot == 0) {
+			cascade(wheel, 1);
+		}
+
+		struct timer_list* list = &wheel->slots[0][slot];
+		struct timer*      timer;
+		while ((timer = LIST_FIRST(list))) {
+			LIST_REMOVE(timer, entries);
+			timer->pending = 0;
+			--wheel->count;
+			++fired;
+			timer->callback(timer, timer->arg);
+		}
+	}
+	return fired;
+}
@@ -0,0 +1,50 @@
+#ifndef BGP_TIMER_WHEEL_H
+#define BGP_TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <sys/queue.h>
+#include <sys/types.h>
+
+#define TIMER_WHEEL_BITS   6
+#define TIMER_WHEEL_SLOTS  (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK   (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4
+
+// timers further away than this are parked in the last level and cascaded
+// again once they come into range.
+#define TIMER_WHEEL_RANGE                                                      \
+	((u_int64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+struct timer;
+
+typedef void (*timer_callback)(struct timer* timer, void* arg);
+
+struct timer {
+	u_int64_t      expires;  // absolute tick
+	timer_callback callback;
+	void*          arg;
+	int            pending;
+	LIST_ENTRY(timer) entries;
+};
+
+LIST_HEAD(timer_list, timer);
+
+struct timer_wheel {
+	u_int64_t         now;
+	size_t            count;
+	struct timer_list slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+void timer_wheel_init(struct timer_wheel* wheel, u_int64_t now);
+
+void timer_init(struct timer* timer, timer_callback callback, void* arg);
+
+void timer_arm(struct timer_wheel* wheel, struct timer* timer, u_int64_t ticks);
+
+void timer_cancel(struct timer_wheel* wheel, struct timer* timer);
+
+int timer_pending(const struct timer* timer);
+
+size_t timer_wheel_advance(struct timer_wheel* wheel, u_int64_t now);
+
+#endif  // BGP_TIMER_WHEEL_H
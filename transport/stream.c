@@ -0,0 +1,368 @@
+#include "stream.h"
+#include "../logger/logger.h"
+#include "../mem/mem_account.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define STREAM_IN_BUF_STEP 4096
+
+#ifndef STAILQ_FOREACH_SAFE
+#define STAILQ_FOREACH_SAFE(var, head, field, tvar)                            \
+	for ((var) = STAILQ_FIRST((head));                                         \
+	     (var) && ((tvar) = STAILQ_NEXT((var), field), 1);                     \
+	     (var) = (tvar))
+#endif
+
+static int
+set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0) {
+		return -1;
+	}
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static struct stream_peer*
+make_stream_peer(int fd, in_addr_t addr, enum stream_state state)
+{
+	struct stream_peer* peer = calloc(1, sizeof(struct stream_peer));
+	if (!peer) {
+		LOG_ERROR("failed to allocate stream peer.");
+		return NULL;
+	}
+	peer->fd    = fd;
+	peer->addr  = addr;
+	peer->state = state;
+	pthread_mutex_init(&peer->lock, NULL);
+	STAILQ_INIT(&peer->out_queue);
+
+	int nodelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	return peer;
+}
+
+int
+stream_listen(in_addr_t addr, u_int16_t port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		LOG_ERROR("failed to create stream socket. errno: %d", errno);
+		return -1;
+	}
+
+	int reuse = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	struct sockaddr_in listen_addr;
+	memset(&listen_addr, 0, sizeof(listen_addr));
+	listen_addr.sin_family      = AF_INET;
+	listen_addr.sin_port        = htons(port);
+	listen_addr.sin_addr.s_addr = addr;
+
+	if (bind(fd, (const struct sockaddr*)&listen_addr, sizeof(listen_addr)) <
+	    0) {
+		LOG_ERROR("failed to bind stream socket. errno: %d", errno);
+		close(fd);
+		return -1;
+	}
+	if (listen(fd, SOMAXCONN) < 0 || set_nonblocking(fd) < 0) {
+		LOG_ERROR("failed to listen on stream socket. errno: %d", errno);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+struct stream_peer*
+stream_peer_connect(in_addr_t addr, u_int16_t port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		LOG_ERROR("failed to create stream socket. errno: %d", errno);
+		return NULL;
+	}
+	if (set_nonblocking(fd) < 0) {
+		LOG_ERROR("failed to set stream socket nonblocking. errno: %d", errno);
+		close(fd);
+		return NULL;
+	}
+
+	struct sockaddr_in dest_addr;
+	memset(&dest_addr, 0, sizeof(dest_addr));
+	dest_addr.sin_family      = AF_INET;
+	dest_addr.sin_port        = htons(port);
+	dest_addr.sin_addr.s_addr = addr;
+
+	enum stream_state state = SESTABLISHED;
+	if (connect(fd, (const struct sockaddr*)&dest_addr, sizeof(dest_addr)) <
+	    0) {
+		if (errno != EINPROGRESS) {
+			LOG_WARN("stream connect failed. errno: %d", errno);
+			close(fd);
+			return NULL;
+		}
+		state = SCONNECTING;
+	}
+
+	struct stream_peer* peer = make_stream_peer(fd, addr, state);
+	if (!peer) {
+		close(fd);
+	}
+	return peer;
+}
+
+struct stream_peer*
+stream_peer_accept(int listen_fd)
+{
+	struct sockaddr_in peer_addr;
+	socklen_t          addrlen = sizeof(peer_addr);
+
+	int fd = accept(listen_fd, (struct sockaddr*)&peer_addr, &addrlen);
+	if (fd < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			LOG_WARN("stream accept failed. errno: %d", errno);
+		}
+		return NULL;
+	}
+	if (set_nonblocking(fd) < 0) {
+		LOG_ERROR("failed to set stream socket nonblocking. errno: %d", errno);
+		close(fd);
+		return NULL;
+	}
+
+	struct stream_peer* peer =
+	    make_stream_peer(fd, peer_addr.sin_addr.s_addr, SESTABLISHED);
+	if (!peer) {
+		close(fd);
+	}
+	return peer;
+}
+
+int
+stream_peer_finish_connect(struct stream_peer* peer)
+{
+	int       err = 0;
+	socklen_t len = sizeof(err);
+	if (getsockopt(peer->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+		LOG_WARN("stream connect failed. errno: %d", err ? err : errno);
+		peer->state = SCLOSED;
+		return -1;
+	}
+	peer->state = SESTABLISHED;
+	return 0;
+}
+
+int
+stream_peer_send(struct stream_peer* peer, const char* msg, u_int32_t len)
+{
+	if (len > STREAM_MAX_FRAME) {
+		LOG_ERROR("frame too large for stream transport. size: %u", len);
+		return -1;
+	}
+
+	struct stream_frame* frame =
+	    malloc(sizeof(struct stream_frame) + STREAM_HEADER_SIZE + len);
+	if (!frame) {
+		LOG_ERROR("failed to allocate stream frame.");
+		return -1;
+	}
+	u_int32_t header = htonl(len);
+	memcpy(frame->data, &header, STREAM_HEADER_SIZE);
+	memcpy(frame->data + STREAM_HEADER_SIZE, msg, len);
+	frame->size   = STREAM_HEADER_SIZE + len;
+	frame->offset = 0;
+	mem_charge(MEM_BUFFERS, sizeof(struct stream_frame) + frame->size);
+
+	pthread_mutex_lock(&peer->lock);
+	STAILQ_INSERT_TAIL(&peer->out_queue, frame, entries);
+	peer->out_bytes += frame->size;
+	size_t queued = peer->out_bytes;
+	pthread_mutex_unlock(&peer->lock);
+
+	if (queued >= STREAM_FLUSH_THRESHOLD) {
+		return stream_peer_flush(peer);
+	}
+	return 0;
+}
+
+// writes as much of the output queue as the socket accepts, gathering up to
+// STREAM_IOV_MAX frames per writev(). returns 0 when the queue is drained or
+// the socket would block, -1 on fatal error.
+int
+stream_peer_flush(struct stream_peer* peer)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&peer->lock);
+	if (peer->state != SESTABLISHED) {
+		goto TERM;
+	}
+
+	while (!STAILQ_EMPTY(&peer->out_queue)) {
+		struct iovec         iov[STREAM_IOV_MAX];
+		int                  iovcnt = 0;
+		struct stream_frame* frame;
+
+		STAILQ_FOREACH (frame, &peer->out_queue, entries) {
+			if (iovcnt == STREAM_IOV_MAX) {
+				break;
+			}
+			iov[iovcnt].iov_base = frame->data + frame->offset;
+			iov[iovcnt].iov_len  = frame->size - frame->offset;
+			++iovcnt;
+		}
+
+		ssize_t n = writev(peer->fd, iov, iovcnt);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			if (errno == EINTR) {
+				continue;
+			}
+			LOG_WARN("stream write failed. errno: %d", errno);
+			peer->state = SCLOSED;
+			ret         = -1;
+			break;
+		}
+
+		peer->out_bytes -= n;
+		while (n > 0) {
+			frame          = STAILQ_FIRST(&peer->out_queue);
+			size_t remains = frame->size - frame->offset;
+			if ((size_t)n < remains) {
+				frame->offset += n;
+				break;
+			}
+			n -= remains;
+			STAILQ_REMOVE_HEAD(&peer->out_queue, entries);
+			mem_uncharge(MEM_BUFFERS,
+			             sizeof(struct stream_frame) + frame->size);
+			free(frame);
+		}
+	}
+
+TERM:
+	pthread_mutex_unlock(&peer->lock);
+	return ret;
+}
+
+int
+stream_peer_wants_write(struct stream_peer* peer)
+{
+	pthread_mutex_lock(&peer->lock);
+	int ret = peer->state == SCONNECTING ||
+	          (peer->state == SESTABLISHED && !STAILQ_EMPTY(&peer->out_queue));
+	pthread_mutex_unlock(&peer->lock);
+	return ret;
+}
+
+static int
+dispatch_frames(struct stream_peer*  peer,
+                stream_frame_handler handler,
+                void*                arg)
+{
+	u_int32_t consumed = 0;
+	while (peer->in_len - consumed >= STREAM_HEADER_SIZE) {
+		u_int32_t header;
+		memcpy(&header, peer->in_buf + consumed, STREAM_HEADER_SIZE);
+		u_int32_t len = ntohl(header);
+		if (len > STREAM_MAX_FRAME) {
+			LOG_ERROR("oversized frame from stream peer. size: %u", len);
+			return -1;
+		}
+		if (peer->in_len - consumed - STREAM_HEADER_SIZE < len) {
+			break;
+		}
+		handler(peer, peer->in_buf + consumed + STREAM_HEADER_SIZE, len, arg);
+		consumed += STREAM_HEADER_SIZE + len;
+	}
+
+	if (consumed) {
+		memmove(peer->in_buf, peer->in_buf + consumed, peer->in_len - consumed);
+		peer->in_len -= consumed;
+	}
+	return 0;
+}
+
+// reads everything currently available on the socket and calls handler once
+// per complete frame. partial frames stay buffered until the next call.
+// returns -1 when the peer should be dropped.
+int
+stream_peer_read(struct stream_peer*  peer,
+                 stream_frame_handler handler,
+                 void*                arg)
+{
+	while (1) {
+		if (peer->in_cap - peer->in_len < STREAM_IN_BUF_STEP) {
+			u_int32_t new_cap = peer->in_cap + STREAM_IN_BUF_STEP;
+			if (new_cap > STREAM_MAX_FRAME + STREAM_HEADER_SIZE +
+			                  STREAM_IN_BUF_STEP) {
+				LOG_ERROR("stream input buffer overflow.");
+				return -1;
+			}
+			char* new_buf = realloc(peer->in_buf, new_cap);
+			if (!new_buf) {
+				LOG_ERROR("failed to grow stream input buffer.");
+				return -1;
+			}
+			if (!peer->in_buf) {
+				mem_charge(MEM_BUFFERS, new_cap);
+			} else {
+				mem_recharge(MEM_BUFFERS, peer->in_cap, new_cap);
+			}
+			peer->in_buf = new_buf;
+			peer->in_cap = new_cap;
+		}
+
+		ssize_t n = read(peer->fd,
+		                 peer->in_buf + peer->in_len,
+		                 peer->in_cap - peer->in_len);
+		if (n == 0) {
+			LOG_INFO("stream peer closed connection.");
+			return -1;
+		}
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+			if (errno == EINTR) {
+				continue;
+			}
+			LOG_WARN("stream read failed. errno: %d", errno);
+			return -1;
+		}
+		peer->in_len += n;
+
+		if (dispatch_frames(peer, handler, arg) < 0) {
+			return -1;
+		}
+	}
+}
+
+void
+stream_peer_free(struct stream_peer* peer)
+{
+	struct stream_frame* frame;
+	struct stream_frame* temp;
+
+	close(peer->fd);
+	STAILQ_FOREACH_SAFE (frame, &peer->out_queue, entries, temp) {
+		mem_uncharge(MEM_BUFFERS, sizeof(struct stream_frame) + frame->size);
+		free(frame);
+	}
+	pthread_mutex_destroy(&peer->lock);
+	if (peer->in_buf) {
+		mem_uncharge(MEM_BUFFERS, peer->in_cap);
+	}
+	free(peer->in_buf);
+	free(peer);
+}
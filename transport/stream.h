@@ -0,0 +1,81 @@
+#ifndef BGP_STREAM_H
+#define BGP_STREAM_H
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/queue.h>
+#include <sys/types.h>
+
+#define STREAM_PORT 5152
+
+// frames larger than this are treated as a protocol error and the peer is
+// dropped.
+#define STREAM_MAX_FRAME (1 << 20)
+
+// upper bound of frames gathered into a single writev() call.
+#define STREAM_IOV_MAX 64
+
+// queued bytes above which stream_peer_send() flushes immediately instead of
+// waiting for the transport loop.
+#define STREAM_FLUSH_THRESHOLD (64 * 1024)
+
+#define STREAM_HEADER_SIZE sizeof(u_int32_t)
+
+struct stream_frame {
+	u_int32_t size;    // header + payload
+	u_int32_t offset;  // bytes already written to the socket
+	STAILQ_ENTRY(stream_frame) entries;
+	char data[];  // u_int32_t payload length in network order, then payload
+};
+
+enum stream_state {
+	SCONNECTING = 0,
+	SESTABLISHED,
+	SCLOSED,
+};
+
+struct stream_peer {
+	int               fd;
+	enum stream_state state;
+	in_addr_t         addr;
+	void*             owner;
+
+	// output side, shared between the sending threads and the transport loop.
+	pthread_mutex_t lock;
+	STAILQ_HEAD(, stream_frame) out_queue;
+	size_t out_bytes;
+
+	// input side, only touched by the transport loop.
+	char*     in_buf;
+	u_int32_t in_len;
+	u_int32_t in_cap;
+
+	LIST_ENTRY(stream_peer) entries;
+};
+
+typedef int (*stream_frame_handler)(struct stream_peer* peer,
+                                    char*               frame,
+                                    u_int32_t           len,
+                                    void*               arg);
+
+int stream_listen(in_addr_t addr, u_int16_t port);
+
+struct stream_peer* stream_peer_connect(in_addr_t addr, u_int16_t port);
+
+struct stream_peer* stream_peer_accept(int listen_fd);
+
+int stream_peer_finish_connect(struct stream_peer* peer);
+
+int stream_peer_send(struct stream_peer* peer, const char* msg, u_int32_t len);
+
+int stream_peer_flush(struct stream_peer* peer);
+
+int stream_peer_wants_write(struct stream_peer* peer);
+
+int stream_peer_read(struct stream_peer*  peer,
+                     stream_frame_handler handler,
+                     void*                arg);
+
+void stream_peer_free(struct stream_peer* peer);
+
+#endif  // BGP_STREAM_H